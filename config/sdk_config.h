@@ -1381,6 +1381,14 @@
 // </h> 
 //==========================================================
 
+// <o> NRF_DFU_APP_DATA_AREA_SIZE - Size of application data kept by bootloader on DFU. 
+// <i> Must be the same as in sdk_config.h of bootloader.
+// <i> It covers fds, log and fs partitions of fs_partition.h: (FDS_VIRTUAL_PAGES_RESERVED + FDS_VIRTUAL_PAGES) pages.
+
+#ifndef NRF_DFU_APP_DATA_AREA_SIZE
+#define NRF_DFU_APP_DATA_AREA_SIZE 53248
+#endif
+
 // </h> 
 //==========================================================
 
@@ -6732,9 +6740,10 @@
 // <i> FDS module stores its data in the last pages of the flash memory.
 // <i> By setting this value, you can move flash end address used by the FDS.
 // <i> As a result the reserved space can be used by other modules.
+// <i> Reserved pages hold modules/fs and log partitions, see fs_partition.h.
 
 #ifndef FDS_VIRTUAL_PAGES_RESERVED
-#define FDS_VIRTUAL_PAGES_RESERVED 0
+#define FDS_VIRTUAL_PAGES_RESERVED 10
 #endif
 
 // </h> 
@@ -7250,9 +7259,10 @@
 //==========================================================
 // <o> NRF_FSTORAGE_SD_QUEUE_SIZE - Size of the internal queue of operations 
 // <i> Increase this value if API calls frequently return the error @ref NRF_ERROR_NO_MEM.
+// <i> fs queues up to three operations per record, fds and fs_log take own slots.
 
 #ifndef NRF_FSTORAGE_SD_QUEUE_SIZE
-#define NRF_FSTORAGE_SD_QUEUE_SIZE 4
+#define NRF_FSTORAGE_SD_QUEUE_SIZE 8
 #endif
 
 // <o> NRF_FSTORAGE_SD_MAX_RETRIES - Maximum number of attempts at executing an operation when the SoftDevice is busy 
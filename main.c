@@ -90,6 +90,8 @@
     #include "modules/commands/commands.h"
 #endif
 #include "modules/fs/fs.h"
+#include "modules/fs/fs_log.h"
+#include "modules/fs/fs_vars.h"
 #include "modules/button_control/button_control.h"
 #include "modules/color_types/color_types.h"
 #include "modules/led_color/led_color.h"
@@ -106,6 +108,21 @@
 
 #define CHANGE_COLOR_SPEED_TIME_US 2000
 
+/* Types of fs_log entries written by application, see log_dump command */
+#define LOG_EVENT_COLOR 1
+#define LOG_EVENT_CLICKS 2
+#define LOG_EVENT_CONNECTED 3
+#define LOG_EVENT_DISCONNECTED 4
+/* Color is logged once it stays unchanged for this time, so fast changes don`t wear log pages */
+#define COLOR_LOG_QUIET_MS FS_VARS_QUIET_MS
+
+/* Persistent statistics kept in fs counters */
+#define COUNTER_CONNECTIONS "connections"
+#define COUNTER_COLOR_CHANGES "color_changes"
+#define COUNTER_UPTIME_HOURS "uptime_hours"
+#define UPTIME_TIMER_INTERVAL_MS 60000
+#define UPTIME_TIMER_TICKS_PER_HOUR 60
+
 #define DEVICE_NAME                     "BLE LED Service"        /**< Name of device. Will be included in the advertising data. */
 #define MANUFACTURER_NAME               "NordicSemiconductor"                   /**< Manufacturer. Will be passed to Device Information Service. */
 #define APP_ADV_INTERVAL                300                                     /**< The advertising interval (in units of 0.625 ms. This value corresponds to 187.5 ms). */
@@ -123,6 +140,15 @@
 #define NEXT_CONN_PARAMS_UPDATE_DELAY   APP_TIMER_TICKS(30000)                  /**< Time between each call to sd_ble_gap_conn_param_update after the first call (30 seconds). */
 #define MAX_CONN_PARAMS_UPDATE_COUNT    3                                       /**< Number of attempts before giving up the connection parameter negotiation. */
 
+#define SEC_PARAM_BOND                  1                                       /**< Perform bonding, bonds are stored by fds below fs partition. */
+#define SEC_PARAM_MITM                  0                                       /**< Man In The Middle protection not required. */
+#define SEC_PARAM_LESC                  0                                       /**< LE Secure Connections not enabled. */
+#define SEC_PARAM_KEYPRESS              0                                       /**< Keypress notifications not enabled. */
+#define SEC_PARAM_IO_CAPABILITIES       BLE_GAP_IO_CAPS_NONE                    /**< No I/O capabilities. */
+#define SEC_PARAM_OOB                   0                                       /**< Out Of Band data not available. */
+#define SEC_PARAM_MIN_KEY_SIZE          7                                       /**< Minimum encryption key size. */
+#define SEC_PARAM_MAX_KEY_SIZE          16                                      /**< Maximum encryption key size. */
+
 #define DEAD_BEEF                       0xDEADBEEF                              /**< Value used as error code on stack dump, can be used to identify stack location on stack unwind. */
 
 
@@ -143,6 +169,7 @@ ble_estc_service_t m_service_example; /**< ESTC example BLE service */
 
 
 APP_TIMER_DEF(led1_blink_timer);                                                /**< Timer to blink led1 when changing led2 color*/
+APP_TIMER_DEF(uptime_timer);                                                    /**< Timer to count uptime hours */
 
 /* Code to changing led2 color with button press*/
 typedef enum {
@@ -160,10 +187,50 @@ static volatile bool should_change_color = false;
 
 static nrfx_systick_state_t change_color_speed_timer;
 
+/* Restored by fs_vars_init(), color speed can be tuned by var command */
+FS_VAR_DEF(hsv_data_t, last_hsv, "last_hsv", {.h = 360 * 77 / 100, .s = 100, .v = 100});
+FS_VAR_DEF(uint32_t, change_color_speed_us, "color_speed_us", CHANGE_COLOR_SPEED_TIME_US);
+
 static hsv_data_t hsv;
 
+static struct {
+    hsv_data_t hsv;
+    uint32_t changed_ticks;
+    bool pending;
+} color_log_s;
+
+/* Can be called from interrupt handlers, entry is dropped if log queue is full */
+static void log_event(uint8_t type, const void *data, uint8_t length) {
+    ret_code_t err_code = fs_log_append(type, data, length);
+    if (err_code != NRF_SUCCESS) {
+        NRF_LOG_WARNING("Log entry of type %" PRIu8 " is dropped, error %" PRIu32, type, err_code);
+    }
+}
+
+static void color_log_changed(const hsv_data_t *p_hsv) {
+    color_log_s.hsv = *p_hsv;
+    color_log_s.changed_ticks = app_timer_cnt_get();
+    color_log_s.pending = true;
+}
+
+static void color_log_process() {
+    if (!color_log_s.pending ||
+        app_timer_cnt_diff_compute(app_timer_cnt_get(), color_log_s.changed_ticks) < APP_TIMER_TICKS(COLOR_LOG_QUIET_MS)) {
+        return;
+    }
+    ret_code_t err_code = fs_log_append(LOG_EVENT_COLOR, &color_log_s.hsv, sizeof(color_log_s.hsv));
+    if (err_code != NRF_SUCCESS) {
+        // Log queue is full, entry is retried after next quiet window
+        NRF_LOG_WARNING("Color log entry is delayed, error %" PRIu32, err_code);
+        color_log_s.changed_ticks = app_timer_cnt_get();
+        return;
+    }
+    color_log_s.pending = false;
+}
+
 void click_handler(uint8_t clicks_count) {
     NRF_LOG_INFO("CLICK HANDLER %" PRIu8 " clicks", clicks_count);
+    log_event(LOG_EVENT_CLICKS, &clicks_count, sizeof(clicks_count));
     hsv = get_current_hsv_color();
     if (clicks_count == 2) {
         switch (current_input_state) {
@@ -180,7 +247,7 @@ void click_handler(uint8_t clicks_count) {
                 current_input_state = STATE_BRIGHTNESS_MODIFICATION;
                 app_timer_stop(led1_blink_timer);
 
-                set_led1_brightness(PWM_TOP_VALUE);
+                set_led1_brightness(LED1_BRIGHTNESS_MAX);
                 break;
             case STATE_BRIGHTNESS_MODIFICATION:
                 current_input_state = STATE_NO_INPUT;
@@ -203,12 +270,21 @@ void release_handler() {
 
 void led1_blink_timer_handler(void* p_context) {
     uint16_t led1_brightness = get_led1_brightness();
-    if (led1_brightness + pwm_step > PWM_TOP_VALUE || led1_brightness  + pwm_step < 0) {
+    if (led1_brightness + pwm_step > LED1_BRIGHTNESS_MAX || led1_brightness  + pwm_step < 0) {
         pwm_step *= -1;
     }
     set_led1_brightness(led1_brightness + pwm_step);
 }
 
+void uptime_timer_handler(void* p_context) {
+    /* Hour doesn`t fit app_timer counter, so it is counted by minutes */
+    static uint8_t ticks = 0;
+    if (++ticks == UPTIME_TIMER_TICKS_PER_HOUR) {
+        ticks = 0;
+        fs_counter_add(COUNTER_UPTIME_HOURS, 1);
+    }
+}
+
 void ble_write_evt(ble_evt_t const * p_ble_evt, void * p_context) {
     ble_gatts_evt_write_t const* p_evt_write = &p_ble_evt->evt.gatts_evt.params.write;
 	uint16_t handle = p_evt_write->handle;
@@ -256,6 +332,9 @@ static void timers_init(void)
 
     err_code = app_timer_create(&led1_blink_timer, APP_TIMER_MODE_REPEATED, led1_blink_timer_handler);
     APP_ERROR_CHECK(err_code);
+
+    err_code = app_timer_create(&uptime_timer, APP_TIMER_MODE_REPEATED, uptime_timer_handler);
+    APP_ERROR_CHECK(err_code);
 }
 
 
@@ -390,7 +469,8 @@ static void conn_params_init(void)
  */
 static void application_timers_start(void)
 {
-    /* Nothing to start */
+    ret_code_t err_code = app_timer_start(uptime_timer, APP_TIMER_TICKS(UPTIME_TIMER_INTERVAL_MS), NULL);
+    APP_ERROR_CHECK(err_code);
 }
 
 
@@ -425,10 +505,16 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
     ret_code_t err_code = NRF_SUCCESS;
     rgb_data_t curr_rgb;
 
+    // Background flash operations wait until radio is quiet
+    fs_sched_traffic();
+
     switch (p_ble_evt->header.evt_id)
     {
         case BLE_GAP_EVT_DISCONNECTED:
             NRF_LOG_INFO("Disconnected.");
+            fs_flush_request();
+            fs_vars_flush_request();
+            log_event(LOG_EVENT_DISCONNECTED, NULL, 0);
             // LED indication will be changed when advertising starts.
             break;
 
@@ -437,6 +523,8 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
             m_conn_handle = p_ble_evt->evt.gap_evt.conn_handle;
             err_code = nrf_ble_qwr_conn_handle_assign(&m_qwr, m_conn_handle);
             APP_ERROR_CHECK(err_code);
+            log_event(LOG_EVENT_CONNECTED, NULL, 0);
+            fs_counter_add(COUNTER_CONNECTIONS, 1);
 
             // Update char
             curr_rgb = get_current_rgb_color();
@@ -474,6 +562,26 @@ static void ble_evt_handler(ble_evt_t const * p_ble_evt, void * p_context)
             NRF_LOG_DEBUG("BLE Write event");
             ble_write_evt(p_ble_evt, p_context);
             break;
+        case BLE_GATTS_EVT_RW_AUTHORIZE_REQUEST:
+        {
+            ble_gatts_evt_rw_authorize_request_t const *p_auth = &p_ble_evt->evt.gatts_evt.params.authorize_request;
+            if (p_auth->type == BLE_GATTS_AUTHORIZE_TYPE_READ &&
+                p_auth->request.read.handle == m_service_example.fs_stats_char.value_handle) {
+                fs_stats_t stats[FS_PARTS_COUNT];
+                for (fs_part_id_t part = 0; part < FS_PARTS_COUNT; part++) {
+                    fs_get_stats(part, &stats[part]);
+                }
+                err_code = estc_ble_reply_read(p_ble_evt->evt.gatts_evt.conn_handle, p_auth->request.read.offset,
+                                               (uint8_t*) stats, sizeof(stats));
+                if (err_code == NRF_ERROR_INVALID_STATE || err_code == BLE_ERROR_INVALID_CONN_HANDLE) {
+                    // Peer has disconnected before reply, like ignored updates of color_read_char
+                    NRF_LOG_WARNING("Statistics read isn`t answered, error %" PRIu32, err_code);
+                }
+                else {
+                    APP_ERROR_CHECK(err_code);
+                }
+            }
+        } break;
         default:
             // No implementation needed.
             break;
@@ -582,13 +690,25 @@ void buttons_init() {
     button_interrupt_init(BUTTON1_ID, click_handler, release_handler);
 }
 
+/* Palette is changed rarely, so it is kept away from last color saved on every change */
+static fs_part_id_t fs_part_policy(const char *record_name) {
+    return strcmp(record_name, "rgb_array") == 0 ? FS_PART_COLD : FS_PART_HOT;
+}
+
 
 void pm_evt_handler(pm_evt_t const * p_evt) {
     pm_handler_on_pm_evt(p_evt);
     pm_handler_disconnect_on_sec_failure(p_evt);
+    pm_handler_flash_clean(p_evt);
 
     switch (p_evt->evt_id)
     {
+        case PM_EVT_CONN_SEC_CONFIG_REQ:
+        {
+            // Phone which lost its bond pairs again instead of being rejected.
+            pm_conn_sec_config_t conn_sec_config = {.allow_repairing = true};
+            pm_conn_sec_config_reply(p_evt->conn_handle, &conn_sec_config);
+        } break;
         case PM_EVT_PEERS_DELETE_SUCCEEDED:
             advertising_start();
             break;
@@ -597,6 +717,45 @@ void pm_evt_handler(pm_evt_t const * p_evt) {
     }
 }
 
+
+/**@brief Function for the Peer Manager initialization.
+ *
+ * @details fds used by Peer Manager shares flash with fs, partitions are checked before fds is initialized.
+ */
+static void peer_manager_init(void)
+{
+    ble_gap_sec_params_t sec_param;
+    ret_code_t           err_code;
+
+    err_code = fs_partition_check();
+    APP_ERROR_CHECK(err_code);
+
+    err_code = pm_init();
+    APP_ERROR_CHECK(err_code);
+
+    memset(&sec_param, 0, sizeof(ble_gap_sec_params_t));
+
+    // Security parameters to be used for all security procedures.
+    sec_param.bond           = SEC_PARAM_BOND;
+    sec_param.mitm           = SEC_PARAM_MITM;
+    sec_param.lesc           = SEC_PARAM_LESC;
+    sec_param.keypress       = SEC_PARAM_KEYPRESS;
+    sec_param.io_caps        = SEC_PARAM_IO_CAPABILITIES;
+    sec_param.oob            = SEC_PARAM_OOB;
+    sec_param.min_key_size   = SEC_PARAM_MIN_KEY_SIZE;
+    sec_param.max_key_size   = SEC_PARAM_MAX_KEY_SIZE;
+    sec_param.kdist_own.enc  = 1;
+    sec_param.kdist_own.id   = 1;
+    sec_param.kdist_peer.enc = 1;
+    sec_param.kdist_peer.id  = 1;
+
+    err_code = pm_sec_params_set(&sec_param);
+    APP_ERROR_CHECK(err_code);
+
+    err_code = pm_register(pm_evt_handler);
+    APP_ERROR_CHECK(err_code);
+}
+
 /**@brief Function for application main entry.
  */
 int main(void)
@@ -611,11 +770,17 @@ int main(void)
     services_init();
     advertising_init();
     conn_params_init();
+    peer_manager_init();
     nrfx_systick_init();
     pwm_control_init();
     nrfx_gpiote_init();
     buttons_init();
+    fs_set_part_policy(fs_part_policy);
     fs_init();
+    APP_ERROR_CHECK(fs_vars_init());
+    APP_ERROR_CHECK(fs_log_init());
+    NRF_LOG_INFO("Connections %" PRIu32 ", color changes %" PRIu32 ", uptime %" PRIu32 " h",
+                 fs_counter_get(COUNTER_CONNECTIONS), fs_counter_get(COUNTER_COLOR_CHANGES), fs_counter_get(COUNTER_UPTIME_HOURS));
     #if ESTC_USB_CLI_ENABLED == 1
         cli_init(commands_cli_listener);
         commands_init();
@@ -625,14 +790,8 @@ int main(void)
     application_timers_start();
     advertising_start();
     
-    /* Getting last saved hsv if it exists.*/
-    fs_header_t *last_hsv_header = fs_find_record("last_hsv");
-    hsv_data_t hsv;
-    if (last_hsv_header == NULL) {
-        hsv = new_hsv(360. * 77 / 100, 100, 100);
-    } else {
-       fs_read(last_hsv_header, &hsv, last_hsv_header->length);
-    }
+    /* Last saved hsv or default one */
+    hsv_data_t hsv = last_hsv;
     set_led2_color_by_hsv(&hsv);
     led_color_was_color_changed(); /* Set color_was_changed = false */
 
@@ -648,12 +807,20 @@ int main(void)
             cli_process();
             commands_process();
         #endif
+        fs_process();
+        fs_vars_process();
+        color_log_process();
+        fs_log_process();
 
         /* Hsv editing process */
         if (current_input_state == STATE_NO_INPUT) {
             if (led_color_was_color_changed()) {
                 hsv = get_current_hsv_color();
-                fs_write("last_hsv", &hsv, sizeof(hsv));
+                /* Written when variables stay unchanged for FS_VARS_QUIET_MS */
+                last_hsv = hsv;
+                fs_var_changed(&last_hsv);
+                color_log_changed(&hsv);
+                fs_counter_add(COUNTER_COLOR_CHANGES, 1);
 
                 if (m_conn_handle != BLE_CONN_HANDLE_INVALID) {
                     rgb_data_t curr_rgb = get_current_rgb_color();
@@ -664,7 +831,7 @@ int main(void)
 
         }
         else if (should_change_color && 
-                 nrfx_systick_test(&change_color_speed_timer, CHANGE_COLOR_SPEED_TIME_US)) {
+                 nrfx_systick_test(&change_color_speed_timer, change_color_speed_us)) {
 
             switch (current_input_state) {
                 case STATE_HUE_MODIFICATION:
@@ -7,6 +7,8 @@
 #include "ble_gatts.h"
 #include "ble_srv_common.h"
 
+#include "../fs/fs.h"
+
 
 static ret_code_t estc_ble_add_characteristics(ble_estc_service_t *service, ble_gatts_char_handles_t *char_handle, uint16_t uuid,
                                                uint8_t *p_val, uint16_t val_len, uint8_t char_properties, bool secure_write, char *cdesc);
@@ -15,6 +17,7 @@ ret_code_t estc_ble_service_init(ble_estc_service_t *service)
 {
     ret_code_t error_code = NRF_SUCCESS;
     uint8_t rgb_default_data[3] = {0};
+    uint8_t fs_stats_default_data[FS_PARTS_COUNT * sizeof(fs_stats_t)] = {0};
 
     ble_uuid_t service_uuid;
     service_uuid.uuid = ESTC_SERVICE_UUID;
@@ -42,6 +45,11 @@ ret_code_t estc_ble_service_init(ble_estc_service_t *service)
                                               ESTC_WRITE_PROPERTY, false, ESTC_COLOR_WRITE_CHAR_DESC);
     APP_ERROR_CHECK(error_code);
 
+    // Configure fs_stats_char
+    error_code = estc_ble_add_characteristics(service, &service->fs_stats_char, ESTC_FS_STATS_CHAR_UUID, fs_stats_default_data, sizeof(fs_stats_default_data),
+                                              ESTC_READ_PROPERTY | ESTC_READ_AUTH_PROPERTY, false, ESTC_FS_STATS_CHAR_DESC);
+    APP_ERROR_CHECK(error_code);
+
     return error_code;
 }
 
@@ -69,6 +77,7 @@ static ret_code_t estc_ble_add_characteristics(ble_estc_service_t *service, ble_
     // Configures attribute metadata. For now we only specify that the attribute will be stored in the softdevice
     ble_gatts_attr_md_t attr_md = { 0 };
     attr_md.vloc = BLE_GATTS_VLOC_STACK;
+    attr_md.rd_auth = char_properties & ESTC_READ_AUTH_PROPERTY ? 1 : 0;
 
     // Set read/write security levels to our attribute metadata using `BLE_GAP_CONN_SEC_MODE_SET_OPEN`
     BLE_GAP_CONN_SEC_MODE_SET_OPEN(&attr_md.read_perm);
@@ -116,4 +125,19 @@ ret_code_t estc_ble_update_char(uint16_t conn_handle, uint16_t char_handle,
     _can_send_indication =  err_code != NRF_SUCCESS;
 
     return err_code;
+}
+
+ret_code_t estc_ble_reply_read(uint16_t conn_handle, uint16_t offset, uint8_t *p_val, uint16_t length) {
+    // Long read is answered from value stored at its start, so every part comes from one snapshot
+    ble_gatts_rw_authorize_reply_params_t reply = {
+        .type = BLE_GATTS_AUTHORIZE_TYPE_READ,
+        .params.read = {
+            .gatt_status = BLE_GATT_STATUS_SUCCESS,
+            .update = offset == 0 ? 1 : 0,
+            .offset = 0,
+            .len = length,
+            .p_data = p_val
+        }
+    };
+    return sd_ble_gatts_rw_authorize_reply(conn_handle, &reply);
 }
\ No newline at end of file
@@ -11,14 +11,18 @@
 
 #define ESTC_COLOR_WRITE_CHAR_UUID 0x0001
 #define ESTC_COLOR_READ_CHAR_UUID  0x0002
+#define ESTC_FS_STATS_CHAR_UUID    0x0003
 
 #define ESTC_COLOR_READ_CHAR_DESC  "LED color read"
 #define ESTC_COLOR_WRITE_CHAR_DESC "LED color write"
+#define ESTC_FS_STATS_CHAR_DESC    "Storage statistics"
 
 #define ESTC_READ_PROPERTY 0b00000001
 #define ESTC_WRITE_PROPERTY (ESTC_READ_PROPERTY << 1)
 #define ESTC_NOTIFY_PROPERTY (ESTC_READ_PROPERTY << 2)
 #define ESTC_INDICATE_PROPERTY (ESTC_READ_PROPERTY << 3)
+// Value is given by estc_ble_reply_read() on every read
+#define ESTC_READ_AUTH_PROPERTY (ESTC_READ_PROPERTY << 4)
 
 typedef struct
 {
@@ -26,11 +30,14 @@ typedef struct
 
     ble_gatts_char_handles_t color_write_char;
     ble_gatts_char_handles_t color_read_char;
+    ble_gatts_char_handles_t fs_stats_char; // fs_stats_t of every fs instance
 } ble_estc_service_t;
 
 ret_code_t estc_ble_service_init(ble_estc_service_t *service);
 ret_code_t estc_ble_update_char(uint16_t conn_handle, uint16_t char_handle, 
                                 uint8_t type, uint8_t *p_val, uint16_t length);
 void estc_ble_indication_confirms();
+/* Answers read authorization request, value is updated only when read starts from offset 0 */
+ret_code_t estc_ble_reply_read(uint16_t conn_handle, uint16_t offset, uint8_t *p_val, uint16_t length);
 
 #endif
\ No newline at end of file
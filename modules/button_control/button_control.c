@@ -2,14 +2,19 @@
 #include "nrf_gpio.h"
 #include "app_timer.h"
 #include "nrfx_gpiote.h"
+#include "../fs/fs_vars.h"
 #include <inttypes.h>
 
 #define DEBOUNCING_TIMEOUT_MS 50
+#define DEBOUNCING_MIN_TIMEOUT_MS 1
 #define CLICKS_COUNT_TIMEOUT_MS 400
 
 APP_TIMER_DEF(debouncing_timer);
 APP_TIMER_DEF(clicks_count_timer);
 
+/* Can be tuned by var command */
+FS_VAR_DEF(uint32_t, debouncing_timeout_ms, "debounce_ms", DEBOUNCING_TIMEOUT_MS);
+
 static struct {
     uint32_t button_id;
     uint8_t button_clicks_count;
@@ -25,7 +30,9 @@ const static uint8_t buttons_array[BUTTONS_COUNT] = BUTTONS_ARRAY;
 static void button_handler(nrfx_gpiote_pin_t pin, nrf_gpiote_polarity_t action) {
     if (!button_config_s.debounce_proccessing) {
         button_config_s.debounce_proccessing = true;
-        app_timer_start(debouncing_timer, APP_TIMER_TICKS(DEBOUNCING_TIMEOUT_MS), NULL);
+        // Timer doesn`t start with zero timeout, then button would never be handled again
+        uint32_t timeout_ms = MAX(debouncing_timeout_ms, DEBOUNCING_MIN_TIMEOUT_MS);
+        app_timer_start(debouncing_timer, APP_TIMER_TICKS(timeout_ms), NULL);
     }
 }
 
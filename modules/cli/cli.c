@@ -1,4 +1,5 @@
 #include "cli.h"
+#include "../fs/fs.h"
 #include "nrf_log.h"
 #include <string.h>
 #include <inttypes.h>
@@ -100,6 +101,7 @@ static void usb_ev_handler(app_usbd_class_inst_t const * p_inst,
     {
         NRF_LOG_INFO("TX DONE");
         is_writing = false;
+        fs_sched_traffic();
         break;
     }
     case APP_USBD_CDC_ACM_USER_EVT_RX_DONE:
@@ -109,6 +111,7 @@ static void usb_ev_handler(app_usbd_class_inst_t const * p_inst,
             is_first_rx_done = false;
         }
         NRF_LOG_INFO("RX DONE");
+        fs_sched_traffic();
         ret_code_t ret;
         uint8_t offset = line_buff_s.current_index;
         bool is_newline = false;
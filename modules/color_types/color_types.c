@@ -1,8 +1,11 @@
 #include "color_types.h"
 #include <math.h>
+#include <stdbool.h>
+#include <stdlib.h>
 #include <inttypes.h>
 
 #include "nrf_dfu_types.h"
+#include "nrf_assert.h"
 
 #include "nrf_log.h"
 #include <string.h>
@@ -11,6 +14,9 @@
 #define GET_MAX(a, b) (((a) > (b))? (a) : (b))
 #define GET_MIN(a, b) (((a) > (b))? (b) : (a))
 
+/* Common denominator of fixed-point HSV to RGB components, 10000 for v * s and 60 for hue sector */
+#define HSV_TO_RGB_DENOMINATOR 600000
+
 
 hsv_data_t new_hsv(uint16_t h, uint8_t s, uint8_t v) {
     return (hsv_data_t) {.h = h, .s = s, .v = v};
@@ -28,6 +34,118 @@ rgb_data_with_name_t new_rgb_with_name(rgb_data_t rgb, char* color_name, size_t
     return rgb_with_name;
 }
 
+static void get_hsv_components(const hsv_data_t* hsv_data, uint32_t* r_component, uint32_t* g_component,
+                               uint32_t* b_component) {
+    /*
+        Components are numerators over HSV_TO_RGB_DENOMINATOR: chroma c = v * s / 10000,
+        x = c * f / 60 where f falls from 60 to 0 and rises back within every 120 degrees,
+        m = v / 100 - c.
+    */
+    uint32_t h = hsv_data->h % 360;
+    uint32_t f = 60 - abs((int32_t)(h % 120) - 60);
+    uint32_t c = (uint32_t) hsv_data->v * hsv_data->s * 60;
+    uint32_t x = (uint32_t) hsv_data->v * hsv_data->s * f;
+    uint32_t m = (uint32_t) hsv_data->v * (100 - hsv_data->s) * 60;
+
+    if (h < 60) {
+        *r_component = c;
+        *g_component = x;
+        *b_component = 0;
+    }
+    else if (h < 120) {
+        *r_component = x;
+        *g_component = c;
+        *b_component = 0;
+    }
+    else if (h < 180) {
+        *r_component = 0;
+        *g_component = c;
+        *b_component = x;
+    }
+    else if (h < 240) {
+        *r_component = 0;
+        *g_component = x;
+        *b_component = c;
+    }
+    else if (h < 300) {
+        *r_component = x;
+        *g_component = 0;
+        *b_component = c;
+    }
+    else {
+        *r_component = c;
+        *g_component = 0;
+        *b_component = x;
+    }
+    *r_component += m;
+    *g_component += m;
+    *b_component += m;
+}
+
+static uint16_t get_rgb16_component(uint32_t component) {
+    // 600000 * 65535 doesn`t fit 32 bits, numerator and denominator are divided by their gcd 15
+    return (component * (UINT16_MAX / 15) + HSV_TO_RGB_DENOMINATOR / 30) / (HSV_TO_RGB_DENOMINATOR / 15);
+}
+
+rgb16_data_t get_rgb16_from_hsv(const hsv_data_t* hsv_data) {
+    uint32_t r_component, g_component, b_component;
+    get_hsv_components(hsv_data, &r_component, &g_component, &b_component);
+    return (rgb16_data_t) {.r = get_rgb16_component(r_component), .g = get_rgb16_component(g_component),
+                           .b = get_rgb16_component(b_component)};
+}
+
+rgb16_data_t get_rgb16_from_rgb(const rgb_data_t* rgb_data) {
+    // 255 * 257 is UINT16_MAX
+    return (rgb16_data_t) {.r = rgb_data->r * 257, .g = rgb_data->g * 257, .b = rgb_data->b * 257};
+}
+
+#if COLOR_TYPES_FIXED_POINT
+
+rgb_data_t get_rgb_from_hsv(const hsv_data_t* hsv_data) {
+    /* Output is floor of component * 255, it is exact */
+    uint32_t r_component, g_component, b_component;
+    get_hsv_components(hsv_data, &r_component, &g_component, &b_component);
+    return new_rgb(r_component * 255 / HSV_TO_RGB_DENOMINATOR, g_component * 255 / HSV_TO_RGB_DENOMINATOR,
+                   b_component * 255 / HSV_TO_RGB_DENOMINATOR);
+}
+
+static uint32_t div_ceil(uint32_t dividend, uint32_t divisor) {
+    return (dividend + divisor - 1) / divisor;
+}
+
+hsv_data_t get_hsv_from_rgb(const rgb_data_t* rgb_data) {
+    /*
+        Hue, saturation and value are ceilings of exact ratios of 8 bit components,
+        hue is taken from blue, red, green max in this order.
+    */
+    int32_t r = rgb_data->r;
+    int32_t g = rgb_data->g;
+    int32_t b = rgb_data->b;
+    int32_t max = GET_MAX(GET_MAX(r, g), b);
+    int32_t min = GET_MIN(GET_MIN(r, g), b);
+    int32_t delta = max - min;
+
+    uint32_t h = 0;
+    if (delta != 0) {
+        if (b == max) {
+            h = div_ceil(60 * (r - g) + 240 * delta, delta);
+        }
+        else if (r == max) {
+            h = div_ceil(60 * (g - b) + (g < b ? 360 * delta : 0), delta);
+        }
+        else {
+            h = div_ceil(60 * (b - r) + 120 * delta, delta);
+        }
+    }
+
+    uint32_t s = max == 0 ? 0 : div_ceil(delta * 100, max);
+    uint32_t v = div_ceil(max * 100, 255);
+
+    return new_hsv(h % 360, s, v);
+}
+
+#else
+
 rgb_data_t get_rgb_from_hsv(const hsv_data_t* hsv_data) {
     float c = (float)(hsv_data->v * hsv_data->s) / 10000;
     float x = c * (1 - fabsf(fmodf((float)hsv_data->h / 60, 2) - 1));
@@ -82,13 +200,17 @@ hsv_data_t get_hsv_from_rgb(const rgb_data_t* rgb_data) {
         h = 0;
     } else {
         if (r == max) {
-            h = 60 * fmod(fabs((g - b) / delta), 6.);
+            /* Negative hue of red sector wraps to its upper half */
+            h = 60 * ((g - b) / delta);
+            if (h < 0) {
+                h += 360;
+            }
         } else if (g == max) {
-            h = 60 * (fabs((b - r) / delta) + 2);
+            h = 60 * ((b - r) / delta + 2);
         }
 
         if (b == max) {
-            h = 60 * (fabs((r - g) / delta) + 4);
+            h = 60 * ((r - g) / delta + 4);
         }
     }
 
@@ -99,6 +221,8 @@ hsv_data_t get_hsv_from_rgb(const rgb_data_t* rgb_data) {
 
 }
 
+#endif
+
 
 void put_rgb_in_array(rgb_data_array_t* rgb_array, rgb_data_with_name_t* rgb_data) {
     for (size_t i = 0; i < COLORS_COUNT; i++) {
@@ -7,6 +7,15 @@
 #define COLOR_NAME_SIZE 32
 #define COLORS_COUNT 10
 
+/*
+    HSV and RGB are converted by integer math. Result is exact: RGB components are floors
+    and HSV components are ceilings of formula values, float version is off by one at most
+    where float rounding crosses an integer. Set to 0 for float version.
+*/
+#ifndef COLOR_TYPES_FIXED_POINT
+#define COLOR_TYPES_FIXED_POINT 1
+#endif
+
 typedef struct {
     uint16_t h;
     uint8_t s;
@@ -19,6 +28,12 @@ typedef struct {
     uint8_t b;
 } rgb_data_t;
 
+/* Same gamma encoding as rgb_data_t, full scale is UINT16_MAX */
+typedef struct {
+    uint16_t r;
+    uint16_t g;
+    uint16_t b;
+} rgb16_data_t;
 
 
 typedef struct {
@@ -36,6 +51,8 @@ typedef struct {
 rgb_data_t new_rgb(uint8_t r, uint8_t g, uint8_t b);
 hsv_data_t new_hsv(uint16_t h, uint8_t s, uint8_t v);
 rgb_data_t get_rgb_from_hsv(const hsv_data_t* hsv_data);
+rgb16_data_t get_rgb16_from_hsv(const hsv_data_t* hsv_data);
+rgb16_data_t get_rgb16_from_rgb(const rgb_data_t* rgb_data);
 rgb_data_with_name_t new_rgb_with_name(rgb_data_t rgb, char* color_name, size_t name_length);
 hsv_data_t get_hsv_from_rgb(const rgb_data_t* rgb_data);
 void put_rgb_in_array(rgb_data_array_t* rgb_array, rgb_data_with_name_t* rgb_data);
@@ -49,19 +49,144 @@ static size_t get_args_count(char* str) {
     return count;
 }
 
-static rgb_data_array_t get_last_saved_rgb_array() {
-    rgb_data_array_t rgb_array;
-    fs_header_t *rgb_array_header = fs_find_record("rgb_array");
-    if (rgb_array_header == NULL) {
-        rgb_array = (rgb_data_array_t){0};
-    } else {
-        fs_read(rgb_array_header, &rgb_array, sizeof(rgb_array));
-    }
-    return rgb_array;
+static struct {
+    // Source of queued writes, it stays unchanged until every write of save is finished
+    rgb_data_array_t array;
+    uint8_t pending;
+    bool rewrite_queued;
+    bool failed;
+    const char *saved_msg;
+} palette_save_s;
+
+static const rgb_data_array_t *map_last_saved_rgb_array() {
+    /*
+        Array is read in place from flash. Pointer must not be used after fs_process(),
+        compaction started by queued write may erase the page. Patched or packed array is read to RAM.
+        Array being saved is newer than flash, so it is returned until save is finished.
+    */
+    static const rgb_data_array_t empty_array = {0};
+    static rgb_data_array_t patched_array;
+    if (palette_save_s.pending > 0) {
+        return &palette_save_s.array;
+    }
+    fs_map_t rgb_array_map;
+    ret_code_t err_code = fs_map("rgb_array", &rgb_array_map);
+    if (err_code == NRF_ERROR_INVALID_STATE) {
+        fs_header_t *header = fs_find_record("rgb_array");
+        if (fs_record_length(header) < sizeof(rgb_data_array_t) || fs_read(header, &patched_array, sizeof(rgb_data_array_t)) != NRF_SUCCESS) {
+            return &empty_array;
+        }
+        return &patched_array;
+    }
+    if (err_code != NRF_SUCCESS || rgb_array_map.length < sizeof(rgb_data_array_t)) {
+        return &empty_array;
+    }
+    return rgb_array_map.data;
 }
 
-static void save_colors_array(rgb_data_array_t *rgb_array) {
-    fs_write("rgb_array", rgb_array, sizeof(rgb_data_array_t));
+static void palette_save_finish() {
+    if (palette_save_s.pending > 0) {
+        return;
+    }
+    send_msg_to_cli(palette_save_s.failed ? COLORS_NOT_SAVED_MSG : palette_save_s.saved_msg);
+}
+
+static void palette_write_cb(ret_code_t result, fs_header_t *phead, void *p_context) {
+    palette_save_s.pending--;
+    if (result != NRF_SUCCESS) {
+        NRF_LOG_ERROR("Colors aren`t saved: %" PRIu32, result);
+        palette_save_s.failed = true;
+    }
+    palette_save_finish();
+}
+
+static void palette_queue_rewrite() {
+    if (palette_save_s.rewrite_queued) {
+        return;
+    }
+    ret_code_t err_code = fs_write_packed_async("rgb_array", &palette_save_s.array, sizeof(rgb_data_array_t), palette_write_cb, NULL);
+    if (err_code != NRF_SUCCESS) {
+        NRF_LOG_ERROR("Colors aren`t saved: %" PRIu32, err_code);
+        palette_save_s.failed = true;
+        return;
+    }
+    palette_save_s.rewrite_queued = true;
+    palette_save_s.pending++;
+}
+
+static void palette_patch_cb(ret_code_t result, fs_header_t *phead, void *p_context) {
+    // Whole array is written if patch is rejected, following patches write the same bytes over it
+    palette_save_s.pending--;
+    if (result != NRF_SUCCESS) {
+        palette_queue_rewrite();
+    }
+    palette_save_finish();
+}
+
+static void save_colors_range(size_t offset, size_t length) {
+    const uint8_t *src = (const uint8_t*) &palette_save_s.array + offset;
+    if (fs_patch_async("rgb_array", offset, src, length, palette_patch_cb, NULL) == NRF_SUCCESS) {
+        palette_save_s.pending++;
+    }
+    else {
+        palette_queue_rewrite();
+    }
+}
+
+static void save_colors_array(const rgb_data_array_t *saved_array, const rgb_data_array_t *rgb_array, const char *saved_msg) {
+    /*
+        Only changed bytes are written as fs patches. Added color is written before count,
+        so reset between two patches leaves saved array unchanged. Writes are queued,
+        message is sent to cli when the last of them is finished.
+    */
+    palette_save_s.array = *rgb_array;
+    palette_save_s.rewrite_queued = false;
+    palette_save_s.failed = false;
+    palette_save_s.saved_msg = saved_msg;
+
+    fs_header_t *header = fs_find_record("rgb_array");
+    if (header == NULL || fs_record_length(header) < sizeof(rgb_data_array_t)) {
+        palette_queue_rewrite();
+        palette_save_finish();
+        return;
+    }
+
+    const uint8_t *saved = (const uint8_t*) saved_array;
+    const uint8_t *changed = (const uint8_t*) rgb_array;
+    size_t count_offset = offsetof(rgb_data_array_t, count);
+    size_t first = 0;
+    size_t last = count_offset;
+    while (first < last && saved[first] == changed[first]) {
+        first++;
+    }
+    while (last > first && saved[last - 1] == changed[last - 1]) {
+        last--;
+    }
+
+    if (saved_array->count == rgb_array->count) {
+        if (first < last) {
+            save_colors_range(first, last - first);
+        }
+    }
+    else if (last - first <= sizeof(rgb_data_with_name_t)) {
+        if (first < last) {
+            save_colors_range(first, last - first);
+        }
+        save_colors_range(count_offset, sizeof(rgb_array->count));
+    }
+    else {
+        // Colors are shifted, they are written with count by one patch
+        save_colors_range(first, sizeof(rgb_data_array_t) - first);
+    }
+    palette_save_finish();
+}
+
+static bool is_palette_saving() {
+    if (palette_save_s.pending > 0) {
+        send_msg_to_cli(COLORS_ARE_SAVING_MSG);
+        return true;
+    }
+    return false;
 }
 
 typedef struct {
@@ -177,11 +302,14 @@ static void add_rgb_color(char* args) {
     }
 
 
-    rgb_data_array_t rgb_array = get_last_saved_rgb_array();
+    if (is_palette_saving()) {
+        return;
+    }
+    const rgb_data_array_t *saved_array = map_last_saved_rgb_array();
+    rgb_data_array_t rgb_array = *saved_array;
     rgb_data_with_name_t rgb_data = new_rgb_with_name(new_rgb(rgb_vals[0], rgb_vals[1], rgb_vals[2]), name, name_length);
     put_rgb_in_array(&rgb_array, &rgb_data);
-    save_colors_array(&rgb_array);
-    send_msg_to_cli(COLOR_SAVED_MSG);
+    save_colors_array(saved_array, &rgb_array, COLOR_SAVED_MSG);
 }
 
 static void list_colors(char* args) {
@@ -191,19 +319,19 @@ static void list_colors(char* args) {
         return;
     }
 
-    rgb_data_array_t rgb_array = get_last_saved_rgb_array();
+    const rgb_data_array_t *rgb_array = map_last_saved_rgb_array();
     
-    NRF_LOG_INFO("Colors count %" PRIu32, rgb_array.count);
-    if (rgb_array.count == 0) {
+    NRF_LOG_INFO("Colors count %" PRIu32, rgb_array->count);
+    if (rgb_array->count == 0) {
         send_msg_to_cli(CANT_FIND_ANY_SAVED_COLORS_MSG);
         return;
     }
 
     char* unformatted_str = "\r\nColor name: %s";
     char formatted_str[strlen(unformatted_str) + COLOR_NAME_SIZE];
-    for (size_t i = 0; i < rgb_array.count; i++) {
-        sprintf(formatted_str, unformatted_str, rgb_array.colors_array[i].color_name);
-        cli_write(formatted_str, strlen(unformatted_str) + strlen(rgb_array.colors_array[i].color_name) - 1);
+    for (size_t i = 0; i < rgb_array->count; i++) {
+        sprintf(formatted_str, unformatted_str, rgb_array->colors_array[i].color_name);
+        cli_write(formatted_str, strlen(unformatted_str) + strlen(rgb_array->colors_array[i].color_name) - 1);
     }
 }
 
@@ -230,13 +358,16 @@ static void add_current_color(char* args) {
         return;
     }
 
-    rgb_data_array_t rgb_array = get_last_saved_rgb_array();
+    if (is_palette_saving()) {
+        return;
+    }
+    const rgb_data_array_t *saved_array = map_last_saved_rgb_array();
+    rgb_data_array_t rgb_array = *saved_array;
     hsv_data_t hsv_color = get_current_hsv_color();
 
     rgb_data_with_name_t rgb_data = new_rgb_with_name(get_rgb_from_hsv(&hsv_color), name, name_length);
     put_rgb_in_array(&rgb_array, &rgb_data);
-    save_colors_array(&rgb_array);
-    send_msg_to_cli(COLOR_SAVED_MSG);
+    save_colors_array(saved_array, &rgb_array, COLOR_SAVED_MSG);
 }
 
 static void apply_color(char* args) {
@@ -254,14 +385,14 @@ static void apply_color(char* args) {
     }
 
     ptrdiff_t name_length = end_of_name - name;
-    rgb_data_array_t rgb_array = get_last_saved_rgb_array();
-    for (size_t i = 0; i < rgb_array.count; i++) {
-        if (strncmp(rgb_array.colors_array[i].color_name, name, name_length) == 0 && 
+    const rgb_data_array_t *rgb_array = map_last_saved_rgb_array();
+    for (size_t i = 0; i < rgb_array->count; i++) {
+        if (strncmp(rgb_array->colors_array[i].color_name, name, name_length) == 0 && 
             (name[name_length] == ' ' || name[name_length] == '\0') && 
-            strlen(name) >= strlen(rgb_array.colors_array[i].color_name)) 
+            strlen(name) >= strlen(rgb_array->colors_array[i].color_name)) 
             {
                 
-                set_led2_color_by_rgb(&rgb_array.colors_array[i].rgb);
+                set_led2_color_by_rgb(&rgb_array->colors_array[i].rgb);
                 send_msg_to_cli(COLOR_SET_MSG);
                 return;
             }
@@ -284,20 +415,140 @@ static void del_color(char* args) {
     }
 
     ptrdiff_t name_length = end_of_name - name;
-    rgb_data_array_t rgb_array = get_last_saved_rgb_array();
-    for (size_t i = 0; i < rgb_array.count; i++) {
-        if (strncmp(rgb_array.colors_array[i].color_name, name, name_length) == 0 && 
-            (name[name_length] == ' ' || name[name_length] == '\0') && strlen(name) >= strlen(rgb_array.colors_array[i].color_name)) 
+    if (is_palette_saving()) {
+        return;
+    }
+    const rgb_data_array_t *saved_array = map_last_saved_rgb_array();
+    for (size_t i = 0; i < saved_array->count; i++) {
+        if (strncmp(saved_array->colors_array[i].color_name, name, name_length) == 0 && 
+            (name[name_length] == ' ' || name[name_length] == '\0') && strlen(name) >= strlen(saved_array->colors_array[i].color_name)) 
             {
+                // Copy is modified, saved array stays in flash until it is rewritten
+                rgb_data_array_t rgb_array = *saved_array;
                 delete_color_from_array(&rgb_array, i);
-                save_colors_array(&rgb_array);
-                send_msg_to_cli(COLOR_DELETED_MSG);
+                save_colors_array(saved_array, &rgb_array, COLOR_DELETED_MSG);
                 return;
             }
     }
     send_msg_to_cli(COLOR_DOESNT_FOUND_MSG);
 }
 
+static void fs_stats_print(const fs_stats_t *p_stats, char *formatted_str) {
+    sprintf(formatted_str, "\r\nBytes written: %" PRIu32, p_stats->bytes_written);
+    send_msg_to_cli(formatted_str);
+    sprintf(formatted_str, "\r\nPages erased: %" PRIu32, p_stats->pages_erased);
+    send_msg_to_cli(formatted_str);
+    sprintf(formatted_str, "\r\nCompactions: %" PRIu32, p_stats->compactions);
+    send_msg_to_cli(formatted_str);
+    sprintf(formatted_str, "\r\nLookups: %" PRIu32 ", headers scanned: %" PRIu32, p_stats->lookups, p_stats->headers_scanned);
+    send_msg_to_cli(formatted_str);
+    sprintf(formatted_str, "\r\nActive page: live %" PRIu32 " bytes, dead %" PRIu32 " bytes",
+            p_stats->active_live_bytes, p_stats->active_dead_bytes);
+    send_msg_to_cli(formatted_str);
+    sprintf(formatted_str, "\r\nQueueing: urgent avg %" PRIu32 " us, max %" PRIu32 " us",
+            p_stats->urgent_latency_avg_us, p_stats->urgent_latency_max_us);
+    send_msg_to_cli(formatted_str);
+    sprintf(formatted_str, "\r\nQueueing: deferrable avg %" PRIu32 " ms, max %" PRIu32 " ms",
+            p_stats->deferrable_latency_avg_ms, p_stats->deferrable_latency_max_ms);
+    send_msg_to_cli(formatted_str);
+}
+
+static void fs_stats(char* args) {
+    NRF_LOG_INFO("fs_stats args: %s", args);
+    if (get_args_count(args) > 0) {
+        send_msg_to_cli(COMMAND_DOESNT_ACCEPT_ARGS_MSG);
+        return;
+    }
+
+    char formatted_str[64];
+    fs_stats_t stats;
+    for (fs_part_id_t part = 0; part < FS_PARTS_COUNT; part++) {
+        fs_get_stats(part, &stats);
+        sprintf(formatted_str, "\r\n%s instance:", part == FS_PART_HOT ? "Hot" : "Cold");
+        send_msg_to_cli(formatted_str);
+        fs_stats_print(&stats, formatted_str);
+    }
+    // Waits for flash are shared by instances
+    sprintf(formatted_str, "\r\nFlash wait: total %" PRIu32 " ms, max %" PRIu32 " us", stats.wait_total_ms, stats.wait_max_us);
+    send_msg_to_cli(formatted_str);
+}
+
+static void log_dump(char* args) {
+    NRF_LOG_INFO("log_dump args: %s", args);
+    get_uint_ret_t ret = get_uint_from_str(args, 0);
+    if (get_args_count(args) != 1 || ret.error) {
+        send_msg_to_cli(INVALID_ARGUMENTS_MSG);
+        return;
+    }
+
+    char formatted_str[64];
+    fs_log_iter_t iter;
+    fs_log_entry_t entry;
+    uint32_t index;
+    uint32_t printed = 0;
+    fs_log_iter_init(&iter, true);
+    while (printed < ret.value && fs_log_iter_next(&iter, &entry, &index)) {
+        int length = sprintf(formatted_str, "\r\n#%" PRIu32 " type %" PRIu8 ":", index, entry.type);
+        for (uint8_t i = 0; i < entry.length; i++) {
+            length += sprintf(formatted_str + length, " %02" PRIX8, entry.data[i]);
+        }
+        send_msg_to_cli(formatted_str);
+        printed++;
+    }
+    if (printed == 0) {
+        send_msg_to_cli(LOG_IS_EMPTY_MSG);
+    }
+}
+
+static void var_handler(char* args) {
+    NRF_LOG_INFO("var args: %s", args);
+    size_t args_count = get_args_count(args);
+    if (args_count != 1 && args_count != 2) {
+        send_msg_to_cli(INVALID_ARGUMENTS_MSG);
+        return;
+    }
+
+    char* name = get_begin_of_word(args, 0);
+    char* value_str = get_begin_of_word(args, 1);
+    char* end_of_name = strchr(name, ' ');
+    if (end_of_name != NULL) {
+        *end_of_name = '\0';
+    }
+
+    /* Only unsigned integer variables can be printed and set */
+    const fs_var_t *var = fs_var_find(name);
+    if (var == NULL || (var->size != sizeof(uint8_t) && var->size != sizeof(uint16_t) && var->size != sizeof(uint32_t))) {
+        send_msg_to_cli(VAR_DOESNT_FOUND_MSG);
+        return;
+    }
+
+    if (value_str != NULL) {
+        get_uint_ret_t ret = get_uint_from_str(value_str, 0);
+        if (ret.error || (var->size < sizeof(uint32_t) && (ret.value >> (var->size * 8)) != 0)) {
+            send_msg_to_cli(INVALID_ARGUMENTS_MSG);
+            return;
+        }
+        memcpy(var->p_data, &ret.value, var->size);
+        fs_var_changed(var->p_data);
+    }
+
+    char formatted_str[64];
+    uint32_t value = 0;
+    memcpy(&value, var->p_data, var->size);
+    sprintf(formatted_str, "\r\n%s = %" PRIu32, var->record_name, value);
+    send_msg_to_cli(formatted_str);
+}
+
+static void reset_handler(char* args) {
+    NRF_LOG_INFO("reset args: %s", args);
+    if (get_args_count(args) > 0) {
+        send_msg_to_cli(COMMAND_DOESNT_ACCEPT_ARGS_MSG);
+        return;
+    }
+    /* Shutdown handlers of fs and fs_vars postpone reset until deferred records and variables are written */
+    nrf_pwr_mgmt_shutdown(NRF_PWR_MGMT_SHUTDOWN_RESET);
+}
+
 static void help_handler(char* args);
 
 static cli_command_t commands[COMMANDS_COUNT] = {
@@ -340,6 +591,26 @@ static cli_command_t commands[COMMANDS_COUNT] = {
         .command = DEL_COLOR_COMMAND_NAME,
         .handler = del_color,
         .help_str = DEL_COLOR_HELP_MSG
+    },
+    {
+        .command = FS_STATS_COMMAND_NAME,
+        .handler = fs_stats,
+        .help_str = FS_STATS_HELP_MSG
+    },
+    {
+        .command = LOG_DUMP_COMMAND_NAME,
+        .handler = log_dump,
+        .help_str = LOG_DUMP_HELP_MSG
+    },
+    {
+        .command = VAR_COMMAND_NAME,
+        .handler = var_handler,
+        .help_str = VAR_HELP_MSG
+    },
+    {
+        .command = RESET_COMMAND_NAME,
+        .handler = reset_handler,
+        .help_str = RESET_HELP_MSG
     }
 };
 
@@ -5,14 +5,17 @@
 #include <inttypes.h>
 
 #include "nrf_log.h"
+#include "nrf_pwr_mgmt.h"
 
 #include "../color_types/color_types.h"
 #include "../cli/cli.h"
 #include "../led_color/led_color.h"
 #include "../fs/fs.h"
+#include "../fs/fs_log.h"
+#include "../fs/fs_vars.h"
 
 
-#define COMMANDS_COUNT 8
+#define COMMANDS_COUNT 12
 
 #define INVALID_ARGUMENTS_MSG "\r\nInvalid arguments"
 #define UNKNOWN_COMMAND_MSG "\r\nUnknown command"
@@ -21,8 +24,12 @@
 #define COLOR_DELETED_MSG "\r\nColor deleted"
 #define COLOR_SET_MSG "\r\nColor set"
 #define COLOR_SAVED_MSG "\r\nColor saved"
+#define COLORS_NOT_SAVED_MSG "\r\nColors aren`t saved"
+#define COLORS_ARE_SAVING_MSG "\r\nColors are being saved, try again later"
 #define COLOR_NAME_EXCEEDS_SIZE "\r\nColor name size can`t be bigger than 31"
 #define CANT_FIND_ANY_SAVED_COLORS_MSG "\r\nCan`t find any saved colors"
+#define LOG_IS_EMPTY_MSG "\r\nLog is empty"
+#define VAR_DOESNT_FOUND_MSG "\r\nVariable doesn`t found"
 
 #define HELP_COMMAND_NAME "help"
 #define HELP_HELP_MSG "\r\nhelp - print information about available commands"
@@ -48,6 +55,18 @@
 #define DEL_COLOR_COMMAND_NAME "del_color"
 #define DEL_COLOR_HELP_MSG "\r\ndel_color <color_name> - delete <color_name> color"
 
+#define FS_STATS_COMMAND_NAME "fs_stats"
+#define FS_STATS_HELP_MSG "\r\nfs_stats - print storage statistics"
+
+#define LOG_DUMP_COMMAND_NAME "log_dump"
+#define LOG_DUMP_HELP_MSG "\r\nlog_dump <n> - print last <n> log entries, newest first"
+
+#define VAR_COMMAND_NAME "var"
+#define VAR_HELP_MSG "\r\nvar <name> [value] - print or set persistent variable, it is saved to flash"
+
+#define RESET_COMMAND_NAME "reset"
+#define RESET_HELP_MSG "\r\nreset - write pending records and variables to flash, then reset"
+
 
 
 void commands_init();
@@ -1,340 +1,3345 @@
 #include "fs.h"
+#include "fs_flash.h"
 
 #include "nrf_log.h"
-#include "nrf_fstorage.h"
-#include "nrf_fstorage_sd.h"
+#include "app_error.h"
 #include "nrf_soc.h"
+#include "nrf_pwr_mgmt.h"
+#include "app_timer.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+#include <stddef.h>
 #include <string.h>
 #include <inttypes.h>
 
 #define FS_MIN(a, b) (((a) < (b)) ? (a) : (b))
 #define FS_MAX(a, b) (((a) < (b) ? (b) : (a)))
+#define FS_TICKS_TO(ticks, units_per_sec) ((uint32_t) ((uint64_t) (ticks) * (units_per_sec) / APP_TIMER_TICKS(1000)))
 
-NRF_FSTORAGE_DEF(nrf_fstorage_t fstorage_instance) = {
-    .evt_handler = NULL,
-    .start_addr = APP_DATA_ADDR,
-    .end_addr = BOOTLOADER_ADDR
-};
+#define PAGES_COUNT FS_PARTITION_PAGES
+#define FS_PART_MAX_PAGES FS_MAX(FS_HOT_PAGES, FS_COLD_PAGES)
+#define PAGE_ADDR(page) ((uintptr_t) APP_DATA_ADDR + CODE_PAGE_SIZE * (page))
+
+#define FS_PAGE_MAGIC 0x32505346 // "FSP2", page of compact records
+#define FS_PAGE_MAGIC_V1 0x31505346 // "FSP1", page of 36 bytes records
+#define FS_SEQ_FREE 0xFFFFFFFF
+#define FS_ERASE_COUNT_UNKNOWN 0xFFFFFFFF
+#define FS_NAME_ID_MAX 0xFF // Ids are reused, they must cover only names of index and batch being staged
+
+STATIC_ASSERT(FS_HOT_PAGES >= FS_RESERVED_PAGES + 2 && FS_COLD_PAGES >= FS_RESERVED_PAGES + 2);
+STATIC_ASSERT(FS_HOT_PAGES + FS_COLD_PAGES == PAGES_COUNT);
+STATIC_ASSERT(FS_RECORD_MAX_LENGTH <= UINT16_MAX);
+STATIC_ASSERT(FS_LARGE_EXTENT_SIZE > FS_INLINE_VALUE_SIZE && FS_LARGE_EXTENT_SIZE <= FS_RECORD_MAX_LENGTH);
+STATIC_ASSERT(FS_INDEX_SIZE + FS_BATCH_MAX_RECORDS < FS_NAME_ID_MAX);
+
+/*
+    Statistics state. Bytes written and erases are counted by instance from boot,
+    saved record adds counters of previous boots to them. Waits are shared by instances.
+*/
+
+typedef struct {
+    uint32_t bytes_written;
+    uint32_t pages_erased;
+    uint32_t compactions;
+} fs_stats_record_t;
+
+typedef struct {
+    fs_stats_record_t saved;    // Lifetime counters restored on mount
+    uint32_t bytes_written;
+    uint32_t pages_erased;
+    uint32_t compactions;
+    uint32_t lookups;
+    uint32_t headers_scanned;
+    uint32_t latency_total_ticks[2];    // Indexed by urgent flag of operation
+    uint32_t latency_max_ticks[2];
+    uint32_t latency_ops[2];
+    bool saved_on_shutdown;     // Write of saved record is counted by itself, so it is saved once
+} fs_part_stats_t;
+
+static struct {
+    uint32_t wait_total_ticks;
+    uint32_t wait_max_ticks;
+} stats_s;
 
 /* Wait function */
 static void fs_wait() {
-    while (nrf_fstorage_is_busy(&fstorage_instance)) {
+    if (!fs_flash_is_busy()) {
+        return;
+    }
+    uint32_t start_ticks = app_timer_cnt_get();
+    while (fs_flash_is_busy()) {
         sd_app_evt_wait();
+        fs_flash_process();
+    }
+    uint32_t wait_ticks = app_timer_cnt_diff_compute(app_timer_cnt_get(), start_ticks);
+    stats_s.wait_total_ticks += wait_ticks;
+    stats_s.wait_max_ticks = FS_MAX(stats_s.wait_max_ticks, wait_ticks);
+}
+
+
+static uint32_t generation; // Changed on every erase, see fs_map()
+// Extents of open writer are moved by compaction, it stays NULL without FS_LARGE_ENABLED
+static fs_large_writer_t *large_writer;
+
+/*
+    Payload of large record. Only extents_count offsets are stored, it is derived from length.
+    Object crc tells moved object from replaced one, when reader maps it again.
+*/
+typedef struct {
+    uint32_t length;
+    uint32_t crc;
+    uint16_t extents[FS_LARGE_MAX_EXTENTS]; // Word offsets from APP_DATA_ADDR
+} fs_large_desc_t;
+
+#define FS_LARGE_DESC_SIZE(extents_count) (offsetof(fs_large_desc_t, extents) + (extents_count) * sizeof(uint16_t))
+
+STATIC_ASSERT(sizeof(fs_large_desc_t) <= FS_RECORD_MAX_LENGTH);
+
+/*
+    Payload of patch record, changed bytes follow it. Versions of value are chained from
+    the newest patch to value record, compaction folds them to new value record.
+*/
+typedef struct {
+    uint16_t prev;      // Word offset from APP_DATA_ADDR of previous version
+    uint16_t offset;    // Offset of changed bytes in value
+} fs_patch_desc_t;
+
+#define FS_PATCH_APPEND SIZE_MAX // Offset of fs_append() patch, it is taken when write starts
+
+/*
+    Payload of counter record. Value is base plus number of cleared bits. Only header and base
+    are written with record, crc doesn`t cover bits, so they are cleared in place by increments.
+*/
+typedef struct {
+    uint32_t base;
+    uint32_t bits[FS_COUNTER_WORDS];
+} fs_counter_desc_t;
+
+#define FS_COUNTER_WRITTEN_SIZE (FS_HEADER_SIZE_BYTES + offsetof(fs_counter_desc_t, bits))
+
+STATIC_ASSERT(sizeof(fs_counter_desc_t) <= FS_RECORD_MAX_LENGTH);
+
+/*
+    Packed value record. Header value, unused by record with payload, holds codec and unpacked length.
+    Payload is a sequence of runs: control byte below 0x80 is followed by control + 1 literal bytes,
+    control byte 0x80 and above is followed by one byte repeated control - 0x80 + FS_RLE_MIN_REPEAT times.
+*/
+#define FS_CODEC_RLE 0x01
+#define FS_RLE_MIN_REPEAT 3
+#define FS_RLE_MAX_REPEAT (0x7F + FS_RLE_MIN_REPEAT)
+#define FS_RLE_MAX_LITERAL 0x80
+
+STATIC_ASSERT(FS_PACK_MIN_LENGTH > FS_INLINE_VALUE_SIZE);
+
+/*
+    Page state.
+    Every page starts with fs_page_header_t. Erase counter is written right after erase,
+    sequence number is written when page is opened for records, so page with greatest
+    sequence number is the active one.
+*/
+
+typedef struct {
+    uint32_t magic;
+    uint32_t erase_count;
+    uint32_t seq;       // FS_SEQ_FREE until page is opened
+    uint32_t reserved;
+} fs_page_header_t;
+
+#define FS_PAGE_HEADER_SIZE_BYTES sizeof(fs_page_header_t)
+
+static struct {
+    uint32_t seq;           // FS_SEQ_FREE for free page
+    uint32_t erase_count;
+    uintptr_t used_end;     // End of last record, tail_addr of instance is used for active page
+    bool legacy;            // Holds 36 bytes records, which are migrated on mount
+} pages_s[PAGES_COUNT];
+
+typedef struct {
+    volatile bool op_in_progress;
+    int8_t page;            // Page which sequence number is being written, -1 if none
+    uint32_t seq;
+} fs_page_op_t;
+
+/*
+    Checkpoint record is the first record of opened page. It holds used end of every other page
+    and index entries at that moment, so mount restores them and walks only active page.
+    Payload is uint16_t used end offset per page (0 for free page), then fs_checkpoint_entry_t array.
+*/
+
+typedef struct {
+    uint16_t phead;         // Word offsets from APP_DATA_ADDR, 0 if there is no record
+    uint16_t pname;
+} fs_checkpoint_entry_t;
+
+#define FS_CHECKPOINT_PAGES_SIZE(pages_count) (((pages_count) * sizeof(uint16_t) + WORD_SIZE - 1) / WORD_SIZE * WORD_SIZE)
+#define FS_CHECKPOINT_MAX_LENGTH (FS_CHECKPOINT_PAGES_SIZE(FS_PART_MAX_PAGES) + FS_INDEX_SIZE * sizeof(fs_checkpoint_entry_t))
+
+// Space taken on newly opened page before any record
+#if FS_CHECKPOINT_ENABLED
+#define FS_PAGE_OPEN_BYTES (FS_HEADER_SIZE_BYTES + FS_CHECKPOINT_MAX_LENGTH)
+#else
+#define FS_PAGE_OPEN_BYTES 0
+#endif
+
+STATIC_ASSERT(PAGES_COUNT * CODE_PAGE_SIZE / WORD_SIZE <= UINT16_MAX + 1);
+
+/*
+    Name record and value record are staged together and written by one operation. Compaction
+    stages extent copy and large record after name record. Only one operation is in progress
+    at time, so writes and compaction share the buffer.
+*/
+static uint32_t staging[(3 * FS_HEADER_SIZE_BYTES + RECORDNAME_MAX_LENGTH + FS_RECORD_MAX_LENGTH +
+                         sizeof(fs_large_desc_t) + WORD_SIZE) / WORD_SIZE];
+
+STATIC_ASSERT(FS_HEADER_SIZE_BYTES + FS_CHECKPOINT_MAX_LENGTH <= sizeof(staging));
+STATIC_ASSERT(FS_HEADER_SIZE_BYTES + FS_BATCH_MAX_LENGTH <= sizeof(staging));
+
+/*
+    Compaction state.
+    Compaction copies live records of victim page to active page, then erases victim and
+    writes its page header back. It is driven by fs_process(), one flash operation per call.
+*/
+
+typedef enum {
+    FS_GC_IDLE,
+    FS_GC_COPY,
+    FS_GC_ERASE,
+    FS_GC_FORMAT
+} fs_gc_state_t;
+
+typedef struct {
+    fs_gc_state_t state;
+    volatile bool op_in_progress;
+    volatile ret_code_t op_result;
+    int8_t victim;
+    bool victim_oldest;     // No older page can hold records shadowed by deleted ones, so they are dropped
+    bool no_reserve;        // Started without reserved page, writes wait until it is done
+    bool urgent;            // Started for waiting write, it is not deferred
+    bool ready;             // Next step is ready since ready_ticks
+    uint32_t ready_ticks;
+    size_t cursor;          // Next index slot to copy
+    size_t pending_bytes;   // Space on active page reserved for live records not copied yet
+    fs_header_t *copy_src;  // Record copied by operation in progress
+    fs_header_t *copy_dst;
+    fs_header_t *copy_name; // Name record staged in front of it, NULL if none
+    uint16_t *copy_extent;  // Writer offset updated when extent copy is done, NULL if none
+    size_t writer_next;     // Next extent of open writer to check
+    fs_page_header_t page_header;
+} fs_gc_t;
+
+/*
+    Name index entry, index of instance maps name to its newest records.
+*/
+
+typedef struct {
+    uint32_t hash;
+    char name[RECORDNAME_MAX_LENGTH + 1]; // Empty for free slot
+    uint8_t name_id;    // 0 if name record was taken by another name
+    fs_header_t *phead; // Newest value record, NULL until it is found
+    fs_header_t *pname; // Newest name record, it is on the same page as phead or newer one
+} fs_index_entry_t;
+
+/*
+    Instance state. Every instance has own pages, index, compaction and statistics.
+    Flash operations of instances are done one at time, so they share staging buffer and write queue.
+*/
+
+typedef struct {
+    const char *name;
+    int8_t first_page;
+    int8_t end_page;
+    int8_t curr_page;
+    uintptr_t tail_addr;    // First free byte on curr_page
+    uint32_t max_seq;
+    fs_page_op_t page_op;
+    fs_index_entry_t index_table[FS_INDEX_SIZE];
+    fs_gc_t gc;
+    fs_part_stats_t stats;
+} fs_part_t;
+
+/* Cold instance takes the top pages kept by DFU, hot instance is below it */
+static fs_part_t parts_s[FS_PARTS_COUNT] = {
+    [FS_PART_HOT] = {.name = "hot", .first_page = 0, .end_page = FS_HOT_PAGES,
+                     .curr_page = -1, .page_op = {.page = -1}, .gc = {.state = FS_GC_IDLE}},
+    [FS_PART_COLD] = {.name = "cold", .first_page = FS_HOT_PAGES, .end_page = PAGES_COUNT,
+                      .curr_page = -1, .page_op = {.page = -1}, .gc = {.state = FS_GC_IDLE}}
+};
+
+static fs_part_policy_t part_policy;
+
+/*
+    Write queue state.
+    Queued writes and compaction steps share flash, fs_process() starts next operation
+    only when previous one is finished.
+*/
+
+typedef struct {
+    fs_part_t *part;
+    char record_name[RECORDNAME_MAX_LENGTH + 1];
+    uint8_t type;
+    void *src;              // Writer for large record
+    size_t length;
+    size_t offset;          // Offset of patched bytes
+    fs_write_cb_t cb;
+    void *p_context;
+    bool urgent;            // Deferrable operation waits for quiet window
+    uint32_t queued_ticks;
+} fs_write_op_t;
+
+/* Operation of fs_write_packed(), it writes value record */
+#define FS_OP_PACKED_VALUE 0x4B
+
+static struct {
+    fs_write_op_t ops[FS_WRITE_QUEUE_SIZE];
+    uint8_t head;
+    uint8_t count;
+    bool gc_requested;      // Compaction was started to free space for head operation
+    bool gc_turn;           // Next operation slot is given to compaction
+    fs_part_id_t gc_next;   // Instance which compaction step goes first
+    volatile bool op_in_progress;
+    volatile uint8_t op_parts;  // Flash operations left, payload written from source takes up to three
+    volatile ret_code_t op_result;
+    fs_header_t *phead;     // Record written by operation in progress
+    fs_header_t *pname;     // Name record staged in front of it, NULL if none
+    uint8_t name_id;
+    bool in_place;          // Operation clears bits of stored counter record
+    uintptr_t counter_word; // Counter bits word written once since mount, it can be written once more
+} write_queue_s;
+
+/*
+    Scheduler state.
+    Flash operation stalls CPU and takes time from SoftDevice, so deferrable operations are started
+    only after FS_SCHED_QUIET_MS without traffic. Urgent operations are started at once.
+*/
+
+static struct {
+    volatile uint32_t traffic_ticks;
+    volatile bool traffic_seen;
+    bool shutdown;              // Nothing is deferred on shutdown
+} sched_s;
+
+static void fs_evt_handler(ret_code_t result, void *p_param) {
+    if (p_param == &write_queue_s) {
+        if (result != NRF_SUCCESS) {
+            write_queue_s.op_result = result;
+        }
+        if (--write_queue_s.op_parts == 0) {
+            write_queue_s.op_in_progress = false;
+        }
+        return;
+    }
+    for (fs_part_t *part = parts_s; part < parts_s + FS_PARTS_COUNT; part++) {
+        if (p_param == &part->gc) {
+            part->gc.op_result = result;
+            part->gc.op_in_progress = false;
+        }
+        else if (p_param == &part->page_op) {
+            APP_ERROR_CHECK(result);
+            part->page_op.op_in_progress = false;
+        }
+    }
+}
+
+/* Flash operations are counted by statistics of instance which started them */
+static ret_code_t part_flash_write(fs_part_t *part, uintptr_t addr, const void *src, size_t length, void *p_param) {
+    ret_code_t err_code = fs_flash_write(addr, src, length, fs_evt_handler, p_param);
+    if (err_code == NRF_SUCCESS) {
+        part->stats.bytes_written += length;
+    }
+    return err_code;
+}
+
+static ret_code_t part_flash_erase(fs_part_t *part, uintptr_t page_addr, void *p_param) {
+    ret_code_t err_code = fs_flash_erase(page_addr, fs_evt_handler, p_param);
+    if (err_code == NRF_SUCCESS) {
+        part->stats.pages_erased++;
+    }
+    return err_code;
+}
+
+static bool is_flash_op_in_progress() {
+    if (write_queue_s.op_in_progress) {
+        return true;
+    }
+    for (fs_part_t *part = parts_s; part < parts_s + FS_PARTS_COUNT; part++) {
+        if (part->gc.op_in_progress || part->page_op.op_in_progress) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Instance selection impl
+*/
+
+static fs_part_id_t get_part_id(const char *record_name) {
+    fs_part_id_t part_id = part_policy != NULL ? part_policy(record_name) : FS_PART_HOT;
+    return part_id < FS_PARTS_COUNT ? part_id : FS_PART_HOT;
+}
+
+static fs_part_t *get_part(const char *record_name) {
+    return &parts_s[get_part_id(record_name)];
+}
+
+static fs_part_t *get_header_part(const fs_header_t *phead) {
+    // Instance of record in flash, address must be checked by caller
+    int8_t page = ((uintptr_t) phead - APP_DATA_ADDR) / CODE_PAGE_SIZE;
+    return page < parts_s[FS_PART_HOT].end_page ? &parts_s[FS_PART_HOT] : &parts_s[FS_PART_COLD];
+}
+
+void fs_set_part_policy(fs_part_policy_t policy) {
+    part_policy = policy;
+}
+
+/*
+    Crc functions impl
+*/
+
+static uint8_t crc8(uint8_t crc, const uint8_t *data_block, size_t length) {
+    /*
+        Bit-serial crc8, used only for records of previous version on migration.
+    */
+    uint8_t i;
+
+    while (length--) {
+        crc ^= *data_block++;
+
+        for (i = 0; i < 8; i++) {
+            crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+        }
+    }
+
+    return crc;
+}
+
+/* CRC-32 (IEEE 802.3, reflected polynomial 0xEDB88320), one table lookup per byte */
+static const uint32_t crc32_table[256] = {
+    0x00000000, 0x77073096, 0xEE0E612C, 0x990951BA, 0x076DC419, 0x706AF48F,
+    0xE963A535, 0x9E6495A3, 0x0EDB8832, 0x79DCB8A4, 0xE0D5E91E, 0x97D2D988,
+    0x09B64C2B, 0x7EB17CBD, 0xE7B82D07, 0x90BF1D91, 0x1DB71064, 0x6AB020F2,
+    0xF3B97148, 0x84BE41DE, 0x1ADAD47D, 0x6DDDE4EB, 0xF4D4B551, 0x83D385C7,
+    0x136C9856, 0x646BA8C0, 0xFD62F97A, 0x8A65C9EC, 0x14015C4F, 0x63066CD9,
+    0xFA0F3D63, 0x8D080DF5, 0x3B6E20C8, 0x4C69105E, 0xD56041E4, 0xA2677172,
+    0x3C03E4D1, 0x4B04D447, 0xD20D85FD, 0xA50AB56B, 0x35B5A8FA, 0x42B2986C,
+    0xDBBBC9D6, 0xACBCF940, 0x32D86CE3, 0x45DF5C75, 0xDCD60DCF, 0xABD13D59,
+    0x26D930AC, 0x51DE003A, 0xC8D75180, 0xBFD06116, 0x21B4F4B5, 0x56B3C423,
+    0xCFBA9599, 0xB8BDA50F, 0x2802B89E, 0x5F058808, 0xC60CD9B2, 0xB10BE924,
+    0x2F6F7C87, 0x58684C11, 0xC1611DAB, 0xB6662D3D, 0x76DC4190, 0x01DB7106,
+    0x98D220BC, 0xEFD5102A, 0x71B18589, 0x06B6B51F, 0x9FBFE4A5, 0xE8B8D433,
+    0x7807C9A2, 0x0F00F934, 0x9609A88E, 0xE10E9818, 0x7F6A0DBB, 0x086D3D2D,
+    0x91646C97, 0xE6635C01, 0x6B6B51F4, 0x1C6C6162, 0x856530D8, 0xF262004E,
+    0x6C0695ED, 0x1B01A57B, 0x8208F4C1, 0xF50FC457, 0x65B0D9C6, 0x12B7E950,
+    0x8BBEB8EA, 0xFCB9887C, 0x62DD1DDF, 0x15DA2D49, 0x8CD37CF3, 0xFBD44C65,
+    0x4DB26158, 0x3AB551CE, 0xA3BC0074, 0xD4BB30E2, 0x4ADFA541, 0x3DD895D7,
+    0xA4D1C46D, 0xD3D6F4FB, 0x4369E96A, 0x346ED9FC, 0xAD678846, 0xDA60B8D0,
+    0x44042D73, 0x33031DE5, 0xAA0A4C5F, 0xDD0D7CC9, 0x5005713C, 0x270241AA,
+    0xBE0B1010, 0xC90C2086, 0x5768B525, 0x206F85B3, 0xB966D409, 0xCE61E49F,
+    0x5EDEF90E, 0x29D9C998, 0xB0D09822, 0xC7D7A8B4, 0x59B33D17, 0x2EB40D81,
+    0xB7BD5C3B, 0xC0BA6CAD, 0xEDB88320, 0x9ABFB3B6, 0x03B6E20C, 0x74B1D29A,
+    0xEAD54739, 0x9DD277AF, 0x04DB2615, 0x73DC1683, 0xE3630B12, 0x94643B84,
+    0x0D6D6A3E, 0x7A6A5AA8, 0xE40ECF0B, 0x9309FF9D, 0x0A00AE27, 0x7D079EB1,
+    0xF00F9344, 0x8708A3D2, 0x1E01F268, 0x6906C2FE, 0xF762575D, 0x806567CB,
+    0x196C3671, 0x6E6B06E7, 0xFED41B76, 0x89D32BE0, 0x10DA7A5A, 0x67DD4ACC,
+    0xF9B9DF6F, 0x8EBEEFF9, 0x17B7BE43, 0x60B08ED5, 0xD6D6A3E8, 0xA1D1937E,
+    0x38D8C2C4, 0x4FDFF252, 0xD1BB67F1, 0xA6BC5767, 0x3FB506DD, 0x48B2364B,
+    0xD80D2BDA, 0xAF0A1B4C, 0x36034AF6, 0x41047A60, 0xDF60EFC3, 0xA867DF55,
+    0x316E8EEF, 0x4669BE79, 0xCB61B38C, 0xBC66831A, 0x256FD2A0, 0x5268E236,
+    0xCC0C7795, 0xBB0B4703, 0x220216B9, 0x5505262F, 0xC5BA3BBE, 0xB2BD0B28,
+    0x2BB45A92, 0x5CB36A04, 0xC2D7FFA7, 0xB5D0CF31, 0x2CD99E8B, 0x5BDEAE1D,
+    0x9B64C2B0, 0xEC63F226, 0x756AA39C, 0x026D930A, 0x9C0906A9, 0xEB0E363F,
+    0x72076785, 0x05005713, 0x95BF4A82, 0xE2B87A14, 0x7BB12BAE, 0x0CB61B38,
+    0x92D28E9B, 0xE5D5BE0D, 0x7CDCEFB7, 0x0BDBDF21, 0x86D3D2D4, 0xF1D4E242,
+    0x68DDB3F8, 0x1FDA836E, 0x81BE16CD, 0xF6B9265B, 0x6FB077E1, 0x18B74777,
+    0x88085AE6, 0xFF0F6A70, 0x66063BCA, 0x11010B5C, 0x8F659EFF, 0xF862AE69,
+    0x616BFFD3, 0x166CCF45, 0xA00AE278, 0xD70DD2EE, 0x4E048354, 0x3903B3C2,
+    0xA7672661, 0xD06016F7, 0x4969474D, 0x3E6E77DB, 0xAED16A4A, 0xD9D65ADC,
+    0x40DF0B66, 0x37D83BF0, 0xA9BCAE53, 0xDEBB9EC5, 0x47B2CF7F, 0x30B5FFE9,
+    0xBDBDF21C, 0xCABAC28A, 0x53B39330, 0x24B4A3A6, 0xBAD03605, 0xCDD70693,
+    0x54DE5729, 0x23D967BF, 0xB3667A2E, 0xC4614AB8, 0x5D681B02, 0x2A6F2B94,
+    0xB40BBE37, 0xC30C8EA1, 0x5A05DF1B, 0x2D02EF8D
+};
+
+static uint32_t crc32_update(uint32_t crc, const uint8_t *data_block, size_t length) {
+    while (length--) {
+        crc = crc32_table[(crc ^ *data_block++) & 0xFF] ^ (crc >> 8);
+    }
+    return crc;
+}
+
+static uint32_t get_record_crc(const fs_header_t *phead, const uint8_t *data) {
+    /*
+        Covers type, name_id, length and value fields of header, data is covered if it is not inline.
+    */
+    uint32_t crc = crc32_update(0xFFFFFFFF, phead->_val, offsetof(fs_header_t, crc));
+    crc = crc32_update(crc, phead->value, FS_INLINE_VALUE_SIZE);
+    if (phead->type == FS_RECORD_COUNTER) {
+        // Bits are cleared after record is written
+        crc = crc32_update(crc, data, sizeof(uint32_t));
+    }
+    else if (phead->length > FS_INLINE_VALUE_SIZE) {
+        crc = crc32_update(crc, data, phead->length);
+    }
+    return crc ^ 0xFFFFFFFF;
+}
+
+/*
+    Next fs_header_t function impl
+*/
+
+static size_t get_rounded_length(size_t length) {
+    /*
+        Rounds length to top number multiples of 4
+    */
+
+    if (length % 4 == 0) {
+        return length;
+    }
+
+   return length + (4 - length % 4);
+}
+
+static size_t get_data_size(size_t length) {
+    return length > FS_INLINE_VALUE_SIZE ? get_rounded_length(length) : 0;
+}
+
+static size_t get_record_size(fs_header_t *phead) {
+    return FS_HEADER_SIZE_BYTES + get_data_size(phead->length);
+}
+
+static size_t get_name_record_size(const char *name) {
+    return FS_HEADER_SIZE_BYTES + get_data_size(strlen(name));
+}
+
+static uint8_t *get_record_data(fs_header_t *phead) {
+    return phead->length > FS_INLINE_VALUE_SIZE ? (uint8_t*) phead + FS_HEADER_SIZE_BYTES : phead->value;
+}
+
+static size_t get_packed_length(fs_header_t *phead) {
+    // Unpacked length of packed value record, 0 for any other record
+    if (phead->type != FS_RECORD_VALUE || phead->length <= FS_INLINE_VALUE_SIZE || phead->value[0] != FS_CODEC_RLE) {
+        return 0;
+    }
+    return phead->value[1] | (phead->value[2] << 8);
+}
+
+static bool is_header_sane(fs_header_t *phead) {
+    // Header fields are in range, crc is not checked
+    uintptr_t page_end = PAGE_ADDR(((uintptr_t)phead - APP_DATA_ADDR) / CODE_PAGE_SIZE + 1);
+
+    if (phead->type == FS_RECORD_NAME) {
+        if (phead->length == 0 || phead->length > RECORDNAME_MAX_LENGTH) {
+            return false;
+        }
+    }
+    else if (phead->type == FS_RECORD_CHECKPOINT) {
+        if (phead->length < FS_CHECKPOINT_PAGES_SIZE(FS_MIN(FS_HOT_PAGES, FS_COLD_PAGES)) || phead->length > FS_CHECKPOINT_MAX_LENGTH) {
+            return false;
+        }
+    }
+    else if (phead->type == FS_RECORD_LARGE) {
+        if (phead->length < FS_LARGE_DESC_SIZE(0) || phead->length > sizeof(fs_large_desc_t)) {
+            return false;
+        }
+    }
+    else if (phead->type == FS_RECORD_EXTENT) {
+        if (phead->length == 0 || phead->length > FS_LARGE_EXTENT_SIZE) {
+            return false;
+        }
+    }
+    else if (phead->type == FS_RECORD_PATCH) {
+        if (phead->length <= sizeof(fs_patch_desc_t) || phead->length > FS_RECORD_MAX_LENGTH) {
+            return false;
+        }
+    }
+    else if (phead->type == FS_RECORD_BATCH) {
+        if (phead->length < FS_HEADER_SIZE_BYTES || phead->length > FS_BATCH_MAX_LENGTH) {
+            return false;
+        }
+    }
+    else if (phead->type == FS_RECORD_COUNTER) {
+        if (phead->length != sizeof(fs_counter_desc_t)) {
+            return false;
+        }
+    }
+    else if (phead->type != FS_RECORD_VALUE || phead->length > FS_RECORD_MAX_LENGTH || get_packed_length(phead) > FS_RECORD_MAX_LENGTH) {
+        return false;
+    }
+    bool has_name = phead->type != FS_RECORD_CHECKPOINT && phead->type != FS_RECORD_EXTENT && phead->type != FS_RECORD_BATCH;
+    return (phead->name_id != 0) == has_name && (uintptr_t)phead + get_record_size(phead) <= page_end;
+}
+
+static bool is_header_valid(fs_header_t *phead) {
+    return is_header_sane(phead) && phead->crc == get_record_crc(phead, get_record_data(phead));
+}
+
+static uintptr_t page_data_addr(int8_t page) {
+    return PAGE_ADDR(page) + FS_PAGE_HEADER_SIZE_BYTES;
+}
+
+static fs_header_t *next_header_on_page(int8_t page, fs_header_t *phead) {
+    if (phead == NULL) {
+        phead = (fs_header_t*)page_data_addr(page);
+        // Checkpoint with damaged payload is skipped, page is walked by records after it then
+        if (phead->type == FS_RECORD_CHECKPOINT && is_header_sane(phead) && !is_header_valid(phead)) {
+            NRF_LOG_INFO("fs: Checkpoint of page %" PRIi8 " is corrupted", page);
+            phead = (fs_header_t*)((uint8_t*)phead + get_record_size(phead));
+        }
+    }
+    else {
+        phead = (fs_header_t*)((uint8_t*)phead + get_record_size(phead));
+    }
+
+    // Zeroed words are remains of interrupted write, see seal_torn_tail()
+    while ((uintptr_t) phead < PAGE_ADDR(page + 1) && *(uint32_t*) phead == 0) {
+        phead = (fs_header_t*)((uint8_t*)phead + WORD_SIZE);
+    }
+
+    if ((uintptr_t) phead + FS_HEADER_SIZE_BYTES > PAGE_ADDR(page + 1)) {
+        return NULL;
+    }
+
+    if (is_header_valid(phead)) {
+        NRF_LOG_DEBUG("fs_next_header: Find header at 0x%" PRIXPTR " with name id %" PRIu8, (uintptr_t) phead, phead->name_id);
+        return phead;
+    }
+    return NULL;
+}
+
+static fs_header_t *next_batch_record(fs_header_t *pbatch, fs_header_t *phead) {
+    /*
+        Walks name and value records nested in valid batch record.
+    */
+    uintptr_t batch_end = (uintptr_t) get_record_data(pbatch) + pbatch->length;
+    if (phead == NULL) {
+        phead = (fs_header_t*) get_record_data(pbatch);
+    }
+    else {
+        phead = (fs_header_t*)((uint8_t*)phead + get_record_size(phead));
+    }
+
+    if ((uintptr_t) phead + FS_HEADER_SIZE_BYTES > batch_end || !is_header_valid(phead) ||
+        (phead->type != FS_RECORD_NAME && phead->type != FS_RECORD_VALUE) ||
+        (uintptr_t) phead + get_record_size(phead) > batch_end) {
+        return NULL;
+    }
+    return phead;
+}
+
+static bool is_on_page(fs_header_t *phead, int8_t page) {
+    return (uintptr_t) phead >= PAGE_ADDR(page) && (uintptr_t) phead < PAGE_ADDR(page + 1);
+}
+
+static uint16_t get_header_offset(fs_header_t *phead) {
+    // Records are word aligned, so offset of any one fits 16 bits
+    return phead != NULL ? ((uintptr_t) phead - APP_DATA_ADDR) / WORD_SIZE : 0;
+}
+
+static fs_header_t *get_header_at(uint16_t offset) {
+    return offset != 0 ? (fs_header_t*) ((uintptr_t) APP_DATA_ADDR + offset * WORD_SIZE) : NULL;
+}
+
+static bool is_live_record(fs_header_t *phead) {
+    return phead->type == FS_RECORD_VALUE || phead->type == FS_RECORD_LARGE || phead->type == FS_RECORD_PATCH ||
+           phead->type == FS_RECORD_COUNTER;
+}
+
+static size_t get_large_bytes_on_page(const uint16_t *extents, size_t extents_count, int8_t page) {
+    size_t bytes = 0;
+    for (size_t i = 0; i < extents_count; i++) {
+        if (is_on_page(get_header_at(extents[i]), page)) {
+            bytes += get_record_size(get_header_at(extents[i]));
+        }
+    }
+    return bytes;
+}
+
+static size_t get_extents_count(fs_header_t *phead) {
+    return (phead->length - FS_LARGE_DESC_SIZE(0)) / sizeof(uint16_t);
+}
+
+static fs_header_t *get_prev_version(fs_header_t *phead) {
+    /*
+        Returns version patched by patch record, NULL for value record or broken chain.
+    */
+    if (phead->type != FS_RECORD_PATCH) {
+        return NULL;
+    }
+    fs_header_t *prev = get_header_at(((const fs_patch_desc_t*) get_record_data(phead))->prev);
+    if (prev == NULL || prev->name_id != phead->name_id ||
+        (prev->type != FS_RECORD_VALUE && prev->type != FS_RECORD_PATCH)) {
+        NRF_LOG_ERROR("fs: Broken patch chain of name id %" PRIu8, phead->name_id);
+        return NULL;
+    }
+    return prev;
+}
+
+static size_t get_patches_count(fs_header_t *phead) {
+    size_t count = 0;
+    for (phead = get_prev_version(phead); phead != NULL; phead = get_prev_version(phead)) {
+        count++;
+    }
+    return count;
+}
+
+static const fs_counter_desc_t *get_counter_desc(fs_header_t *phead) {
+    return (const fs_counter_desc_t*) get_record_data(phead);
+}
+
+static uint32_t count_set_bits(uint32_t word) {
+    uint32_t count = 0;
+    for (; word != 0; word &= word - 1) {
+        count++;
     }
+    return count;
 }
 
+static uint32_t get_counter_value(fs_header_t *phead) {
+    const fs_counter_desc_t *desc = get_counter_desc(phead);
+    uint32_t value = desc->base;
+    for (size_t i = 0; i < FS_COUNTER_WORDS; i++) {
+        value += count_set_bits(~desc->bits[i]);
+    }
+    return value;
+}
+
+/*
+    Packing impl
+*/
+
+static bool is_repeat_at(const uint8_t *src, size_t length, size_t pos) {
+    for (size_t i = 1; i < FS_RLE_MIN_REPEAT; i++) {
+        if (pos + i >= length || src[pos + i] != src[pos]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t rle_pack(const uint8_t *src, size_t length, uint8_t *dst, size_t capacity) {
+    /*
+        Returns packed length, 0 if it exceeds capacity.
+    */
+    size_t packed_length = 0;
+    size_t pos = 0;
+    while (pos < length) {
+        if (is_repeat_at(src, length, pos)) {
+            size_t run = FS_RLE_MIN_REPEAT;
+            while (pos + run < length && run < FS_RLE_MAX_REPEAT && src[pos + run] == src[pos]) {
+                run++;
+            }
+            if (packed_length + 2 > capacity) {
+                return 0;
+            }
+            dst[packed_length++] = 0x80 + (run - FS_RLE_MIN_REPEAT);
+            dst[packed_length++] = src[pos];
+            pos += run;
+            continue;
+        }
+
+        // Literal bytes last until next repeat
+        size_t literal = 1;
+        while (pos + literal < length && literal < FS_RLE_MAX_LITERAL && !is_repeat_at(src, length, pos + literal)) {
+            literal++;
+        }
+        if (packed_length + 1 + literal > capacity) {
+            return 0;
+        }
+        dst[packed_length++] = literal - 1;
+        memcpy(dst + packed_length, src + pos, literal);
+        packed_length += literal;
+        pos += literal;
+    }
+    return packed_length;
+}
+
+static void rle_unpack(const uint8_t *src, size_t length, uint8_t *dest, size_t bytes_count) {
+    /*
+        Unpacks up to bytes_count bytes.
+    */
+    size_t pos = 0;
+    size_t unpacked = 0;
+    while (pos < length && unpacked < bytes_count) {
+        uint8_t control = src[pos++];
+        if (control >= 0x80) {
+            if (pos == length) {
+                break;
+            }
+            size_t run = FS_MIN((size_t) control - 0x80 + FS_RLE_MIN_REPEAT, bytes_count - unpacked);
+            memset(dest + unpacked, src[pos++], run);
+            unpacked += run;
+        }
+        else {
+            size_t literal = FS_MIN(FS_MIN((size_t) control + 1, length - pos), bytes_count - unpacked);
+            memcpy(dest + unpacked, src + pos, literal);
+            pos += control + 1;
+            unpacked += literal;
+        }
+    }
+}
+
+static size_t resolve_value(fs_header_t *phead, uint8_t *dest, size_t bytes_count) {
+    /*
+        Copies up to bytes_count bytes of value with every patch applied, returns value length.
+        dest may be NULL to get length only. Versions are applied from the oldest one.
+    */
+    uint16_t versions[FS_PATCH_MAX_CHAIN + 1];
+    size_t count = 0;
+    for (; phead != NULL && count < ARRAY_SIZE(versions); phead = get_prev_version(phead)) {
+        versions[count++] = get_header_offset(phead);
+    }
+
+    size_t length = 0;
+    while (count > 0) {
+        fs_header_t *version = get_header_at(versions[--count]);
+        const uint8_t *data = get_record_data(version);
+        size_t data_length = version->length;
+        size_t offset = 0;
+        if (get_packed_length(version) != 0) {
+            // Packed value can be only the oldest version
+            length = get_packed_length(version);
+            if (dest != NULL) {
+                rle_unpack(data, version->length, dest, FS_MIN(length, bytes_count));
+            }
+            continue;
+        }
+        if (version->type == FS_RECORD_PATCH) {
+            offset = ((const fs_patch_desc_t*) data)->offset;
+            data += sizeof(fs_patch_desc_t);
+            data_length -= sizeof(fs_patch_desc_t);
+        }
+        if (dest != NULL && offset < bytes_count) {
+            memcpy(dest + offset, data, FS_MIN(data_length, bytes_count - offset));
+        }
+        length = FS_MAX(length, offset + data_length);
+    }
+    return length;
+}
+
+static bool is_chain_on_page(fs_header_t *phead, int8_t page) {
+    // Patched value is folded by compaction, if any version of it is on page
+    for (; phead != NULL; phead = get_prev_version(phead)) {
+        if (is_on_page(phead, page)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_region_erased(uintptr_t start_addr, uintptr_t end_addr) {
+    for (uintptr_t word_addr = start_addr; word_addr < end_addr; word_addr += WORD_SIZE) {
+        if (*(uint32_t*)word_addr != 0xffffffff) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool is_page_erased(int8_t page) {
+    return is_region_erased(PAGE_ADDR(page), PAGE_ADDR(page + 1));
+}
+
+/*
+    Name index impl
+*/
+
+static bool has_curr_page_name(fs_part_t *part, fs_index_entry_t *entry) {
+    return entry->pname != NULL && is_on_page(entry->pname, part->curr_page);
+}
+
+static uint32_t name_hash(const char *name) {
+    /* FNV-1a */
+    uint32_t hash = 2166136261u;
+    while (*name != '\0') {
+        hash ^= (uint8_t) *name++;
+        hash *= 16777619u;
+    }
+    return hash;
+}
+
+static bool is_entry_used(fs_index_entry_t *entry) {
+    return entry->name[0] != '\0';
+}
+
+static fs_index_entry_t *index_lookup(fs_part_t *part, const char *name, uint32_t hash) {
+    /*
+        Returns slot holding record with given name or first empty slot on probe sequence.
+        Returns NULL if table is full and name is not in it.
+    */
+    part->stats.lookups++;
+    for (size_t probe = 0; probe < FS_INDEX_SIZE; probe++) {
+        fs_index_entry_t *entry = &part->index_table[(hash + probe) & (FS_INDEX_SIZE - 1)];
+        part->stats.headers_scanned++;
+        if (!is_entry_used(entry) ||
+            (entry->hash == hash && strcmp(entry->name, name) == 0)) {
+            return entry;
+        }
+    }
+    return NULL;
+}
+
+static fs_index_entry_t *index_find_id(fs_part_t *part, uint8_t name_id) {
+    for (size_t i = 0; i < FS_INDEX_SIZE; i++) {
+        if (is_entry_used(&part->index_table[i]) && part->index_table[i].name_id == name_id) {
+            return &part->index_table[i];
+        }
+    }
+    return NULL;
+}
+
+static void index_remove(fs_part_t *part, fs_index_entry_t *entry) {
+    /*
+        Backward shift deletion: entries placed after removed one on their probe sequence
+        are moved back, so lookups don`t stop at the hole.
+    */
+    size_t hole = entry - part->index_table;
+    size_t start = hole;
+    // Full table has no empty slot to stop at, walk ends when it comes back to removed entry
+    for (size_t i = (hole + 1) & (FS_INDEX_SIZE - 1); i != start && is_entry_used(&part->index_table[i]); i = (i + 1) & (FS_INDEX_SIZE - 1)) {
+        size_t home = part->index_table[i].hash & (FS_INDEX_SIZE - 1);
+        if (((i - home) & (FS_INDEX_SIZE - 1)) >= ((i - hole) & (FS_INDEX_SIZE - 1))) {
+            part->index_table[hole] = part->index_table[i];
+            hole = i;
+        }
+    }
+    memset(&part->index_table[hole], 0, sizeof(fs_index_entry_t));
+}
+
+static fs_index_entry_t *index_add_name(fs_part_t *part, const char *name, uint8_t name_id) {
+    uint32_t hash = name_hash(name);
+    fs_index_entry_t *entry = index_lookup(part, name, hash);
+    if (entry == NULL) {
+        NRF_LOG_WARNING("fs_index: Index is full, record \"%s\" is not indexed", name);
+        return NULL;
+    }
+
+    // Newest name record wins, if name id was taken by other name before
+    fs_index_entry_t *id_owner = index_find_id(part, name_id);
+    if (id_owner != NULL && id_owner != entry) {
+        id_owner->name_id = 0;
+    }
+
+    if (!is_entry_used(entry)) {
+        entry->hash = hash;
+        strcpy(entry->name, name);
+        entry->phead = NULL;
+        entry->pname = NULL;
+    }
+    entry->name_id = name_id;
+    return entry;
+}
+
+static uint8_t get_free_name_id(fs_part_t *part, uint8_t after) {
+    /*
+        Name id starts from 1. Ids of names dropped by compaction are taken again, newest name record
+        wins on mount. Returns lowest id greater than after, which no indexed name holds, 0 if none is left.
+        Index holds at most FS_INDEX_SIZE names, so one of next FS_INDEX_SIZE + 1 ids is free.
+    */
+    uint32_t taken[(FS_INDEX_SIZE + 1 + 31) / 32] = {0};
+    for (size_t i = 0; i < FS_INDEX_SIZE; i++) {
+        uint8_t name_id = part->index_table[i].name_id;
+        if (is_entry_used(&part->index_table[i]) && name_id > after && name_id - after <= FS_INDEX_SIZE + 1) {
+            taken[(name_id - after - 1) / 32] |= 1u << ((name_id - after - 1) % 32);
+        }
+    }
+
+    for (size_t i = 0; i <= FS_INDEX_SIZE && after + 1 + i <= FS_NAME_ID_MAX; i++) {
+        if ((taken[i / 32] & (1u << (i % 32))) == 0) {
+            return after + 1 + i;
+        }
+    }
+    return 0;
+}
+
+static void index_add_record(fs_part_t *part, fs_header_t *phead) {
+    if (phead->type == FS_RECORD_NAME) {
+        char name[RECORDNAME_MAX_LENGTH + 1] = {0};
+        memcpy(name, get_record_data(phead), phead->length);
+        fs_index_entry_t *entry = index_add_name(part, name, phead->name_id);
+        if (entry != NULL) {
+            entry->pname = phead;
+        }
+    }
+    else if (is_live_record(phead)) {
+        fs_index_entry_t *entry = index_find_id(part, phead->name_id);
+        if (entry != NULL) {
+            entry->phead = phead;
+        }
+    }
+}
+
+static fs_header_t *index_add_page(fs_part_t *part, int8_t page) {
+    /*
+        Walks page once. Later versions of record overwrite earlier ones.
+        Returns last valid header on page.
+    */
+    fs_header_t *last_phead = NULL;
+    for (fs_header_t *phead = next_header_on_page(page, NULL); phead != NULL; phead = next_header_on_page(page, phead)) {
+        if (phead->type == FS_RECORD_BATCH) {
+            for (fs_header_t *precord = next_batch_record(phead, NULL); precord != NULL; precord = next_batch_record(phead, precord)) {
+                index_add_record(part, precord);
+            }
+        }
+        else {
+            index_add_record(part, phead);
+        }
+        last_phead = phead;
+    }
+    return last_phead;
+}
+
+/*
+    Staging impl
+*/
+
+static void stage_header(uint8_t *dst, uint8_t type, uint8_t name_id, const void *data, size_t length) {
+    fs_header_t head;
+    memset(&head, 0xFF, sizeof(head));
+    head.type = type;
+    head.name_id = name_id;
+    head.length = length;
+    if (length <= FS_INLINE_VALUE_SIZE && length > 0) {
+        memcpy(head.value, data, length);
+    }
+    head.crc = get_record_crc(&head, data);
+    memcpy(dst, head._val, FS_HEADER_SIZE_BYTES);
+}
+
+static size_t stage_record(uint8_t *dst, uint8_t type, uint8_t name_id, const void *data, size_t length) {
+    /*
+        Puts record to staging buffer, returns its size.
+    */
+    if (length > FS_INLINE_VALUE_SIZE) {
+        // Data may be staged in place already
+        memmove(dst + FS_HEADER_SIZE_BYTES, data, length);
+        memset(dst + FS_HEADER_SIZE_BYTES + length, 0xFF, get_data_size(length) - length);
+    }
+    stage_header(dst, type, name_id, data, length);
+    return FS_HEADER_SIZE_BYTES + get_data_size(length);
+}
+
+static size_t stage_direct(uint8_t *dst, uint8_t type, uint8_t name_id, const void *data, size_t length) {
+    /*
+        Stages header of record which payload is written from data. Unaligned end of payload
+        is staged after header as padded word. Returns record size.
+    */
+    size_t aligned_length = length & ~(WORD_SIZE - 1);
+    if (aligned_length != length) {
+        memset(dst + FS_HEADER_SIZE_BYTES, 0xFF, WORD_SIZE);
+        memcpy(dst + FS_HEADER_SIZE_BYTES, (const uint8_t*) data + aligned_length, length - aligned_length);
+    }
+    stage_header(dst, type, name_id, data, length);
+    return FS_HEADER_SIZE_BYTES + get_data_size(length);
+}
+
+static size_t stage_packed(uint8_t *dst, uint8_t name_id, const void *data, size_t length) {
+    /*
+        Puts packed value record to staging buffer, returns its size or 0 if packing doesn`t save flash.
+    */
+    uint8_t *packed = dst + FS_HEADER_SIZE_BYTES;
+    size_t packed_length = length >= FS_PACK_MIN_LENGTH ? rle_pack(data, length, packed, length) : 0;
+    if (packed_length <= FS_INLINE_VALUE_SIZE || get_data_size(packed_length) >= get_data_size(length)) {
+        return 0;
+    }
+    memset(packed + packed_length, 0xFF, get_data_size(packed_length) - packed_length);
+
+    fs_header_t head;
+    memset(&head, 0xFF, sizeof(head));
+    head.type = FS_RECORD_VALUE;
+    head.name_id = name_id;
+    head.length = packed_length;
+    head.value[0] = FS_CODEC_RLE;
+    head.value[1] = length & 0xFF;
+    head.value[2] = length >> 8;
+    head.crc = get_record_crc(&head, packed);
+    memcpy(dst, head._val, FS_HEADER_SIZE_BYTES);
+    return FS_HEADER_SIZE_BYTES + get_data_size(packed_length);
+}
+
+static size_t stage_name(fs_part_t *part, uint8_t *dst, fs_index_entry_t *entry) {
+    /*
+        Name record is needed only before first value record with this name id on active page.
+    */
+    if (has_curr_page_name(part, entry)) {
+        return 0;
+    }
+    return stage_record(dst, FS_RECORD_NAME, entry->name_id, entry->name, strlen(entry->name));
+}
+
+static size_t stage_batch(fs_part_t *part, uint8_t *dst, fs_batch_t *p_batch) {
+    /*
+        Puts batch record to staging buffer, name records are nested only where value needs them.
+        New names take next name ids, they are added to index when batch is written.
+        Returns 0 if index or name ids are exhausted.
+    */
+    uint8_t *payload = dst + FS_HEADER_SIZE_BYTES;
+    size_t length = 0;
+    uint8_t new_id = 0;
+    size_t free_entries = 0;
+    for (size_t i = 0; i < FS_INDEX_SIZE; i++) {
+        free_entries += !is_entry_used(&part->index_table[i]);
+    }
+
+    for (size_t i = 0; i < p_batch->count; i++) {
+        char *name = p_batch->records[i].record_name;
+        fs_index_entry_t *entry = index_lookup(part, name, name_hash(name));
+        if (entry == NULL) {
+            return 0;
+        }
+
+        uint8_t name_id;
+        if (!is_entry_used(entry) || entry->name_id == 0) {
+            new_id = get_free_name_id(part, new_id);
+            if (new_id == 0 || (!is_entry_used(entry) && free_entries-- == 0)) {
+                return 0;
+            }
+            name_id = new_id;
+            length += stage_record(payload + length, FS_RECORD_NAME, name_id, name, strlen(name));
+        }
+        else {
+            name_id = entry->name_id;
+            length += stage_name(part, payload + length, entry);
+        }
+        length += stage_record(payload + length, FS_RECORD_VALUE, name_id,
+                               p_batch->data + p_batch->records[i].offset, p_batch->records[i].length);
+    }
+    return stage_record(dst, FS_RECORD_BATCH, 0, payload, length);
+}
+
+/*
+    Pages impl
+*/
+
+static bool is_page_used(int8_t page) {
+    return pages_s[page].seq != FS_SEQ_FREE;
+}
+
+static uint8_t free_pages_count(fs_part_t *part) {
+    uint8_t count = 0;
+    for (int8_t page = part->first_page; page < part->end_page; page++) {
+        count += !is_page_used(page);
+    }
+    return count;
+}
+
+static int8_t least_worn_free_page(fs_part_t *part) {
+    int8_t result = -1;
+    for (int8_t page = part->first_page; page < part->end_page; page++) {
+        if (!is_page_used(page) &&
+            (result == -1 || pages_s[page].erase_count < pages_s[result].erase_count)) {
+            result = page;
+        }
+    }
+    return result;
+}
+
+static void page_format(fs_part_t *part, int8_t page, uint32_t erase_count) {
+    /*
+        Erases page if needed and writes page header. Used by mount and fs_format(), waits for flash.
+    */
+    static fs_page_header_t page_header;
+    ret_code_t err_code;
+
+    if (!is_page_erased(page)) {
+        err_code = part_flash_erase(part, PAGE_ADDR(page), NULL);
+        APP_ERROR_CHECK(err_code);
+        fs_wait();
+        erase_count++;
+    }
+
+    page_header = (fs_page_header_t) {
+        .magic = FS_PAGE_MAGIC,
+        .erase_count = erase_count,
+        .seq = FS_SEQ_FREE,
+        .reserved = 0xFFFFFFFF
+    };
+    err_code = part_flash_write(part, PAGE_ADDR(page), &page_header, FS_PAGE_HEADER_SIZE_BYTES, NULL);
+    APP_ERROR_CHECK(err_code);
+    fs_wait();
+
+    pages_s[page].seq = FS_SEQ_FREE;
+    pages_s[page].erase_count = erase_count;
+    pages_s[page].legacy = false;
+    pages_s[page].used_end = page_data_addr(page);
+}
+
+static void page_open_start(fs_part_t *part, int8_t page) {
+    /*
+        Writes sequence number of free page. Page becomes active in page_open_finish().
+    */
+    part->page_op.page = page;
+    part->page_op.seq = part->max_seq + 1;
+    part->page_op.op_in_progress = true;
+    ret_code_t err_code = part_flash_write(part, PAGE_ADDR(page) + offsetof(fs_page_header_t, seq),
+                                         &part->page_op.seq, sizeof(part->page_op.seq), &part->page_op);
+    APP_ERROR_CHECK(err_code);
+}
+
+static void checkpoint_write(fs_part_t *part);
+
+static void page_open_finish(fs_part_t *part) {
+    /*
+        Checkpoint write is started when it is enabled, it must be finished before any other operation.
+    */
+    if (part->curr_page != -1) {
+        pages_s[part->curr_page].used_end = part->tail_addr;
+    }
+
+    part->curr_page = part->page_op.page;
+    part->max_seq = part->page_op.seq;
+    pages_s[part->curr_page].seq = part->page_op.seq;
+    part->tail_addr = page_data_addr(part->curr_page);
+    part->page_op.page = -1;
+
+    NRF_LOG_INFO("fs: Page %" PRIi8 " opened, erase count %" PRIu32, part->curr_page, pages_s[part->curr_page].erase_count);
+#if FS_CHECKPOINT_ENABLED
+    checkpoint_write(part);
+#endif
+}
+
+static void page_open_sync(fs_part_t *part, int8_t page) {
+    page_open_start(part, page);
+    fs_wait();
+    page_open_finish(part);
+    fs_wait();
+}
+
+/*
+    Checkpoint impl
+*/
+
+static size_t stage_checkpoint(fs_part_t *part, uint8_t *dst) {
+    // Used ends are indexed by page number in instance
+    size_t pages_size = FS_CHECKPOINT_PAGES_SIZE(part->end_page - part->first_page);
+    uint16_t *used_ends = (uint16_t*)(dst + FS_HEADER_SIZE_BYTES);
+    memset(used_ends, 0, pages_size);
+    for (int8_t page = part->first_page; page < part->end_page; page++) {
+        if (is_page_used(page) && !pages_s[page].legacy && page != part->curr_page) {
+            used_ends[page - part->first_page] = pages_s[page].used_end - PAGE_ADDR(page);
+        }
+    }
+
+    fs_checkpoint_entry_t *entries = (fs_checkpoint_entry_t*)(dst + FS_HEADER_SIZE_BYTES + pages_size);
+    size_t count = 0;
+    for (size_t i = 0; i < FS_INDEX_SIZE; i++) {
+        if (is_entry_used(&part->index_table[i]) && part->index_table[i].name_id != 0 && part->index_table[i].pname != NULL) {
+            entries[count].phead = get_header_offset(part->index_table[i].phead);
+            entries[count].pname = get_header_offset(part->index_table[i].pname);
+            count++;
+        }
+    }
+
+    return stage_record(dst, FS_RECORD_CHECKPOINT, 0, used_ends, pages_size + count * sizeof(fs_checkpoint_entry_t));
+}
+
+static void checkpoint_write(fs_part_t *part) {
+    /*
+        Written to just opened page before any other record, completion is reported to page_op of instance.
+    */
+    size_t size = stage_checkpoint(part, (uint8_t*) staging);
+    uintptr_t write_addr = part->tail_addr;
+    part->tail_addr += size;
+
+    part->page_op.op_in_progress = true;
+    ret_code_t err_code = part_flash_write(part, write_addr, staging, size, &part->page_op);
+    APP_ERROR_CHECK(err_code);
+}
+
+static bool checkpoint_load(fs_part_t *part, int8_t page) {
+    /*
+        Restores index and used ends of other pages from checkpoint of active page.
+        Value records are checked by checkpoint_check_records() after active page is walked.
+        Returns false if page has no checkpoint, every page is walked then.
+    */
+    size_t pages_size = FS_CHECKPOINT_PAGES_SIZE(part->end_page - part->first_page);
+    fs_header_t *phead = next_header_on_page(page, NULL);
+    if (phead == NULL || phead->type != FS_RECORD_CHECKPOINT || phead->length < pages_size) {
+        return false;
+    }
+
+    const uint16_t *used_ends = (const uint16_t*) get_record_data(phead);
+    for (int8_t other = part->first_page; other < part->end_page; other++) {
+        if (other != page && is_page_used(other) && !pages_s[other].legacy && used_ends[other - part->first_page] == 0) {
+            NRF_LOG_WARNING("fs: Page %" PRIi8 " is missing in checkpoint", other);
+            return false;
+        }
+    }
+    for (int8_t other = part->first_page; other < part->end_page; other++) {
+        if (other != page && is_page_used(other) && !pages_s[other].legacy) {
+            pages_s[other].used_end = PAGE_ADDR(other) + used_ends[other - part->first_page];
+        }
+    }
+
+    const fs_checkpoint_entry_t *entries = (const fs_checkpoint_entry_t*)(get_record_data(phead) + pages_size);
+    size_t count = (phead->length - pages_size) / sizeof(fs_checkpoint_entry_t);
+    for (size_t i = 0; i < count; i++) {
+        // Name record is on erased page, if its value record was dropped by compaction
+        fs_header_t *pname = get_header_at(entries[i].pname);
+        if (pname == NULL || !is_header_valid(pname) || pname->type != FS_RECORD_NAME) {
+            continue;
+        }
+        char name[RECORDNAME_MAX_LENGTH + 1] = {0};
+        memcpy(name, get_record_data(pname), pname->length);
+        fs_index_entry_t *entry = index_add_name(part, name, pname->name_id);
+        if (entry != NULL) {
+            entry->pname = pname;
+            entry->phead = get_header_at(entries[i].phead);
+        }
+    }
+    return true;
+}
+
+static void checkpoint_check_records(fs_part_t *part) {
+    /*
+        Records rewritten after checkpoint point to active page already. Remaining ones are on
+        older pages, they are invalid only if compaction dropped them after checkpoint was written.
+    */
+    for (size_t i = 0; i < FS_INDEX_SIZE; ) {
+        fs_index_entry_t *entry = &part->index_table[i];
+        if (is_entry_used(entry) && entry->phead != NULL && !is_on_page(entry->phead, part->curr_page) &&
+            (!is_header_valid(entry->phead) || !is_live_record(entry->phead) ||
+             entry->phead->name_id != entry->pname->name_id)) {
+            NRF_LOG_INFO("fs: Record \"%s\" of checkpoint is dropped", entry->name);
+            index_remove(part, entry);
+        }
+        else {
+            i++;
+        }
+    }
+}
+
+/*
+    Mount impl
+*/
+
+static void seal_torn_tail(fs_part_t *part) {
+    /*
+        Write interrupted by reset leaves programmed words after last valid record.
+        They are overwritten with zeros, which are skipped by page walk, so page stays appendable.
+    */
+    static const uint32_t zero_words[16] = {0};
+
+    while (part->tail_addr < PAGE_ADDR(part->curr_page + 1) && *(uint32_t*)part->tail_addr == 0) {
+        part->tail_addr += WORD_SIZE;
+    }
+
+    uintptr_t dirty_end = part->tail_addr;
+    for (uintptr_t word_addr = part->tail_addr; word_addr < PAGE_ADDR(part->curr_page + 1); word_addr += WORD_SIZE) {
+        if (*(uint32_t*)word_addr != 0xffffffff) {
+            dirty_end = word_addr + WORD_SIZE;
+        }
+    }
+    if (dirty_end != part->tail_addr) {
+        NRF_LOG_WARNING("fs: Sealing torn write at 0x%" PRIXPTR, part->tail_addr);
+    }
+
+    while (part->tail_addr < dirty_end) {
+        size_t length = FS_MIN(sizeof(zero_words), dirty_end - part->tail_addr);
+        ret_code_t err_code = part_flash_write(part, part->tail_addr, zero_words, length, NULL);
+        APP_ERROR_CHECK(err_code);
+        fs_wait();
+        part->tail_addr += length;
+    }
+}
+
+/*
+    Migration impl
+    Previous versions wrote records with 36 bytes header, either from page start or
+    after "FSP1" page header. Newest version of every such record is rewritten on mount.
+*/
+
+typedef union {
+    uint8_t _val[36];
+
+    struct {
+        uint8_t id;
+        uint8_t nid; // inverted id
+        char record_name[RECORDNAME_MAX_LENGTH + 1];
+        uint32_t length;
+        uint8_t _crc8;
+    };
+} fs_v1_header_t;
+
+static uintptr_t v1_data_addr(int8_t page) {
+    return PAGE_ADDR(page) + (((fs_page_header_t*) PAGE_ADDR(page))->magic == FS_PAGE_MAGIC_V1 ? FS_PAGE_HEADER_SIZE_BYTES : 0);
+}
+
+static fs_v1_header_t *v1_next_header(int8_t page, fs_v1_header_t *phead) {
+    if (phead == NULL) {
+        phead = (fs_v1_header_t*) v1_data_addr(page);
+    }
+    else {
+        phead = (fs_v1_header_t*)((uint8_t*)phead + sizeof(fs_v1_header_t) + get_rounded_length(phead->length));
+    }
+
+    while ((uintptr_t) phead < PAGE_ADDR(page + 1) && *(uint32_t*) phead == 0) {
+        phead = (fs_v1_header_t*)((uint8_t*)phead + WORD_SIZE);
+    }
+
+    if ((uintptr_t) phead + sizeof(fs_v1_header_t) > PAGE_ADDR(page + 1) ||
+        (phead->id ^ 0xFF) != phead->nid || phead->length >= CODE_PAGE_SIZE ||
+        (uintptr_t) phead + sizeof(fs_v1_header_t) + phead->length > PAGE_ADDR(page + 1) ||
+        crc8(0xFF, (uint8_t*) phead + sizeof(fs_v1_header_t), phead->length) != phead->_crc8) {
+        return NULL;
+    }
+    return phead;
+}
+
+static void migrate_v1_pages(fs_part_t *part) {
+    /*
+        Pages are erased from the oldest one, so after reset in the middle remaining pages
+        still hold newest versions of their records and migration is simply repeated.
+    */
+    // Static, so mount stays within FS_STACK_MAX_BYTES
+    static fs_v1_header_t *live[FS_INDEX_SIZE];
+    size_t live_count = 0;
+
+    bool migrated[PAGES_COUNT] = {false};
+    for (;;) {
+        int8_t next_page = -1;
+        for (int8_t page = part->first_page; page < part->end_page; page++) {
+            if (pages_s[page].legacy && !migrated[page] &&
+                (next_page == -1 || pages_s[page].seq < pages_s[next_page].seq)) {
+                next_page = page;
+            }
+        }
+        if (next_page == -1) {
+            break;
+        }
+        migrated[next_page] = true;
+
+        for (fs_v1_header_t *phead = v1_next_header(next_page, NULL); phead != NULL; phead = v1_next_header(next_page, phead)) {
+            size_t i = 0;
+            while (i < live_count && strcmp(live[i]->record_name, phead->record_name) != 0) {
+                i++;
+            }
+            if (i == live_count && live_count < FS_INDEX_SIZE) {
+                live_count++;
+            }
+            if (i < live_count) {
+                live[i] = phead;
+            }
+        }
+    }
+
+    NRF_LOG_INFO("fs: Migrating %" PRIu32 " records to compact format", (uint32_t) live_count);
+    for (size_t i = 0; i < live_count; i++) {
+        if (live[i]->length == 0) {
+            continue;
+        }
+        if (fs_write(live[i]->record_name, (uint8_t*) live[i] + sizeof(fs_v1_header_t), live[i]->length) == NULL) {
+            NRF_LOG_ERROR("fs: Record \"%s\" is lost in migration", live[i]->record_name);
+        }
+    }
+
+    for (;;) {
+        int8_t next_page = -1;
+        for (int8_t page = part->first_page; page < part->end_page; page++) {
+            if (pages_s[page].legacy && (next_page == -1 || pages_s[page].seq < pages_s[next_page].seq)) {
+                next_page = page;
+            }
+        }
+        if (next_page == -1) {
+            break;
+        }
+        page_format(part, next_page, pages_s[next_page].erase_count);
+    }
+}
+
+static void read_page_headers(fs_part_t *part) {
+    /*
+        Pages without header were erased and not formatted yet or hold records of previous
+        versions (legacy pages). Erase counter of such page is unknown, greatest known one is used.
+    */
+    uint32_t max_erase_count = 0;
+    bool need_format[PAGES_COUNT];
+
+    part->max_seq = 0;
+    for (int8_t page = part->first_page; page < part->end_page; page++) {
+        fs_page_header_t *page_header = (fs_page_header_t*) PAGE_ADDR(page);
+        bool has_header = page_header->magic == FS_PAGE_MAGIC || page_header->magic == FS_PAGE_MAGIC_V1;
+        need_format[page] = false;
+        pages_s[page].legacy = false;
+        pages_s[page].erase_count = FS_ERASE_COUNT_UNKNOWN;
+
+        if (has_header && page_header->erase_count != FS_ERASE_COUNT_UNKNOWN) {
+            pages_s[page].seq = page_header->seq;
+            pages_s[page].erase_count = page_header->erase_count;
+            max_erase_count = FS_MAX(max_erase_count, page_header->erase_count);
+        }
+
+        if (page_header->magic == FS_PAGE_MAGIC && page_header->erase_count != FS_ERASE_COUNT_UNKNOWN) {
+            if (page_header->seq != FS_SEQ_FREE) {
+                part->max_seq = FS_MAX(part->max_seq, page_header->seq);
+            }
+            continue;
+        }
+
+        if (v1_next_header(page, NULL) != NULL) {
+            pages_s[page].legacy = true;
+            if (!has_header) {
+                // Pages without header were filled in ring order, they are older than "FSP1" pages
+                int8_t next_page = page + 1 < part->end_page ? page + 1 : part->first_page;
+                pages_s[page].seq = v1_next_header(next_page, NULL) == NULL ? 1 : 0;
+            }
+            else {
+                pages_s[page].seq += 2;
+            }
+            NRF_LOG_INFO("fs: Page %" PRIi8 " holds records of previous version", page);
+        }
+        else {
+            need_format[page] = true;
+        }
+    }
+
+    for (int8_t page = part->first_page; page < part->end_page; page++) {
+        if (pages_s[page].erase_count == FS_ERASE_COUNT_UNKNOWN) {
+            pages_s[page].erase_count = max_erase_count;
+        }
+        if (need_format[page]) {
+            page_format(part, page, pages_s[page].erase_count);
+        }
+    }
+}
+
+static void part_format(fs_part_t *part);
+
+static void init_page(fs_part_t *part) {
+    /*
+        Pages are indexed in sequence number order, so later versions of record overwrite earlier ones.
+        Page with greatest sequence number is the active one.
+    */
+    part->curr_page = -1;
+    memset(&part->gc, 0, sizeof(part->gc));
+    memset(&part->page_op, 0, sizeof(part->page_op));
+    part->page_op.page = -1;
+    memset(part->index_table, 0, sizeof(part->index_table));
+
+    read_page_headers(part);
+
+    int8_t last_page = -1;
+    for (int8_t page = part->first_page; page < part->end_page; page++) {
+        if (is_page_used(page) && !pages_s[page].legacy && pages_s[page].seq == part->max_seq) {
+            last_page = page;
+        }
+    }
+
+    bool indexed[PAGES_COUNT] = {false};
+    if (last_page != -1 && checkpoint_load(part, last_page)) {
+        part->curr_page = last_page;
+        // Checkpoint is the first record, so page is not empty
+        fs_header_t *last_phead = index_add_page(part, last_page);
+        pages_s[last_page].used_end = (uintptr_t) last_phead + get_record_size(last_phead);
+        checkpoint_check_records(part);
+        memset(indexed, true, sizeof(indexed));
+        NRF_LOG_INFO("fs: Index is restored from checkpoint of page %" PRIi8, last_page);
+    }
+
+    for (;;) {
+        int8_t next_page = -1;
+        for (int8_t page = part->first_page; page < part->end_page; page++) {
+            if (is_page_used(page) && !pages_s[page].legacy && !indexed[page] &&
+                (next_page == -1 || pages_s[page].seq < pages_s[next_page].seq)) {
+                next_page = page;
+            }
+        }
+        if (next_page == -1) {
+            break;
+        }
+
+        if (next_page == last_page) {
+            part->curr_page = next_page;
+        }
+        fs_header_t *last_phead = index_add_page(part, next_page);
+        pages_s[next_page].used_end = last_phead != NULL ? (uintptr_t) last_phead + get_record_size(last_phead) : page_data_addr(next_page);
+        indexed[next_page] = true;
+    }
+
+    if (part->curr_page == -1) {
+        // Nothing is written in current format yet
+        int8_t page = least_worn_free_page(part);
+        if (page == -1) {
+            NRF_LOG_WARNING("fs: No free page in %s instance, formatting", part->name);
+            part_format(part);
+            return;
+        }
+        page_open_sync(part, page);
+    }
+    else {
+        part->tail_addr = pages_s[part->curr_page].used_end;
+        seal_torn_tail(part);
+    }
+}
+
+/*
+    Find record function impl
+*/
+
+
+static fs_header_t *find_record(fs_part_t *part, const char *name) {
+    fs_index_entry_t *entry = index_lookup(part, name, name_hash(name));
+    if (entry == NULL || !is_entry_used(entry) || entry->phead == NULL || entry->phead->length == 0) {
+        return NULL;
+    }
+    return entry->phead;
+}
+
+fs_header_t *fs_find_record(char *name) {
+    NRF_LOG_DEBUG("fs_find_record: Try to find record \"%s\"", name);
+    return find_record(get_part(name), name);
+}
+
+static bool is_header_addr(fs_header_t *phead) {
+    return (uintptr_t) phead >= APP_DATA_ADDR && (uintptr_t) phead < FS_PARTITION_END;
+}
+
+ret_code_t fs_read(fs_header_t *phead, void *dest, size_t bytes_count) {
+    if (is_header_addr(phead) && phead->type == FS_RECORD_VALUE && get_packed_length(phead) == 0) {
+        NRF_LOG_INFO("fs_read: Reading data");
+        bytes_count = FS_MIN(bytes_count, phead->length);
+
+        memcpy(dest, get_record_data(phead), bytes_count);
+        return NRF_SUCCESS;
+    }
+    if (is_header_addr(phead) && (phead->type == FS_RECORD_PATCH || phead->type == FS_RECORD_VALUE)) {
+        NRF_LOG_INFO("fs_read: Reading patched or packed data");
+        resolve_value(phead, dest, bytes_count);
+        return NRF_SUCCESS;
+    }
+    if (is_header_addr(phead) && phead->type == FS_RECORD_COUNTER) {
+        NRF_LOG_INFO("fs_read: Reading counter");
+        uint32_t value = get_counter_value(phead);
+        memcpy(dest, &value, FS_MIN(bytes_count, sizeof(value)));
+        return NRF_SUCCESS;
+    }
+    NRF_LOG_INFO("fs_read: Invalid pointer to fs_header_t");
+    return NRF_ERROR_INVALID_PARAM;
+}
+
+size_t fs_record_length(fs_header_t *phead) {
+    if (!is_header_addr(phead)) {
+        return 0;
+    }
+    if (phead->type == FS_RECORD_PATCH || get_packed_length(phead) != 0) {
+        return resolve_value(phead, NULL, 0);
+    }
+    if (phead->type == FS_RECORD_LARGE) {
+        return ((const fs_large_desc_t*) get_record_data(phead))->length;
+    }
+    if (phead->type == FS_RECORD_COUNTER) {
+        return sizeof(uint32_t);
+    }
+    return phead->length;
+}
+
+ret_code_t fs_map(char *record_name, fs_map_t *p_map) {
+    fs_header_t *phead = fs_find_record(record_name);
+    if (phead != NULL && (phead->type == FS_RECORD_PATCH || phead->type == FS_RECORD_COUNTER || get_packed_length(phead) != 0)) {
+        // Value is spread over patch records, packed or decoded from counter bits
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if (phead == NULL || phead->type != FS_RECORD_VALUE) {
+        return NRF_ERROR_NOT_FOUND;
+    }
+
+    p_map->data = get_record_data(phead);
+    p_map->length = phead->length;
+    p_map->header = phead;
+    p_map->generation = generation;
+    return NRF_SUCCESS;
+}
+
+bool fs_map_is_valid(const fs_map_t *p_map) {
+    // Page of mapped header wasn`t erased while generation is the same, so header can be read
+    if (p_map->data == NULL || p_map->generation != generation) {
+        return false;
+    }
+    fs_index_entry_t *entry = index_find_id(get_header_part(p_map->header), p_map->header->name_id);
+    return entry != NULL && entry->phead == p_map->header;
+}
+
+/*
+    Scheduler impl
+*/
+
+static bool sched_is_quiet() {
+    return !sched_s.traffic_seen ||
+           app_timer_cnt_diff_compute(app_timer_cnt_get(), sched_s.traffic_ticks) >= APP_TIMER_TICKS(FS_SCHED_QUIET_MS);
+}
+
+static bool is_defer_expired(uint32_t ready_ticks) {
+    return app_timer_cnt_diff_compute(app_timer_cnt_get(), ready_ticks) >= APP_TIMER_TICKS(FS_SCHED_MAX_DEFER_MS);
+}
+
+static bool has_urgent_write() {
+    for (uint8_t i = 0; i < write_queue_s.count; i++) {
+        fs_write_op_t *op = &write_queue_s.ops[(write_queue_s.head + i) % FS_WRITE_QUEUE_SIZE];
+        if (op->urgent || is_defer_expired(op->queued_ticks)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool sched_write_allowed() {
+    /*
+        Queue is started in order, so urgent write takes deferrable ones queued before it along.
+    */
+    return sched_s.shutdown || sched_is_quiet() || has_urgent_write();
+}
+
+static bool sched_gc_allowed(fs_part_t *part) {
+    /*
+        Background compaction is deferred, unless queued write may be waiting for it.
+    */
+    if (!part->gc.ready) {
+        part->gc.ready = true;
+        part->gc.ready_ticks = app_timer_cnt_get();
+    }
+    return part->gc.urgent || sched_s.shutdown || sched_is_quiet() ||
+           is_defer_expired(part->gc.ready_ticks) || has_urgent_write();
+}
+
+static void sched_op_started(fs_part_t *part, bool urgent, uint32_t ready_ticks) {
+    uint32_t ticks = app_timer_cnt_diff_compute(app_timer_cnt_get(), ready_ticks);
+    part->stats.latency_total_ticks[urgent] += ticks;
+    part->stats.latency_max_ticks[urgent] = FS_MAX(part->stats.latency_max_ticks[urgent], ticks);
+    part->stats.latency_ops[urgent]++;
+    NRF_LOG_DEBUG("fs: %s operation started after %" PRIu32 " us",
+                  urgent ? "Urgent" : "Deferrable", FS_TICKS_TO(ticks, 1000000));
+}
+
+bool fs_sched_allowed(uint32_t ready_ticks) {
+    return sched_s.shutdown || sched_is_quiet() || is_defer_expired(ready_ticks);
+}
+
+void fs_sched_traffic() {
+    sched_s.traffic_ticks = app_timer_cnt_get();
+    sched_s.traffic_seen = true;
+}
+
+/*
+    Compaction impl
+*/
+
+static const fs_large_desc_t *get_large_desc(fs_header_t *phead) {
+    return (const fs_large_desc_t*) get_record_data(phead);
+}
+
+static size_t get_extents_bytes_on_page(fs_header_t *phead, int8_t page) {
+    if (phead->type != FS_RECORD_LARGE) {
+        return 0;
+    }
+    return get_large_bytes_on_page(get_large_desc(phead)->extents, get_extents_count(phead), page);
+}
+
+static size_t get_copied_record_size(fs_header_t *phead) {
+    // Patches are folded to value record by copy
+    if (phead->type == FS_RECORD_PATCH) {
+        return FS_HEADER_SIZE_BYTES + get_data_size(resolve_value(phead, NULL, 0));
+    }
+    return get_record_size(phead);
+}
+
+static bool is_oldest_page(fs_part_t *part, int8_t page) {
+    // No older page can hold records shadowed by deleted ones
+    for (int8_t other = part->first_page; other < part->end_page; other++) {
+        if (other != page && is_page_used(other) && !pages_s[other].legacy && pages_s[other].seq <= pages_s[page].seq) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static size_t get_copy_size(fs_index_entry_t *entry, int8_t page) {
+    /*
+        Bytes written by compaction to move records of entry from page, 0 if it has none there.
+        Upper bound, name record may be on active page already. Every moved extent is written
+        together with new large record. Patched value is copied as one value record.
+    */
+    fs_header_t *phead = entry->phead;
+    size_t records_count = 1;
+    size_t extents_bytes = 0;
+    if (phead->type == FS_RECORD_LARGE) {
+        const fs_large_desc_t *desc = get_large_desc(phead);
+        size_t extents_on_page = 0;
+        for (size_t i = 0; i < get_extents_count(phead); i++) {
+            if (is_on_page(get_header_at(desc->extents[i]), page)) {
+                extents_bytes += get_record_size(get_header_at(desc->extents[i]));
+                extents_on_page++;
+            }
+        }
+        records_count = FS_MAX(extents_on_page, 1);
+    }
+    if (!is_chain_on_page(phead, page) && extents_bytes == 0 && !is_on_page(entry->pname, page)) {
+        return 0;
+    }
+    return get_name_record_size(entry->name) + records_count * get_copied_record_size(phead) + extents_bytes;
+}
+
+static size_t get_page_live_bytes(fs_part_t *part, int8_t page) {
+    /*
+        Bytes compaction of page writes. Names rewritten in front of copied records are
+        counted too, so page without dead records is never collected.
+    */
+    bool oldest = is_oldest_page(part, page);
+    size_t live_bytes = 0;
+    for (size_t i = 0; i < FS_INDEX_SIZE; i++) {
+        fs_header_t *phead = part->index_table[i].phead;
+        if (phead != NULL && !(oldest && phead->length == 0 && is_on_page(phead, page))) {
+            live_bytes += get_copy_size(&part->index_table[i], page);
+        }
+    }
+    if (large_writer != NULL) {
+        live_bytes += get_large_bytes_on_page(large_writer->extents, large_writer->extents_count, page);
+    }
+    return live_bytes;
+}
+
+static size_t get_page_dead_bytes(fs_part_t *part, int8_t page) {
+    uintptr_t used_end = page == part->curr_page ? part->tail_addr : pages_s[page].used_end;
+    size_t used_bytes = used_end - page_data_addr(page);
+    size_t live_bytes = get_page_live_bytes(part, page);
+    return used_bytes > live_bytes ? used_bytes - live_bytes : 0;
+}
+
+static int8_t gc_select_victim(fs_part_t *part) {
+    /*
+        Page with most dead bytes is collected, older one wins a tie. Active page is collected
+        only if no other page has dead bytes, new page is opened for its live records then.
+        Page opened by compaction starts with checkpoint, so victim must reclaim more than it.
+    */
+    int8_t victim = -1;
+    size_t victim_dead_bytes = FS_PAGE_OPEN_BYTES;
+    for (int8_t page = part->first_page; page < part->end_page; page++) {
+        if (!is_page_used(page) || pages_s[page].legacy || page == part->curr_page) {
+            continue;
+        }
+        size_t dead_bytes = get_page_dead_bytes(part, page);
+        if (dead_bytes > victim_dead_bytes ||
+            (victim != -1 && dead_bytes == victim_dead_bytes && pages_s[page].seq < pages_s[victim].seq)) {
+            victim = page;
+            victim_dead_bytes = dead_bytes;
+        }
+    }
+
+    if (victim == -1 && free_pages_count(part) > 0 && get_page_dead_bytes(part, part->curr_page) > FS_PAGE_OPEN_BYTES) {
+        victim = part->curr_page;
+    }
+    return victim;
+}
+
+static bool is_pending_copy(fs_part_t *part, fs_index_entry_t *entry) {
+    fs_header_t *phead = entry->phead;
+    if (part->gc.state != FS_GC_COPY || phead == NULL || phead == part->gc.copy_src) {
+        return false;
+    }
+    bool on_victim = is_chain_on_page(phead, part->gc.victim) || get_extents_bytes_on_page(phead, part->gc.victim) > 0;
+    if (is_on_page(entry->pname, part->gc.victim) && !on_victim) {
+        // Name record of value on older page, left by interrupted write. Copy keeps the name.
+        return true;
+    }
+    return on_victim && (phead->length > 0 || !part->gc.victim_oldest);
+}
+
+static void gc_start(fs_part_t *part, int8_t victim, bool urgent) {
+    part->gc.victim = victim;
+    part->gc.victim_oldest = is_oldest_page(part, victim);
+    part->gc.no_reserve = free_pages_count(part) < FS_RESERVED_PAGES;
+    part->gc.urgent = urgent || part->gc.no_reserve;
+    part->gc.ready = false;
+
+    part->gc.state = FS_GC_COPY;
+    part->gc.cursor = 0;
+    part->gc.copy_src = NULL;
+    part->gc.writer_next = 0;
+    part->gc.pending_bytes = 0;
+    for (size_t i = 0; i < FS_INDEX_SIZE; i++) {
+        if (is_pending_copy(part, &part->index_table[i])) {
+            part->gc.pending_bytes += get_copy_size(&part->index_table[i], victim);
+        }
+    }
+    if (large_writer != NULL) {
+        part->gc.pending_bytes += get_large_bytes_on_page(large_writer->extents, large_writer->extents_count, victim);
+    }
+    NRF_LOG_INFO("fs: Start compaction of page %" PRIi8, victim);
+}
+
+static bool gc_can_start(fs_part_t *part, int8_t victim) {
+    /*
+        Reserved page is taken if reset interrupts compaction. Until it is given back,
+        live records of victim must fit active page.
+    */
+    return free_pages_count(part) >= FS_RESERVED_PAGES ||
+           (victim != part->curr_page && get_page_live_bytes(part, victim) <= PAGE_ADDR(part->curr_page + 1) - part->tail_addr);
+}
+
+static void gc_start_background(fs_part_t *part) {
+    /*
+        Compaction is started in advance, if it can reclaim enough space. Reserved page taken by
+        compaction interrupted by reset is given back first, if live records of victim fit active page.
+    */
+    uint8_t free_pages = free_pages_count(part);
+    if (part->gc.state != FS_GC_IDLE || free_pages > FS_RESERVED_PAGES) {
+        return;
+    }
+
+    int8_t victim = gc_select_victim(part);
+    if (victim == -1) {
+        return;
+    }
+    if (free_pages < FS_RESERVED_PAGES) {
+        if (gc_can_start(part, victim)) {
+            NRF_LOG_WARNING("fs: Reserved page is in use, compacting page %" PRIi8, victim);
+            gc_start(part, victim, false);
+        }
+    }
+    else if (PAGE_ADDR(part->curr_page + 1) - part->tail_addr < FS_COMPACTION_THRESHOLD_BYTES &&
+             get_page_dead_bytes(part, victim) >= FS_COMPACTION_THRESHOLD_BYTES) {
+        gc_start(part, victim, false);
+    }
+}
+
+static bool gc_start_dropping(fs_part_t *part, bool urgent) {
+    /*
+        Deleted records hold index entries and name ids until compaction of oldest page drops them.
+        When index or name ids are exhausted, oldest pages are compacted until they are dropped.
+        Returns true if write has to wait for compaction.
+    */
+    if (part->gc.state != FS_GC_IDLE) {
+        return true;
+    }
+
+    bool has_deleted = false;
+    for (size_t i = 0; i < FS_INDEX_SIZE; i++) {
+        fs_header_t *phead = part->index_table[i].phead;
+        has_deleted |= is_entry_used(&part->index_table[i]) && (phead == NULL || phead->length == 0);
+    }
+    int8_t victim = -1;
+    for (int8_t page = part->first_page; page < part->end_page; page++) {
+        if (is_page_used(page) && !pages_s[page].legacy && is_oldest_page(part, page)) {
+            victim = page;
+        }
+    }
+    if (!has_deleted || victim == -1 || !gc_can_start(part, victim)) {
+        return false;
+    }
+    gc_start(part, victim, urgent);
+    return true;
+}
+
+static bool gc_open_page(fs_part_t *part) {
+    // Reserved page is taken, victim gives back at least the same space
+    int8_t page = least_worn_free_page(part);
+    if (page == -1) {
+        NRF_LOG_ERROR("fs: No free page for compaction");
+        part->gc.state = FS_GC_IDLE;
+        return false;
+    }
+    page_open_start(part, page);
+    return true;
+}
+
+static bool gc_copy_extent(fs_part_t *part, uint16_t *extents, size_t extents_count, size_t *p_next) {
+    /*
+        Copies next extent found on victim page, its offset is updated when copy is done.
+        Returns false if there is no one left.
+    */
+    for (; *p_next < extents_count; (*p_next)++) {
+        fs_header_t *phead = get_header_at(extents[*p_next]);
+        if (!is_on_page(phead, part->gc.victim)) {
+            continue;
+        }
+
+        size_t record_size = get_record_size(phead);
+        if (part->curr_page == part->gc.victim || part->tail_addr + record_size > PAGE_ADDR(part->curr_page + 1)) {
+            gc_open_page(part);
+            return true;
+        }
+        memcpy(staging, phead, record_size);
+
+        part->gc.pending_bytes -= record_size;
+        part->gc.copy_src = phead;
+        part->gc.copy_dst = (fs_header_t*) part->tail_addr;
+        part->gc.copy_name = NULL;
+        part->gc.copy_extent = &extents[*p_next];
+        uintptr_t write_addr = part->tail_addr;
+        part->tail_addr += record_size;
+        (*p_next)++;
+
+        part->gc.op_in_progress = true;
+        ret_code_t err_code = part_flash_write(part, write_addr, staging, record_size, &part->gc);
+        APP_ERROR_CHECK(err_code);
+        return true;
+    }
+    return false;
+}
+
+static bool gc_copy_large(fs_part_t *part, fs_index_entry_t *entry) {
+    /*
+        Extent on victim is copied together with new large record pointing to the copy,
+        so moved part of object is kept after reset. Entry stays at cursor until every extent is moved.
+        Returns false if no extent is left on victim, large record itself is copied as is then.
+    */
+    fs_header_t *phead = entry->phead;
+    const fs_large_desc_t *desc = get_large_desc(phead);
+    size_t i = 0;
+    while (i < get_extents_count(phead) && !is_on_page(get_header_at(desc->extents[i]), part->gc.victim)) {
+        i++;
+    }
+    if (i == get_extents_count(phead)) {
+        return false;
+    }
+    bool last_extent = true;
+    for (size_t j = i + 1; j < get_extents_count(phead); j++) {
+        last_extent = last_extent && !is_on_page(get_header_at(desc->extents[j]), part->gc.victim);
+    }
+
+    fs_header_t *extent = get_header_at(desc->extents[i]);
+    size_t extent_size = get_record_size(extent);
+    size_t bytes_to_write = (has_curr_page_name(part, entry) ? 0 : get_name_record_size(entry->name)) +
+                            extent_size + get_record_size(phead);
+    if (part->curr_page == part->gc.victim || part->tail_addr + bytes_to_write > PAGE_ADDR(part->curr_page + 1)) {
+        gc_open_page(part);
+        return true;
+    }
+
+    uint8_t *dst = (uint8_t*) staging;
+    size_t name_size = stage_name(part, dst, entry);
+    memcpy(dst + name_size, extent, extent_size);
+    fs_large_desc_t *new_desc = (fs_large_desc_t*)(dst + name_size + extent_size + FS_HEADER_SIZE_BYTES);
+    memcpy(new_desc, desc, phead->length);
+    new_desc->extents[i] = get_header_offset((fs_header_t*)(part->tail_addr + name_size));
+    size_t record_size = stage_record(dst + name_size + extent_size, FS_RECORD_LARGE, entry->name_id, new_desc, phead->length);
+
+    // Rest of object stays reserved until its last extent is moved
+    part->gc.pending_bytes -= last_extent ? get_copy_size(entry, part->gc.victim) : extent_size + record_size;
+    part->gc.copy_src = phead;
+    part->gc.copy_dst = (fs_header_t*)(part->tail_addr + name_size + extent_size);
+    part->gc.copy_name = name_size > 0 ? (fs_header_t*) part->tail_addr : NULL;
+    part->gc.copy_extent = NULL;
+    uintptr_t write_addr = part->tail_addr;
+    part->tail_addr += name_size + extent_size + record_size;
+
+    part->gc.op_in_progress = true;
+    ret_code_t err_code = part_flash_write(part, write_addr, staging, name_size + extent_size + record_size, &part->gc);
+    APP_ERROR_CHECK(err_code);
+    return true;
+}
+
+static void gc_copy_next(fs_part_t *part) {
+    /*
+        Copies next live record of victim page. Index holds only newest version of every record,
+        so one pass over it gives whole live set. Extents of open large object writer are copied after it.
+    */
+    for (; part->gc.cursor < FS_INDEX_SIZE; part->gc.cursor++) {
+        fs_index_entry_t *entry = &part->index_table[part->gc.cursor];
+        fs_header_t *phead = entry->phead;
+        if (!is_pending_copy(part, entry)) {
+            continue;
+        }
+        if (phead->type == FS_RECORD_LARGE && gc_copy_large(part, entry)) {
+            return;
+        }
+
+        size_t bytes_to_write = (has_curr_page_name(part, entry) ? 0 : get_name_record_size(entry->name)) + get_copied_record_size(phead);
+        if (part->curr_page == part->gc.victim || part->tail_addr + bytes_to_write > PAGE_ADDR(part->curr_page + 1)) {
+            gc_open_page(part);
+            return;
+        }
+
+        // Name record is staged in front of copied record, so both are moved by one operation.
+        uint8_t *dst = (uint8_t*) staging;
+        size_t name_size = stage_name(part, dst, entry);
+        size_t record_size;
+        if (phead->type == FS_RECORD_PATCH) {
+            uint8_t *data = dst + name_size + FS_HEADER_SIZE_BYTES;
+            size_t length = resolve_value(phead, data, FS_RECORD_MAX_LENGTH);
+            record_size = stage_record(dst + name_size, FS_RECORD_VALUE, entry->name_id, data, length);
+        }
+        else if (phead->type == FS_RECORD_COUNTER) {
+            // Cleared bits are folded to base, bits of copy stay erased
+            fs_counter_desc_t *desc = (fs_counter_desc_t*)(dst + name_size + FS_HEADER_SIZE_BYTES);
+            desc->base = get_counter_value(phead);
+            stage_header(dst + name_size, FS_RECORD_COUNTER, entry->name_id, desc, sizeof(fs_counter_desc_t));
+            record_size = get_record_size(phead);
+        }
+        else {
+            record_size = get_record_size(phead);
+            memcpy(dst + name_size, phead, record_size);
+        }
+        size_t written_size = phead->type == FS_RECORD_COUNTER ? FS_COUNTER_WRITTEN_SIZE : record_size;
+
+        part->gc.pending_bytes -= get_copy_size(entry, part->gc.victim);
+        part->gc.copy_src = phead;
+        part->gc.copy_dst = (fs_header_t*)(part->tail_addr + name_size);
+        part->gc.copy_name = name_size > 0 ? (fs_header_t*) part->tail_addr : NULL;
+        part->gc.copy_extent = NULL;
+        uintptr_t write_addr = part->tail_addr;
+        part->tail_addr += name_size + record_size;
+        part->gc.cursor++;
+
+        part->gc.op_in_progress = true;
+        ret_code_t err_code = part_flash_write(part, write_addr, staging, name_size + written_size, &part->gc);
+        APP_ERROR_CHECK(err_code);
+        return;
+    }
+
+    if (large_writer != NULL &&
+        gc_copy_extent(part, large_writer->extents, large_writer->extents_count, &part->gc.writer_next)) {
+        return;
+    }
+
+    if (part->curr_page == part->gc.victim) {
+        // Active page can`t be erased, even if nothing was copied from it
+        gc_open_page(part);
+        return;
+    }
+
+    // Every live record is copied, deleted records and unused names left on victim are dropped with it.
+    for (size_t i = 0; i < FS_INDEX_SIZE; ) {
+        if (is_on_page(part->index_table[i].phead, part->gc.victim) || is_on_page(part->index_table[i].pname, part->gc.victim)) {
+            index_remove(part, &part->index_table[i]);
+        }
+        else {
+            i++;
+        }
+    }
+
+    part->gc.state = FS_GC_ERASE;
+    generation++;
+    part->gc.op_in_progress = true;
+    ret_code_t err_code = part_flash_erase(part, PAGE_ADDR(part->gc.victim), &part->gc);
+    APP_ERROR_CHECK(err_code);
+}
+
+static void gc_format_victim(fs_part_t *part) {
+    part->gc.page_header = (fs_page_header_t) {
+        .magic = FS_PAGE_MAGIC,
+        .erase_count = pages_s[part->gc.victim].erase_count + 1,
+        .seq = FS_SEQ_FREE,
+        .reserved = 0xFFFFFFFF
+    };
+
+    part->gc.state = FS_GC_FORMAT;
+    part->gc.op_in_progress = true;
+    ret_code_t err_code = part_flash_write(part, PAGE_ADDR(part->gc.victim), &part->gc.page_header, FS_PAGE_HEADER_SIZE_BYTES, &part->gc);
+    APP_ERROR_CHECK(err_code);
+}
+
+static void stats_save(fs_part_t *part);
+
+static void gc_step(fs_part_t *part) {
+    APP_ERROR_CHECK(part->gc.op_result);
+
+    switch (part->gc.state) {
+        case FS_GC_COPY:
+            if (part->gc.copy_src != NULL && part->gc.copy_src->type == FS_RECORD_EXTENT) {
+                if (part->gc.copy_extent != NULL) {
+                    *part->gc.copy_extent = get_header_offset(part->gc.copy_dst);
+                }
+                part->gc.copy_src = NULL;
+            }
+            else if (part->gc.copy_src != NULL) {
+                // Record could be rewritten while copy was in progress, newer version wins.
+                fs_index_entry_t *entry = index_find_id(part, part->gc.copy_src->name_id);
+                if (entry != NULL && entry->phead == part->gc.copy_src) {
+                    entry->phead = part->gc.copy_dst;
+                }
+                if (entry != NULL && part->gc.copy_name != NULL) {
+                    entry->pname = part->gc.copy_name;
+                }
+                part->gc.copy_src = NULL;
+            }
+            gc_copy_next(part);
+            break;
+        case FS_GC_ERASE:
+            gc_format_victim(part);
+            break;
+        case FS_GC_FORMAT:
+            pages_s[part->gc.victim].seq = FS_SEQ_FREE;
+            pages_s[part->gc.victim].erase_count = part->gc.page_header.erase_count;
+            pages_s[part->gc.victim].legacy = false;
+            pages_s[part->gc.victim].used_end = page_data_addr(part->gc.victim);
+            NRF_LOG_INFO("fs: Compaction done, page %" PRIi8 " is free", part->gc.victim);
+            part->gc.state = FS_GC_IDLE;
+            part->stats.compactions++;
+            stats_save(part);
+            break;
+        case FS_GC_IDLE:
+            break;
+    }
+}
+
+/*
+    Write funtion impl
+*/
+
+static bool is_enough_space(fs_part_t *part, size_t bytes_to_write) {
+    if (part->gc.state == FS_GC_COPY && (part->curr_page == part->gc.victim || part->gc.no_reserve)) {
+        // Active page is collected, records go to page opened by compaction.
+        // Without reserved page every free byte of active page may be needed by compaction.
+        return false;
+    }
+    size_t reserved = part->gc.state == FS_GC_COPY ? part->gc.pending_bytes : 0;
+    return part->tail_addr + reserved + bytes_to_write <= PAGE_ADDR(part->curr_page + 1);
+}
+
+static void write_complete(ret_code_t result, fs_header_t *phead) {
+    fs_write_op_t op = write_queue_s.ops[write_queue_s.head];
+    write_queue_s.head = (write_queue_s.head + 1) % FS_WRITE_QUEUE_SIZE;
+    write_queue_s.count--;
+    write_queue_s.gc_requested = false;
+
+    if (op.cb != NULL) {
+        op.cb(result, phead, op.p_context);
+    }
+}
+
+static void write_finish() {
+    /*
+        Called when operation in progress is done. Record becomes visible for fs_find_record() only now.
+    */
+    fs_part_t *part = write_queue_s.ops[write_queue_s.head].part;
+    fs_header_t *phead = write_queue_s.phead;
+    bool in_place = write_queue_s.in_place;
+    write_queue_s.phead = NULL;
+    write_queue_s.in_place = false;
+
+    if (write_queue_s.op_result != NRF_SUCCESS) {
+        NRF_LOG_WARNING("fs_write: Flash operation failed, error %" PRIu32, write_queue_s.op_result);
+        write_complete(write_queue_s.op_result, NULL);
+        return;
+    }
+    if (in_place) {
+        // Counter record stays where it is, index doesn`t change
+        write_complete(NRF_SUCCESS, phead);
+        return;
+    }
+
+    fs_write_op_t *op = &write_queue_s.ops[write_queue_s.head];
+    if (op->type == FS_RECORD_EXTENT) {
+        // Extent is moved by compaction from now on
+        large_writer->extents[large_writer->extents_count++] = get_header_offset(phead);
+    }
+    else if (op->type == FS_RECORD_BATCH) {
+        // Name record goes before value record, so value finds its entry
+        for (fs_header_t *precord = next_batch_record(phead, NULL); precord != NULL; precord = next_batch_record(phead, precord)) {
+            fs_index_entry_t *entry = index_find_id(part, precord->name_id);
+            if (precord->type == FS_RECORD_VALUE && entry != NULL && is_pending_copy(part, entry)) {
+                part->gc.pending_bytes -= get_copy_size(entry, part->gc.victim);
+            }
+            index_add_record(part, precord);
+        }
+    }
+    else {
+        fs_index_entry_t *entry = index_add_name(part, op->record_name, write_queue_s.name_id);
+        if (is_pending_copy(part, entry)) {
+            // New version supersedes record compaction has not copied yet
+            part->gc.pending_bytes -= get_copy_size(entry, part->gc.victim);
+        }
+        entry->phead = phead;
+        if (write_queue_s.pname != NULL) {
+            entry->pname = write_queue_s.pname;
+        }
+        if (op->type == FS_RECORD_LARGE) {
+            // Extents belong to committed object
+            large_writer = NULL;
+        }
+    }
+
+    gc_start_background(part);
+
+    write_complete(NRF_SUCCESS, phead);
+}
+
+static void write_op_start(fs_part_t *part, size_t name_size, size_t record_size, uint8_t name_id, const void *direct_src) {
+    /*
+        Writes staged records to tail of active page. If direct_src is not NULL, only name record and
+        header are staged, aligned part of payload is written from direct_src and padded last word
+        from staging after header. Header goes last, so payload torn by reset is sealed as garbage
+        after tail, see seal_torn_tail().
+    */
+    write_queue_s.name_id = name_id;
+    write_queue_s.pname = name_size > 0 ? (fs_header_t*) part->tail_addr : NULL;
+    write_queue_s.phead = (fs_header_t*)(part->tail_addr + name_size);
+    uintptr_t write_addr = part->tail_addr;
+    part->tail_addr += name_size + record_size;
+
+    fs_write_op_t *op = &write_queue_s.ops[write_queue_s.head];
+    sched_op_started(part, op->urgent, op->queued_ticks);
+
+    size_t staged_size = name_size + record_size;
+    if (op->type == FS_RECORD_COUNTER) {
+        // Bits of counter are left erased for increments
+        staged_size = name_size + FS_COUNTER_WRITTEN_SIZE;
+    }
+    size_t aligned_length = 0;
+    size_t tail_size = 0;
+    if (direct_src != NULL) {
+        staged_size = name_size + FS_HEADER_SIZE_BYTES;
+        aligned_length = op->length & ~(WORD_SIZE - 1);
+        tail_size = record_size - FS_HEADER_SIZE_BYTES - aligned_length;
+    }
+
+    // Event of first part can come before next one is queued
+    write_queue_s.op_result = NRF_SUCCESS;
+    write_queue_s.op_parts = 1 + (aligned_length > 0) + (tail_size > 0);
+    write_queue_s.op_in_progress = true;
+    ret_code_t err_code;
+    if (aligned_length > 0) {
+        err_code = part_flash_write(part, write_addr + staged_size, direct_src, aligned_length, &write_queue_s);
+        APP_ERROR_CHECK(err_code);
+    }
+    if (tail_size > 0) {
+        err_code = part_flash_write(part, write_addr + staged_size + aligned_length,
+                                    (uint8_t*) staging + staged_size, tail_size, &write_queue_s);
+        APP_ERROR_CHECK(err_code);
+    }
+    err_code = part_flash_write(part, write_addr, staging, staged_size, &write_queue_s);
+    APP_ERROR_CHECK(err_code);
+}
+
+static bool is_direct_write(const fs_write_op_t *op, const void *src) {
+    /*
+        Payload is written from source only if it can`t change while it is written. Compaction moves
+        records of fs, so source in partition is staged. Deferred data is updated in place, so it is
+        shorter than FS_DIRECT_WRITE_MIN_LENGTH.
+    */
+    uintptr_t src_addr = (uintptr_t) src;
+    return (op->type == FS_RECORD_VALUE || op->type == FS_RECORD_EXTENT) && src == op->src &&
+           op->length >= FS_DIRECT_WRITE_MIN_LENGTH && src_addr % WORD_SIZE == 0 &&
+           (src_addr + op->length <= FS_PARTITION_START || src_addr >= FS_PARTITION_END);
+}
+
+static size_t stage_counter_bits(fs_header_t *phead, uint32_t increment, uintptr_t *p_addr) {
+    /*
+        Stages bits words of counter record changed by increment, returns their size or 0 if free bits
+        are not enough. Every word is written at most twice between erases, so partially cleared word
+        is taken again only if it was written once since mount. Other ones are full.
+    */
+    const fs_counter_desc_t *desc = get_counter_desc(phead);
+    size_t first = 0;
+    while (first < FS_COUNTER_WORDS && desc->bits[first] != 0xFFFFFFFF &&
+           (desc->bits[first] == 0 || (uintptr_t) &desc->bits[first] != write_queue_s.counter_word)) {
+        first++;
+    }
+    uint32_t free_bits = 0;
+    for (size_t i = first; i < FS_COUNTER_WORDS; i++) {
+        free_bits += count_set_bits(desc->bits[i]);
+    }
+    if (increment == 0 || free_bits < increment) {
+        return 0;
+    }
+
+    uint32_t *words = staging;
+    size_t count = 0;
+    for (size_t i = first; increment > 0; i++) {
+        uint32_t word = desc->bits[i];
+        for (; increment > 0 && word != 0; increment--) {
+            word &= word - 1;
+        }
+        words[count++] = word;
+    }
+    bool last_written_once = count > 1 || desc->bits[first] == 0xFFFFFFFF;
+    write_queue_s.counter_word = last_written_once && words[count - 1] != 0 ? (uintptr_t) &desc->bits[first + count - 1] : 0;
+    *p_addr = (uintptr_t) &desc->bits[first];
+    return count * WORD_SIZE;
+}
+
+static bool counter_write_start(fs_part_t *part, fs_header_t *phead) {
+    /*
+        Adds increment of head operation to stored counter record by clearing its bits.
+        Returns false if record has not enough free bits, then new record is written.
+        Record on victim may be copied already, its copy would miss cleared bits, so new record is written too.
+    */
+    fs_write_op_t *op = &write_queue_s.ops[write_queue_s.head];
+    if (part->gc.state == FS_GC_COPY && is_on_page(phead, part->gc.victim)) {
+        return false;
+    }
+    uintptr_t write_addr;
+    size_t size = stage_counter_bits(phead, op->offset, &write_addr);
+    if (size == 0) {
+        return false;
+    }
+
+    write_queue_s.name_id = phead->name_id;
+    write_queue_s.pname = NULL;
+    write_queue_s.phead = phead;
+    write_queue_s.in_place = true;
+    sched_op_started(part, op->urgent, op->queued_ticks);
+
+    write_queue_s.op_result = NRF_SUCCESS;
+    write_queue_s.op_parts = 1;
+    write_queue_s.op_in_progress = true;
+    ret_code_t err_code = part_flash_write(part, write_addr, staging, size, &write_queue_s);
+    APP_ERROR_CHECK(err_code);
+    return true;
+}
+
+static bool write_start() {
+    /*
+        Starts head operation of queue. Returns false if it has to wait for compaction.
+    */
+    fs_write_op_t *op = &write_queue_s.ops[write_queue_s.head];
+    fs_part_t *part = op->part;
+
+    if (part->gc.state == FS_GC_COPY && op->type == FS_RECORD_LARGE) {
+        // Compaction may be moving extents of writer, they are taken to large record after it
+        return false;
+    }
+
+    // Batch is staged in advance, its size depends on name records
+    size_t batch_size = 0;
+    if (op->type == FS_RECORD_BATCH) {
+        batch_size = stage_batch(part, (uint8_t*) staging, op->src);
+        if (batch_size == 0) {
+            if (gc_start_dropping(part, op->urgent)) {
+                return false;
+            }
+            NRF_LOG_WARNING("fs_batch: Index is full or no free name id");
+            write_complete(NRF_ERROR_NO_MEM, NULL);
+            return true;
+        }
+    }
+
+    fs_index_entry_t new_entry;
+    fs_index_entry_t *entry = NULL;
+    if (op->type != FS_RECORD_EXTENT && op->type != FS_RECORD_BATCH) {
+        entry = index_lookup(part, op->record_name, name_hash(op->record_name));
+        if (entry == NULL) {
+            if (gc_start_dropping(part, op->urgent)) {
+                return false;
+            }
+            NRF_LOG_WARNING("fs_write: Index is full");
+            write_complete(NRF_ERROR_NO_MEM, NULL);
+            return true;
+        }
+
+        if (!is_entry_used(entry) || entry->name_id == 0) {
+            uint8_t new_id = get_free_name_id(part, 0);
+            if (new_id == 0) {
+                if (gc_start_dropping(part, op->urgent)) {
+                    return false;
+                }
+                NRF_LOG_WARNING("fs_write: No free name id");
+                write_complete(NRF_ERROR_NO_MEM, NULL);
+                return true;
+            }
+            // Entry is added when write is done
+            strcpy(new_entry.name, op->record_name);
+            new_entry.name_id = new_id;
+            new_entry.pname = NULL;
+            entry = &new_entry;
+        }
+    }
+
+    if (op->type == FS_RECORD_COUNTER && entry != &new_entry && entry->phead != NULL &&
+        entry->phead->type == FS_RECORD_COUNTER && counter_write_start(part, entry->phead)) {
+        return true;
+    }
+
+    uint8_t type = op->type == FS_OP_PACKED_VALUE ? FS_RECORD_VALUE : op->type;
+    size_t length = op->type == FS_RECORD_LARGE ? FS_LARGE_DESC_SIZE(((fs_large_writer_t*) op->src)->extents_count) : op->length;
+    if (op->type == FS_RECORD_PATCH) {
+        if (entry == &new_entry || entry->phead == NULL || entry->phead->length == 0 ||
+            (entry->phead->type != FS_RECORD_VALUE && entry->phead->type != FS_RECORD_PATCH)) {
+            NRF_LOG_WARNING("fs_patch: No record to patch");
+            write_complete(NRF_ERROR_NOT_FOUND, NULL);
+            return true;
+        }
+        size_t value_length = resolve_value(entry->phead, NULL, 0);
+        if (op->offset == FS_PATCH_APPEND) {
+            op->offset = value_length;
+        }
+        if (op->offset > value_length || op->offset + op->length > FS_RECORD_MAX_LENGTH) {
+            NRF_LOG_WARNING("fs_patch: Invalid offset");
+            write_complete(NRF_ERROR_INVALID_PARAM, NULL);
+            return true;
+        }
+
+        // Compaction must not leave versions on victim, they are folded to new value record then
+        if (get_patches_count(entry->phead) >= FS_PATCH_MAX_CHAIN ||
+            sizeof(fs_patch_desc_t) + op->length > FS_RECORD_MAX_LENGTH ||
+            (part->gc.state == FS_GC_COPY && is_chain_on_page(entry->phead, part->gc.victim))) {
+            type = FS_RECORD_VALUE;
+            length = FS_MAX(value_length, op->offset + op->length);
+        }
+        else {
+            length = sizeof(fs_patch_desc_t) + op->length;
+        }
+    }
+    size_t bytes_to_write = (entry == NULL || has_curr_page_name(part, entry) ? 0 : get_name_record_size(entry->name)) +
+                            FS_HEADER_SIZE_BYTES + get_data_size(length);
+    if (op->type == FS_RECORD_BATCH) {
+        bytes_to_write = batch_size;
+    }
+    if (!is_enough_space(part, bytes_to_write)) {
+        if (part->gc.state != FS_GC_IDLE) {
+            // Compaction may need reserved page, record waits until it is done
+            return false;
+        }
+        if (free_pages_count(part) > FS_RESERVED_PAGES) {
+            page_open_start(part, least_worn_free_page(part));
+            return true;
+        }
+        int8_t victim = gc_select_victim(part);
+        if (!write_queue_s.gc_requested && victim != -1 && gc_can_start(part, victim)) {
+            write_queue_s.gc_requested = true;
+            gc_start(part, victim, op->urgent);
+            return false;
+        }
+        NRF_LOG_WARNING("fs_write: Not enough space");
+        write_complete(NRF_ERROR_NO_MEM, NULL);
+        return true;
+    }
+
+    if (op->type == FS_RECORD_BATCH) {
+        write_op_start(part, 0, batch_size, 0, NULL);
+        return true;
+    }
+
+    // Name record and value record are written by one operation
+    uint8_t *dst = (uint8_t*) staging;
+    size_t name_size = entry != NULL ? stage_name(part, dst, entry) : 0;
+    const void *src = op->src;
+    if (op->type == FS_RECORD_LARGE) {
+        // Offsets are taken only now, compaction could move extents while record was queued
+        fs_large_writer_t *writer = op->src;
+        fs_large_desc_t *desc = (fs_large_desc_t*)(dst + name_size + FS_HEADER_SIZE_BYTES);
+        desc->length = writer->length;
+        desc->crc = writer->crc ^ 0xFFFFFFFF;
+        memcpy(desc->extents, writer->extents, writer->extents_count * sizeof(uint16_t));
+        src = desc;
+    }
+    else if (op->type == FS_RECORD_PATCH) {
+        uint8_t *data = dst + name_size + FS_HEADER_SIZE_BYTES;
+        if (type == FS_RECORD_VALUE) {
+            resolve_value(entry->phead, data, FS_RECORD_MAX_LENGTH);
+            memcpy(data + op->offset, op->src, op->length);
+        }
+        else {
+            fs_patch_desc_t *desc = (fs_patch_desc_t*) data;
+            desc->prev = get_header_offset(entry->phead);
+            desc->offset = op->offset;
+            memcpy(data + sizeof(fs_patch_desc_t), op->src, op->length);
+        }
+        src = data;
+    }
+    else if (op->type == FS_RECORD_COUNTER) {
+        // Stored value is folded to base of new record
+        fs_counter_desc_t *desc = (fs_counter_desc_t*)(dst + name_size + FS_HEADER_SIZE_BYTES);
+        bool is_counter = entry != &new_entry && entry->phead != NULL && entry->phead->type == FS_RECORD_COUNTER;
+        desc->base = (is_counter ? get_counter_value(entry->phead) : 0) + op->offset;
+        memset(desc->bits, 0xFF, sizeof(desc->bits));
+        src = desc;
+    }
+    uint8_t name_id = entry != NULL ? entry->name_id : 0;
+    if (op->type == FS_OP_PACKED_VALUE) {
+        // Value is written as is, if packing doesn`t save flash
+        size_t record_size = stage_packed(dst + name_size, name_id, src, length);
+        if (record_size != 0) {
+            write_op_start(part, name_size, record_size, name_id, NULL);
+            return true;
+        }
+    }
+    if (is_direct_write(op, src)) {
+        size_t record_size = stage_direct(dst + name_size, type, name_id, src, length);
+        write_op_start(part, name_size, record_size, name_id, src);
+        return true;
+    }
+    size_t record_size = stage_record(dst + name_size, type, name_id, src, length);
+    write_op_start(part, name_size, record_size, name_id, NULL);
+    return true;
+}
 
-// Id starts from 1. 
-static uint8_t max_id = 0;
-static int8_t curr_page = -1;
+static void deferred_process();
 
-/*
-    Crc8 functions impl
-*/
+void fs_process() {
+    fs_flash_process();
+    deferred_process();
 
-static uint8_t crc8(uint8_t *data_block, size_t length) {
-    uint8_t crc = 0xFF;
-    uint8_t i;
+    if (is_flash_op_in_progress()) {
+        return;
+    }
 
-    while (length--) {
-        crc ^= *data_block++;
+    for (fs_part_t *part = parts_s; part < parts_s + FS_PARTS_COUNT; part++) {
+        if (part->page_op.page != -1) {
+            page_open_finish(part);
+            if (part->page_op.op_in_progress) {
+                // Checkpoint goes first on opened page
+                return;
+            }
+        }
+    }
+    if (write_queue_s.phead != NULL) {
+        write_finish();
+    }
 
-        for (i = 0; i < 8; i++) {
-            crc = crc & 0x80 ? (crc << 1) ^ 0x31 : crc << 1;
+    // Writes and compaction steps take turns, so neither of them stalls the other one
+    if (write_queue_s.count > 0 && !write_queue_s.gc_turn && sched_write_allowed() && write_start()) {
+        for (fs_part_t *part = parts_s; part < parts_s + FS_PARTS_COUNT; part++) {
+            write_queue_s.gc_turn |= part->gc.state != FS_GC_IDLE;
         }
+        return;
     }
 
-    return crc;
+    // Compaction of every instance goes in turn too
+    write_queue_s.gc_turn = false;
+    for (size_t i = 0; i < FS_PARTS_COUNT; i++) {
+        fs_part_t *part = &parts_s[(write_queue_s.gc_next + i) % FS_PARTS_COUNT];
+        if (part->gc.state != FS_GC_IDLE && sched_gc_allowed(part)) {
+            write_queue_s.gc_next = (part - parts_s + 1) % FS_PARTS_COUNT;
+            gc_step(part);
+            part->gc.ready = false;
+            if (part->gc.op_in_progress || part->page_op.op_in_progress) {
+                sched_op_started(part, part->gc.urgent, part->gc.ready_ticks);
+            }
+            return;
+        }
+    }
 }
 
-static bool check_crc(fs_header_t *phead) {
-    if (phead->length >= CODE_PAGE_SIZE || (size_t)phead + FS_HEADER_SIZE_BYTES + phead->length >= BOOTLOADER_ADDR) {
-        return false;
+static ret_code_t write_queue_push(fs_part_t *part, uint8_t type, char *record_name, const void *src, size_t bytes_count,
+                                   size_t offset, bool urgent, fs_write_cb_t cb, void *p_context) {
+    if (strlen(record_name) > RECORDNAME_MAX_LENGTH) {
+        NRF_LOG_INFO("fs_write: name \"%s\" length exceeds RECORDNAME_MAX_LENGTH", record_name);
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if (bytes_count > FS_RECORD_MAX_LENGTH) {
+        NRF_LOG_INFO("fs_write: length exceeds FS_RECORD_MAX_LENGTH");
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    if (write_queue_s.count == FS_WRITE_QUEUE_SIZE) {
+        NRF_LOG_WARNING("fs_write: Queue is full");
+        return NRF_ERROR_NO_MEM;
     }
 
-    uint8_t crc = crc8((uint8_t*)phead + FS_HEADER_SIZE_BYTES, phead->length);
-    return phead->_crc8 == crc;
+    fs_write_op_t *op = &write_queue_s.ops[(write_queue_s.head + write_queue_s.count) % FS_WRITE_QUEUE_SIZE];
+    op->part = part;
+    strcpy(op->record_name, record_name);
+    op->type = type;
+    op->src = (void*) src;
+    op->length = bytes_count;
+    op->offset = offset;
+    op->cb = cb;
+    op->p_context = p_context;
+    op->urgent = urgent;
+    op->queued_ticks = app_timer_cnt_get();
+    write_queue_s.count++;
+    return NRF_SUCCESS;
 }
 
-/*
-    Next fs_header_t function impl
-*/
+typedef struct {
+    volatile bool done;
+    fs_header_t *phead;
+} fs_sync_write_t;
 
-static size_t get_rounded_length(size_t length) {
+static void sync_write_cb(ret_code_t result, fs_header_t *phead, void *p_context) {
+    fs_sync_write_t *sync_write = p_context;
+    sync_write->phead = phead;
+    sync_write->done = true;
+}
+
+static fs_header_t *write_sync(fs_part_t *part, uint8_t type, char *record_name, const void *src, size_t bytes_count, size_t offset) {
     /*
-        Rounds length to top number multiples of 4
+        Waits for queued operations and own one. Must not be called from fs_write_cb_t.
     */
+    fs_sync_write_t sync_write = {.done = false};
+    if (write_queue_push(part, type, record_name, src, bytes_count, offset, true, sync_write_cb, &sync_write) != NRF_SUCCESS) {
+        return NULL;
+    }
 
-    if (length % 4 == 0) {
-        return length;
+    while (!sync_write.done) {
+        fs_wait();
+        fs_process();
     }
+    return sync_write.phead;
+}
 
-   return length + (4 - length % 4);
+/* Measured bound of fs calls takes small part of stack, see FS_STACK_MAX_BYTES */
+#ifdef __STACK_SIZE
+STATIC_ASSERT(FS_STACK_MAX_BYTES <= __STACK_SIZE / 4);
+#endif
+
+fs_header_t *fs_write(char* record_name, void *src, size_t bytes_count) {
+    return write_sync(get_part(record_name), FS_RECORD_VALUE, record_name, src, bytes_count, 0);
 }
 
-static bool is_page_erased(uint32_t page_addr);
+fs_header_t *fs_write_packed(char *record_name, void *src, size_t bytes_count) {
+    return write_sync(get_part(record_name), FS_OP_PACKED_VALUE, record_name, src, bytes_count, 0);
+}
 
-static void init_page() {
-    ret_code_t err_code;
+fs_header_t *fs_patch(char *record_name, size_t offset, const void *src, size_t bytes_count) {
+    fs_part_t *part = get_part(record_name);
+    if (bytes_count == 0) {
+        return find_record(part, record_name);
+    }
+    return write_sync(part, FS_RECORD_PATCH, record_name, src, bytes_count, offset);
+}
 
-    fs_header_t *phead;
-    for (int8_t page_index = 0; page_index < 3; page_index++) {
-        phead = (fs_header_t*)(APP_DATA_ADDR + CODE_PAGE_SIZE * page_index);
-        if ((phead->id ^ 0xFF) == phead->nid && check_crc(phead)) {
-            curr_page = page_index;
+fs_header_t *fs_append(char *record_name, const void *src, size_t bytes_count) {
+    return fs_patch(record_name, FS_PATCH_APPEND, src, bytes_count);
+}
+
+ret_code_t fs_write_async(char *record_name, void *src, size_t bytes_count, fs_write_cb_t cb, void *p_context) {
+    return write_queue_push(get_part(record_name), FS_RECORD_VALUE, record_name, src, bytes_count, 0, true, cb, p_context);
+}
+
+ret_code_t fs_write_packed_async(char *record_name, void *src, size_t bytes_count, fs_write_cb_t cb, void *p_context) {
+    return write_queue_push(get_part(record_name), FS_OP_PACKED_VALUE, record_name, src, bytes_count, 0, true, cb, p_context);
+}
+
+ret_code_t fs_patch_async(char *record_name, size_t offset, const void *src, size_t bytes_count, fs_write_cb_t cb, void *p_context) {
+    if (bytes_count == 0) {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    return write_queue_push(get_part(record_name), FS_RECORD_PATCH, record_name, src, bytes_count, offset, true, cb, p_context);
+}
+
+
+/*
+    Batch impl
+    Staged records are nested in one batch record, they are indexed only if its crc is valid.
+*/
+
+void fs_batch_begin(fs_batch_t *p_batch) {
+    p_batch->count = 0;
+    p_batch->size = 0;
+    p_batch->data_length = 0;
+}
+
+ret_code_t fs_batch_stage(fs_batch_t *p_batch, char *record_name, const void *src, size_t bytes_count) {
+    if (strlen(record_name) > RECORDNAME_MAX_LENGTH) {
+        NRF_LOG_INFO("fs_batch: name \"%s\" length exceeds RECORDNAME_MAX_LENGTH", record_name);
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    for (size_t i = 0; i < p_batch->count; i++) {
+        if (strcmp(p_batch->records[i].record_name, record_name) == 0) {
+            NRF_LOG_INFO("fs_batch: Record \"%s\" is staged already", record_name);
+            return NRF_ERROR_INVALID_PARAM;
         }
     }
+    if (p_batch->count > 0 && get_part_id(record_name) != p_batch->part) {
+        NRF_LOG_INFO("fs_batch: Record \"%s\" belongs to other instance", record_name);
+        return NRF_ERROR_INVALID_PARAM;
+    }
 
-    if (curr_page == -1) {
-        NRF_LOG_INFO("Page %" PRIi8, curr_page);
-        err_code = fs_format();
-        APP_ERROR_CHECK(err_code);
+    // Every record is counted with name record, so batch fits staging buffer whatever names are on active page
+    size_t size = get_name_record_size(record_name) + FS_HEADER_SIZE_BYTES + get_data_size(bytes_count);
+    if (p_batch->count == FS_BATCH_MAX_RECORDS || p_batch->size + size > FS_BATCH_MAX_LENGTH) {
+        NRF_LOG_WARNING("fs_batch: Batch is full");
+        return NRF_ERROR_NO_MEM;
     }
-}
 
-static fs_header_t *next_header(fs_header_t *phead) {
-    if (curr_page == -1) {
-        NRF_LOG_INFO("Init page");
-        init_page();
+    p_batch->part = get_part_id(record_name);
+    strcpy(p_batch->records[p_batch->count].record_name, record_name);
+    p_batch->records[p_batch->count].offset = p_batch->data_length;
+    p_batch->records[p_batch->count].length = bytes_count;
+    if (bytes_count > 0) {
+        memcpy(p_batch->data + p_batch->data_length, src, bytes_count);
     }
-    if (phead == NULL) {
-        phead = (fs_header_t*)(APP_DATA_ADDR + CODE_PAGE_SIZE * curr_page);
+    p_batch->data_length += bytes_count;
+    p_batch->size += size;
+    p_batch->count++;
+    return NRF_SUCCESS;
+}
+
+ret_code_t fs_batch_commit(fs_batch_t *p_batch) {
+    if (p_batch->count == 0) {
+        return NRF_SUCCESS;
     }
-    else {
-        phead = (fs_header_t*)((uint8_t*)phead + FS_HEADER_SIZE_BYTES + get_rounded_length(phead->length));
-        
-        if ((uintptr_t) phead >= BOOTLOADER_ADDR || (uintptr_t) phead < APP_DATA_ADDR) {
-            return NULL;
-        }
+    if (write_sync(&parts_s[p_batch->part], FS_RECORD_BATCH, "", p_batch, 0, 0) == NULL) {
+        return NRF_ERROR_NO_MEM;
     }
+    NRF_LOG_INFO("fs_batch: %" PRIu8 " records are committed", p_batch->count);
+    fs_batch_begin(p_batch);
+    return NRF_SUCCESS;
+}
 
-    NRF_LOG_INFO("%" PRIx8 " %" PRIx8 " %" PRIx8, phead->id, phead->nid, phead->id ^ 0xFF);
-    if ((phead->id ^ 0xFF) == phead->nid && check_crc(phead)) {
-        NRF_LOG_INFO("fs_next_header: Find header at 0x%" PRIXPTR " with name \"%s\"", (uintptr_t) phead, phead->record_name);
-        return phead;
+ret_code_t fs_batch_commit_async(fs_batch_t *p_batch, fs_write_cb_t cb, void *p_context) {
+    if (p_batch->count == 0) {
+        return NRF_ERROR_INVALID_LENGTH;
     }
-    return NULL;
+    return write_queue_push(&parts_s[p_batch->part], FS_RECORD_BATCH, "", p_batch, 0, 0, true, cb, p_context);
 }
 
+
+#if FS_LARGE_ENABLED
 /*
-    Find record function impl
+    Large object impl
+    Object is written as extent records, large record with their offsets commits it.
+    Extents of uncommitted object are dropped by compaction after fs_large_abort() or reset.
 */
 
+ret_code_t fs_large_open_write(fs_large_writer_t *p_writer, char *record_name) {
+    if (strlen(record_name) > RECORDNAME_MAX_LENGTH) {
+        NRF_LOG_INFO("fs_large: name \"%s\" length exceeds RECORDNAME_MAX_LENGTH", record_name);
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if (large_writer != NULL) {
+        NRF_LOG_WARNING("fs_large: Other object is being written");
+        return NRF_ERROR_BUSY;
+    }
 
-fs_header_t *fs_find_record(char *name) {
-    NRF_LOG_INFO("fs_find_record: Try to find record \"%s\"", name);
+    strcpy(p_writer->record_name, record_name);
+    p_writer->part = get_part_id(record_name);
+    p_writer->length = 0;
+    p_writer->crc = 0xFFFFFFFF;
+    p_writer->extents_count = 0;
+    large_writer = p_writer;
+    return NRF_SUCCESS;
+}
 
-    fs_header_t *phead = NULL;
-    for (fs_header_t *curr_phead = next_header(NULL); curr_phead != NULL; curr_phead = next_header(curr_phead)) {
-        if ((phead != NULL && phead->id == curr_phead->id) ||
-            strcmp(curr_phead->record_name, name) == 0) {
-            phead = curr_phead;
+ret_code_t fs_large_append(fs_large_writer_t *p_writer, const void *src, size_t bytes_count) {
+    if (p_writer != large_writer) {
+        return NRF_ERROR_INVALID_STATE;
+    }
+
+    const uint8_t *chunk = src;
+    while (bytes_count > 0) {
+        if (p_writer->extents_count == FS_LARGE_MAX_EXTENTS) {
+            NRF_LOG_WARNING("fs_large: Object \"%s\" exceeds FS_LARGE_MAX_EXTENTS", p_writer->record_name);
+            return NRF_ERROR_NO_MEM;
         }
+        size_t extent_length = FS_MIN(bytes_count, FS_LARGE_EXTENT_SIZE);
+        // Extents are kept in instance of object
+        if (write_sync(&parts_s[p_writer->part], FS_RECORD_EXTENT, "", chunk, extent_length, 0) == NULL) {
+            return NRF_ERROR_NO_MEM;
+        }
+        p_writer->length += extent_length;
+        p_writer->crc = crc32_update(p_writer->crc, chunk, extent_length);
+        chunk += extent_length;
+        bytes_count -= extent_length;
     }
-    
-    if (phead != NULL && phead->length == 0) {
-        return NULL;
+    return NRF_SUCCESS;
+}
+
+ret_code_t fs_large_commit(fs_large_writer_t *p_writer) {
+    /*
+        Writer stays open if commit fails, so it can be retried or aborted.
+    */
+    if (p_writer != large_writer) {
+        return NRF_ERROR_INVALID_STATE;
     }
-    return phead;
+    if (write_sync(&parts_s[p_writer->part], FS_RECORD_LARGE, p_writer->record_name, p_writer, 0, 0) == NULL) {
+        return NRF_ERROR_NO_MEM;
+    }
+    NRF_LOG_INFO("fs_large: Object \"%s\" of %" PRIu32 " bytes is committed", p_writer->record_name, p_writer->length);
+    return NRF_SUCCESS;
 }
 
-ret_code_t fs_read(fs_header_t *phead, void *dest, size_t bytes_count) {
-    if ((uintptr_t) phead >= APP_DATA_ADDR && (uintptr_t) phead < BOOTLOADER_ADDR) {
-        NRF_LOG_INFO("fs_read: Reading data");
-        bytes_count = FS_MIN(bytes_count, phead->length);
+void fs_large_abort(fs_large_writer_t *p_writer) {
+    if (p_writer != large_writer) {
+        return;
+    }
+    fs_part_t *part = &parts_s[p_writer->part];
+    if (part->gc.copy_extent >= p_writer->extents && part->gc.copy_extent < p_writer->extents + FS_LARGE_MAX_EXTENTS) {
+        // Extent copy in progress must not update writer any more
+        part->gc.copy_extent = NULL;
+    }
+    large_writer = NULL;
+}
 
-        memcpy(dest, (void*)((uint8_t*)phead + FS_HEADER_SIZE_BYTES), bytes_count);
-        return NRF_SUCCESS;
+static bool large_map(fs_large_reader_t *p_reader) {
+    fs_header_t *phead = fs_find_record(p_reader->record_name);
+    if (phead == NULL || phead->type != FS_RECORD_LARGE) {
+        return false;
     }
-    NRF_LOG_INFO("fs_read: Invalid pointer to fs_header_t");
-    return NRF_ERROR_INVALID_PARAM;
+    p_reader->desc.data = get_record_data(phead);
+    p_reader->desc.length = phead->length;
+    p_reader->desc.header = phead;
+    p_reader->desc.generation = generation;
+    return true;
 }
 
-/* 
-    Write funtion impl
-*/
+ret_code_t fs_large_open_read(fs_large_reader_t *p_reader, char *record_name) {
+    if (strlen(record_name) > RECORDNAME_MAX_LENGTH) {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    strcpy(p_reader->record_name, record_name);
+    if (!large_map(p_reader)) {
+        return NRF_ERROR_NOT_FOUND;
+    }
 
-static fs_header_t *get_last_record() {
-    NRF_LOG_INFO("fs_get_last_record: Try to find last_record");
+    const fs_large_desc_t *desc = p_reader->desc.data;
+    p_reader->length = desc->length;
+    p_reader->crc = desc->crc;
+    p_reader->position = 0;
+    return NRF_SUCCESS;
+}
 
-    fs_header_t *last_phead = NULL;
-    for (fs_header_t *curr_phead = next_header(NULL); curr_phead != NULL; curr_phead = next_header(curr_phead)) {
-        last_phead = curr_phead;
+ret_code_t fs_large_read(fs_large_reader_t *p_reader, void *dest, size_t bytes_count, size_t *p_bytes_read) {
+    *p_bytes_read = 0;
+    if (!fs_map_is_valid(&p_reader->desc)) {
+        // Compaction has moved extents or object was written again, object must be the same one
+        if (!large_map(p_reader) || ((const fs_large_desc_t*) p_reader->desc.data)->length != p_reader->length ||
+            ((const fs_large_desc_t*) p_reader->desc.data)->crc != p_reader->crc) {
+            NRF_LOG_INFO("fs_large: Object \"%s\" was changed while it was read", p_reader->record_name);
+            return NRF_ERROR_INVALID_STATE;
+        }
     }
-    return last_phead;
-}
 
-static bool is_page_erased(uint32_t page_addr) {
-    for (uint32_t word_addr = page_addr; word_addr - page_addr < CODE_PAGE_SIZE; word_addr += WORD_SIZE) {
-        if (*(uint32_t*)word_addr != 0xffffffff) {
-            return false;
+    const fs_large_desc_t *desc = p_reader->desc.data;
+    size_t extents_count = (p_reader->desc.length - FS_LARGE_DESC_SIZE(0)) / sizeof(uint16_t);
+    uint32_t extent_start = 0;
+    for (size_t i = 0; i < extents_count && bytes_count > 0; i++) {
+        fs_header_t *phead = get_header_at(desc->extents[i]);
+        uint32_t extent_end = extent_start + phead->length;
+        if (p_reader->position < extent_end) {
+            if (!is_header_valid(phead) || phead->type != FS_RECORD_EXTENT) {
+                NRF_LOG_ERROR("fs_large: Extent %" PRIu32 " of \"%s\" is corrupted", (uint32_t) i, p_reader->record_name);
+                return NRF_ERROR_INVALID_DATA;
+            }
+            size_t length = FS_MIN(bytes_count, extent_end - p_reader->position);
+            memcpy((uint8_t*) dest + *p_bytes_read, get_record_data(phead) + (p_reader->position - extent_start), length);
+            *p_bytes_read += length;
+            p_reader->position += length;
+            bytes_count -= length;
         }
+        extent_start = extent_end;
     }
-    NRF_LOG_INFO("page erased")
-    return true;
+    return NRF_SUCCESS;
 }
+#endif
 
-static fs_header_t *transition_to_new_page() {
-    /*
-        Endures newest records to new page.
-        Returns pointer to last record.
-    */
-    uint8_t new_page = (curr_page + 1) % 3;
-    uintptr_t new_page_addr = APP_DATA_ADDR + CODE_PAGE_SIZE * new_page;
 
-    ret_code_t err_code;
+/*
+    Write-behind impl
+*/
 
-    if (!is_page_erased(new_page_addr)) {
-        nrf_fstorage_erase(&fstorage_instance, new_page_addr, 1, NULL);
-        fs_wait();
+typedef struct {
+    fs_part_t *part;
+    char record_name[RECORDNAME_MAX_LENGTH + 1]; // Empty name for free slot, slot is freed when record is written
+    uint8_t data[FS_DEFERRED_MAX_LENGTH];
+    size_t length;
+    uint32_t updated_ticks;
+    bool dirty;     // Newer than stored version
+    bool queued;    // Write is queued, data is copied to staging buffer when it is started
+} fs_deferred_slot_t;
+
+static struct {
+    fs_deferred_slot_t slots[FS_DEFERRED_SLOTS];
+    volatile bool flush_requested;
+    bool shutdown_pending;
+} deferred_s;
+
+static bool is_stored(fs_part_t *part, char *record_name, void *src, size_t bytes_count) {
+    fs_header_t *phead = find_record(part, record_name);
+    if (phead == NULL) {
+        return bytes_count == 0;
     }
+    return phead->type == FS_RECORD_VALUE && get_packed_length(phead) == 0 && phead->length == bytes_count &&
+           memcmp(get_record_data(phead), src, bytes_count) == 0;
+}
 
-    uint32_t ids_was[256 / 32];
-    memset(ids_was, 0, sizeof(ids_was));
+static void slot_free(fs_deferred_slot_t *slot) {
+    // Stored record is the newest version, so next deferred write of it can take any slot
+    slot->part = NULL;
+    slot->record_name[0] = '\0';
+}
 
-    fs_header_t *phead = next_header(NULL);
-    fs_header_t *last_file_version;
-    fs_header_t *last_record = NULL;
+static void deferred_write_cb(ret_code_t result, fs_header_t *phead, void *p_context) {
+    fs_deferred_slot_t *slot = p_context;
+    slot->queued = false;
+    if (result != NRF_SUCCESS) {
+        slot->dirty = true;
+    }
+    else if (!slot->dirty) {
+        slot_free(slot);
+    }
+}
 
-    while (phead != NULL) {
-        last_file_version = fs_find_record(phead->record_name);
-        
-        if (last_file_version != NULL) {
-            size_t index = last_file_version->id / 32;
-            uint8_t shift = last_file_version->id % 32;
+static bool is_counters_clean();
+static void counters_process(bool flush);
 
-            if ((ids_was[index] >> shift & 1) == 0) {
-                ids_was[index] = ids_was[index] | (1 << shift);
+static bool is_deferred_clean() {
+    for (size_t i = 0; i < FS_DEFERRED_SLOTS; i++) {
+        if (deferred_s.slots[i].dirty || deferred_s.slots[i].queued) {
+            return false;
+        }
+    }
+    return is_counters_clean();
+}
 
-                err_code = nrf_fstorage_write(&fstorage_instance, new_page_addr, (uint32_t*) last_file_version->_val, FS_HEADER_SIZE_BYTES, NULL);
-                APP_ERROR_CHECK(err_code);
-                fs_wait();
-                last_record = (fs_header_t*) new_page_addr;
-                new_page_addr += FS_HEADER_SIZE_BYTES;
+static void deferred_process() {
+    bool flush = deferred_s.flush_requested;
+    deferred_s.flush_requested = false;
+    counters_process(flush);
 
-                uint32_t *words = (uint32_t*)((uint8_t*)last_file_version + FS_HEADER_SIZE_BYTES);
-                err_code = nrf_fstorage_write(&fstorage_instance, new_page_addr, words, get_rounded_length(last_file_version->length), NULL);
-                APP_ERROR_CHECK(err_code);
-                fs_wait();
+    uint32_t now = app_timer_cnt_get();
+    for (size_t i = 0; i < FS_DEFERRED_SLOTS; i++) {
+        fs_deferred_slot_t *slot = &deferred_s.slots[i];
+        if (!slot->dirty || slot->queued) {
+            continue;
+        }
+        if (!flush && app_timer_cnt_diff_compute(now, slot->updated_ticks) < APP_TIMER_TICKS(FS_DEFERRED_QUIET_MS)) {
+            continue;
+        }
 
-                new_page_addr += get_rounded_length(last_file_version->length);
-            }
+        if (is_stored(slot->part, slot->record_name, slot->data, slot->length)) {
+            slot->dirty = false;
+            slot_free(slot);
+            continue;
+        }
+        if (write_queue_push(slot->part, FS_RECORD_VALUE, slot->record_name, slot->data, slot->length, 0, false,
+                             deferred_write_cb, slot) != NRF_SUCCESS) {
+            // Queue is full, flush is retried on next call
+            deferred_s.flush_requested |= flush;
+            continue;
         }
-        phead = next_header(phead);
+        slot->dirty = false;
+        slot->queued = true;
     }
-    err_code = nrf_fstorage_erase(&fstorage_instance, APP_DATA_ADDR + CODE_PAGE_SIZE * curr_page, 1, NULL);
-    APP_ERROR_CHECK(err_code);
-    fs_wait();
-    curr_page = new_page;
-    return last_record;
+
+    if (deferred_s.shutdown_pending && is_deferred_clean() && write_queue_s.count == 0) {
+        deferred_s.shutdown_pending = false;
+        nrf_pwr_mgmt_shutdown(NRF_PWR_MGMT_SHUTDOWN_CONTINUE);
+    }
+}
+
+static ret_code_t deferred_write(fs_part_t *part, char *record_name, void *src, size_t bytes_count) {
+    if (strlen(record_name) > RECORDNAME_MAX_LENGTH || bytes_count > FS_DEFERRED_MAX_LENGTH) {
+        NRF_LOG_INFO("fs_write_deferred: Record \"%s\" is too big for write-behind cache", record_name);
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    fs_deferred_slot_t *slot = NULL;
+    for (size_t i = 0; i < FS_DEFERRED_SLOTS; i++) {
+        if (deferred_s.slots[i].part == part && strcmp(deferred_s.slots[i].record_name, record_name) == 0) {
+            slot = &deferred_s.slots[i];
+            break;
+        }
+        if (slot == NULL && deferred_s.slots[i].record_name[0] == '\0') {
+            slot = &deferred_s.slots[i];
+        }
+    }
+    if (slot == NULL) {
+        NRF_LOG_WARNING("fs_write_deferred: No free slot for \"%s\"", record_name);
+        return NRF_ERROR_NO_MEM;
+    }
+
+    if (!slot->dirty && !slot->queued && is_stored(part, record_name, src, bytes_count)) {
+        return NRF_SUCCESS;
+    }
+
+    slot->part = part;
+    strcpy(slot->record_name, record_name);
+    memcpy(slot->data, src, bytes_count);
+    slot->length = bytes_count;
+    slot->updated_ticks = app_timer_cnt_get();
+    slot->dirty = true;
+    return NRF_SUCCESS;
 }
 
-static bool is_enough_space(fs_header_t *last_record, size_t bytes_to_write) {
-    uintptr_t new_addr = (uintptr_t)((uint8_t*)last_record + get_rounded_length(last_record->length) + FS_HEADER_SIZE_BYTES * 2 
-        + get_rounded_length(bytes_to_write));
+ret_code_t fs_write_deferred(char *record_name, void *src, size_t bytes_count) {
+    return deferred_write(get_part(record_name), record_name, src, bytes_count);
+}
 
-    uint32_t addr_right_border = curr_page < 2 ? CODE_PAGE_SIZE * (curr_page + 1) + APP_DATA_ADDR : BOOTLOADER_ADDR;
-    
-    return new_addr + bytes_to_write < addr_right_border;
+void fs_flush_request() {
+    deferred_s.flush_requested = true;
 }
 
-static uint8_t get_record_max_id() {
-    if (max_id == 0) {
-        for (fs_header_t *phead = next_header(NULL); phead != NULL; phead = next_header(phead)) {
-            max_id = FS_MAX(max_id, phead->id);
+/*
+    Counters impl
+    Increments are summed in RAM and written by one operation after FS_DEFERRED_QUIET_MS.
+*/
+
+typedef struct {
+    fs_part_t *part;
+    char record_name[RECORDNAME_MAX_LENGTH + 1]; // Empty name for free slot, slot is kept until reset
+    volatile uint32_t pending;  // Increments not queued yet, added from interrupt handlers
+    uint32_t pending_ticks;     // Time of first pending increment
+    uint32_t queued;            // Increment of queued write
+} fs_counter_slot_t;
+
+static fs_counter_slot_t counters_s[FS_COUNTER_SLOTS];
+
+static bool is_counters_clean() {
+    for (size_t i = 0; i < FS_COUNTER_SLOTS; i++) {
+        if (counters_s[i].pending != 0 || counters_s[i].queued != 0) {
+            return false;
         }
     }
-    return max_id;
+    return true;
 }
 
-static fs_header_t new_header(char *name, void *src, size_t bytes_count) {
-    fs_header_t head = {0};
+static void counter_write_cb(ret_code_t result, fs_header_t *phead, void *p_context) {
+    fs_counter_slot_t *slot = p_context;
+    if (result != NRF_SUCCESS) {
+        CRITICAL_REGION_ENTER();
+        slot->pending += slot->queued;
+        CRITICAL_REGION_EXIT();
+    }
+    slot->queued = 0;
+}
 
-    fs_header_t *record_to_rewrite;
-    if ((record_to_rewrite = fs_find_record(name)) == NULL) {
-        if (get_record_max_id() == 0xFF) {
-            NRF_LOG_INFO("fs_write: MAX_ID is 255");
+static void counters_process(bool flush) {
+    uint32_t now = app_timer_cnt_get();
+    for (size_t i = 0; i < FS_COUNTER_SLOTS; i++) {
+        fs_counter_slot_t *slot = &counters_s[i];
+        if (slot->pending == 0 || slot->queued != 0) {
+            continue;
         }
-        else {
-            head.id = get_record_max_id() + 1;
+        if (!flush && app_timer_cnt_diff_compute(now, slot->pending_ticks) < APP_TIMER_TICKS(FS_DEFERRED_QUIET_MS)) {
+            continue;
         }
-    }
-    else {
-        head.id = record_to_rewrite->id;
-    }
-    
-    head.nid = head.id ^ 0xFF;
-    NRF_LOG_INFO("New head %" PRIx8 " %" PRIx8, head.id, head.nid);
-    head.length = bytes_count;
-    head._crc8 = crc8((uint8_t*) src, bytes_count);
-    strcpy(head.record_name, name);
 
-    return head;
+        uint32_t increment;
+        CRITICAL_REGION_ENTER();
+        increment = slot->pending;
+        slot->pending = 0;
+        CRITICAL_REGION_EXIT();
+        if (write_queue_push(slot->part, FS_RECORD_COUNTER, slot->record_name, NULL, sizeof(fs_counter_desc_t), increment,
+                             false, counter_write_cb, slot) != NRF_SUCCESS) {
+            // Queue is full, flush is retried on next call
+            CRITICAL_REGION_ENTER();
+            slot->pending += increment;
+            CRITICAL_REGION_EXIT();
+            deferred_s.flush_requested |= flush;
+            continue;
+        }
+        slot->queued = increment;
+    }
 }
 
-fs_header_t *fs_write(char* record_name, void *src, size_t bytes_count) {
+ret_code_t fs_counter_add(char *record_name, uint32_t increment) {
     if (strlen(record_name) > RECORDNAME_MAX_LENGTH) {
-        NRF_LOG_INFO("fs_write: name \"%s\" length exceeds RECORDNAME_MAX_LENGTH", record_name);
-        return NULL;
+        NRF_LOG_INFO("fs_counter_add: name \"%s\" length exceeds RECORDNAME_MAX_LENGTH", record_name);
+        return NRF_ERROR_INVALID_PARAM;
+    }
+    if (increment == 0) {
+        return NRF_SUCCESS;
+    }
+
+    fs_part_t *part = get_part(record_name);
+    ret_code_t err_code = NRF_ERROR_NO_MEM;
+    CRITICAL_REGION_ENTER();
+    fs_counter_slot_t *slot = NULL;
+    for (size_t i = 0; i < FS_COUNTER_SLOTS; i++) {
+        if (counters_s[i].part == part && strcmp(counters_s[i].record_name, record_name) == 0) {
+            slot = &counters_s[i];
+            break;
+        }
+        if (slot == NULL && counters_s[i].record_name[0] == '\0') {
+            slot = &counters_s[i];
+        }
+    }
+    if (slot != NULL) {
+        if (slot->record_name[0] == '\0') {
+            slot->part = part;
+            strcpy(slot->record_name, record_name);
+        }
+        if (slot->pending == 0) {
+            slot->pending_ticks = app_timer_cnt_get();
+        }
+        slot->pending += increment;
+        err_code = NRF_SUCCESS;
     }
+    CRITICAL_REGION_EXIT();
+    return err_code;
+}
 
-    fs_header_t *last_record = get_last_record();
-    if (last_record != NULL && !is_enough_space(last_record, bytes_count)) {
-        last_record = transition_to_new_page();
-        if (!is_enough_space(last_record, bytes_count)) {
-            NRF_LOG_WARNING("fs_write: Not enough space");
-            return NULL;
+uint32_t fs_counter_get(char *record_name) {
+    fs_part_t *part = get_part(record_name);
+    fs_header_t *phead = find_record(part, record_name);
+    uint32_t value = phead != NULL && phead->type == FS_RECORD_COUNTER ? get_counter_value(phead) : 0;
+    for (size_t i = 0; i < FS_COUNTER_SLOTS; i++) {
+        if (counters_s[i].part == part && strcmp(counters_s[i].record_name, record_name) == 0) {
+            value += counters_s[i].pending + counters_s[i].queued;
         }
     }
+    return value;
+}
 
-    ret_code_t err_code;
-    fs_header_t head = new_header(record_name, src, bytes_count);
-    uint32_t write_addr = last_record != NULL ? (uint32_t)last_record + get_rounded_length(last_record->length) + FS_HEADER_SIZE_BYTES : APP_DATA_ADDR + CODE_PAGE_SIZE * curr_page;
+/*
+    Statistics impl
+*/
 
-    fs_header_t *phead = (fs_header_t*) write_addr;
-    
-    err_code = nrf_fstorage_write(&fstorage_instance, write_addr, head._val, FS_HEADER_SIZE_BYTES, NULL);
-    APP_ERROR_CHECK(err_code);
-    fs_wait();
 
-    write_addr += FS_HEADER_SIZE_BYTES;
+static void get_lifetime_stats(fs_part_t *part, fs_stats_record_t *p_record) {
+    p_record->bytes_written = part->stats.saved.bytes_written + part->stats.bytes_written;
+    p_record->pages_erased = part->stats.saved.pages_erased + part->stats.pages_erased;
+    p_record->compactions = part->stats.saved.compactions + part->stats.compactions;
+}
 
-    if (bytes_count > 0) {
-        uint32_t words[get_rounded_length(bytes_count) / WORD_SIZE];
-        memcpy(&words, src, bytes_count);
-        err_code = nrf_fstorage_write(&fstorage_instance, write_addr, words, get_rounded_length(bytes_count), NULL);
-        APP_ERROR_CHECK(err_code);
-        fs_wait();
+static void stats_save(fs_part_t *part) {
+    /*
+        Goes through write-behind cache, so saved record is rewritten at most once per quiet window.
+        Bytes of record itself are counted by next save. Every instance keeps own record.
+    */
+    fs_stats_record_t record;
+    get_lifetime_stats(part, &record);
+    deferred_write(part, FS_STATS_RECORD_NAME, &record, sizeof(record));
+}
+
+static void stats_load(fs_part_t *part) {
+    fs_header_t *phead = find_record(part, FS_STATS_RECORD_NAME);
+    if (phead == NULL || fs_record_length(phead) != sizeof(fs_stats_record_t) ||
+        fs_read(phead, &part->stats.saved, sizeof(fs_stats_record_t)) != NRF_SUCCESS) {
+        memset(&part->stats.saved, 0, sizeof(part->stats.saved));
     }
-    
-    if (head.id > get_record_max_id()) {
-        max_id = head.id;
+}
+
+void fs_get_stats(fs_part_id_t part_id, fs_stats_t *p_stats) {
+    memset(p_stats, 0, sizeof(fs_stats_t));
+    if (part_id >= FS_PARTS_COUNT) {
+        return;
     }
-    return phead;
+    fs_part_t *part = &parts_s[part_id];
+    fs_stats_record_t lifetime;
+    get_lifetime_stats(part, &lifetime);
+    p_stats->bytes_written = lifetime.bytes_written;
+    p_stats->pages_erased = lifetime.pages_erased;
+    p_stats->compactions = lifetime.compactions;
+    p_stats->wait_total_ms = FS_TICKS_TO(stats_s.wait_total_ticks, 1000);
+    p_stats->wait_max_us = FS_TICKS_TO(stats_s.wait_max_ticks, 1000000);
+    p_stats->lookups = part->stats.lookups;
+    p_stats->headers_scanned = part->stats.headers_scanned;
+    p_stats->urgent_latency_avg_us = part->stats.latency_ops[true] == 0 ? 0 :
+        FS_TICKS_TO(part->stats.latency_total_ticks[true] / part->stats.latency_ops[true], 1000000);
+    p_stats->urgent_latency_max_us = FS_TICKS_TO(part->stats.latency_max_ticks[true], 1000000);
+    p_stats->deferrable_latency_avg_ms = part->stats.latency_ops[false] == 0 ? 0 :
+        FS_TICKS_TO(part->stats.latency_total_ticks[false] / part->stats.latency_ops[false], 1000);
+    p_stats->deferrable_latency_max_ms = FS_TICKS_TO(part->stats.latency_max_ticks[false], 1000);
+    p_stats->active_live_bytes = part->curr_page == -1 ? 0 : get_page_live_bytes(part, part->curr_page);
+    p_stats->active_dead_bytes = part->curr_page == -1 ? 0 : get_page_dead_bytes(part, part->curr_page);
 }
 
+static bool fs_shutdown_handler(nrf_pwr_mgmt_evt_t event) {
+    /*
+        Shutdown is postponed until deferred records are written, see deferred_process().
+    */
+    sched_s.shutdown = true;
+    for (fs_part_t *part = parts_s; part < parts_s + FS_PARTS_COUNT; part++) {
+        if (!part->stats.saved_on_shutdown) {
+            part->stats.saved_on_shutdown = true;
+            stats_save(part);
+        }
+    }
+    if (is_deferred_clean() && write_queue_s.count == 0) {
+        return true;
+    }
+    fs_flush_request();
+    deferred_s.shutdown_pending = true;
+    return false;
+}
+
+NRF_PWR_MGMT_HANDLER_REGISTER(fs_shutdown_handler, 0);
+
 
 ret_code_t fs_delete(fs_header_t* header) {
-    if ((uintptr_t) header < APP_DATA_ADDR || (uintptr_t) header >= BOOTLOADER_ADDR) {
+    if (!is_header_addr(header)) {
         return NRF_ERROR_INVALID_PARAM;
     }
 
-    if (fs_write(header->record_name, NULL, 0) != NULL) {
+    fs_part_t *part = get_header_part(header);
+    fs_index_entry_t *entry = index_find_id(part, header->name_id);
+    if (entry == NULL || entry->phead != header) {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    if (write_sync(part, FS_RECORD_VALUE, entry->name, NULL, 0, 0) != NULL) {
         return NRF_SUCCESS;
     }
     return NRF_ERROR_BASE_NUM;
 }
 
+/*
+    Instance migration impl
+    Policy may be changed by update, records kept in other instance are moved on mount.
+*/
+
+static void migrate_part_records(fs_part_t *part) {
+    /*
+        Record is written to instance of policy before it is deleted here, so after reset
+        in the middle it is found in both of them and simply moved again. Every instance keeps
+        own statistics record. Large objects stay where they are, they are found only there.
+        Counter is written to other instance only if it has none, increment is not added twice then.
+        Entry shifted back by compaction of this instance is moved on next mount.
+    */
+    static uint8_t value[FS_RECORD_MAX_LENGTH];
+
+    for (size_t i = 0; i < FS_INDEX_SIZE; i++) {
+        fs_index_entry_t *entry = &part->index_table[i];
+        fs_header_t *phead = entry->phead;
+        if (!is_entry_used(entry) || phead == NULL || phead->length == 0 || phead->type == FS_RECORD_LARGE ||
+            get_part(entry->name) == part || strcmp(entry->name, FS_STATS_RECORD_NAME) == 0) {
+            continue;
+        }
+
+        char name[RECORDNAME_MAX_LENGTH + 1];
+        strcpy(name, entry->name);
+        if (phead->type == FS_RECORD_COUNTER) {
+            NRF_LOG_INFO("fs: Moving counter \"%s\" from %s instance", name, part->name);
+            if ((find_record(get_part(name), name) == NULL &&
+                 write_sync(get_part(name), FS_RECORD_COUNTER, name, NULL, sizeof(fs_counter_desc_t), get_counter_value(phead)) == NULL) ||
+                write_sync(part, FS_RECORD_VALUE, name, NULL, 0, 0) == NULL) {
+                NRF_LOG_ERROR("fs: Counter \"%s\" is not moved", name);
+            }
+            continue;
+        }
+        size_t length = resolve_value(phead, value, sizeof(value));
+        NRF_LOG_INFO("fs: Moving record \"%s\" from %s instance", name, part->name);
+        if (write_sync(get_part(name), FS_RECORD_VALUE, name, value, length, 0) == NULL ||
+            write_sync(part, FS_RECORD_VALUE, name, NULL, 0, 0) == NULL) {
+            NRF_LOG_ERROR("fs: Record \"%s\" is not moved", name);
+        }
+    }
+}
+
+static void part_format(fs_part_t *part) {
+    part->page_op.page = -1;
+    part->gc.state = FS_GC_IDLE;
+    part->gc.op_in_progress = false;
+    part->gc.ready = false;
+    memset(part->index_table, 0, sizeof(part->index_table));
+    generation++;
+
+    for (int8_t page = part->first_page; page < part->end_page; page++) {
+        page_format(part, page, pages_s[page].erase_count);
+    }
+    part->max_seq = 0;
+    part->curr_page = -1;
+    page_open_sync(part, least_worn_free_page(part));
+    // Lifetime counters are kept, they are written again on empty fs
+    stats_save(part);
+}
+
 ret_code_t fs_format() {
-    ret_code_t err_code = nrf_fstorage_erase(&fstorage_instance, APP_DATA_ADDR, 3, NULL);
     fs_wait();
-    curr_page = 0;
-    return err_code;
+    if (write_queue_s.phead != NULL) {
+        // Record written by operation in progress is erased
+        write_queue_s.phead = NULL;
+        write_complete(NRF_ERROR_INVALID_STATE, NULL);
+    }
+    large_writer = NULL;
+
+    for (fs_part_t *part = parts_s; part < parts_s + FS_PARTS_COUNT; part++) {
+        part_format(part);
+    }
+    return NRF_SUCCESS;
 }
 
 ret_code_t fs_init() {
-    nrf_fstorage_init(&fstorage_instance, &nrf_fstorage_sd, NULL);
+    /*
+        Every instance is mounted before migrations, they write records to instance of policy.
+    */
+    fs_flash_init();
     fs_wait();
-    init_page();
+    large_writer = NULL;
+    memset(&write_queue_s, 0, sizeof(write_queue_s));
+
+    for (fs_part_t *part = parts_s; part < parts_s + FS_PARTS_COUNT; part++) {
+        init_page(part);
+    }
+    for (fs_part_t *part = parts_s; part < parts_s + FS_PARTS_COUNT; part++) {
+        migrate_v1_pages(part);
+        migrate_part_records(part);
+    }
+    for (fs_part_t *part = parts_s; part < parts_s + FS_PARTS_COUNT; part++) {
+        stats_load(part);
+        gc_start_background(part);
+    }
     return NRF_SUCCESS;
 }
@@ -2,41 +2,319 @@
 #define _FS
 
 
-#include "nrf_dfu_types.h"
+#include "fs_partition.h"
 
 
 #include <stdbool.h>
+#include <stddef.h>
 #include <stdint.h>
 
 
-#define BOOTLOADER_ADDR 0xE0000
-#define APP_DATA_ADDR (BOOTLOADER_ADDR - NRF_DFU_APP_DATA_AREA_SIZE)
+#define APP_DATA_ADDR FS_PARTITION_START
 #define WORD_SIZE 4
 
 #define RECORDNAME_MAX_LENGTH 24
-#define FS_HEADER_SIZE_BYTES 36
+#define FS_HEADER_SIZE_BYTES 12
+/* Values up to this size are stored in record header */
+#define FS_INLINE_VALUE_SIZE 4
 
+/*
+    Partition is split between two instances with own pages, index, compaction and statistics.
+    Cold instance takes upper FS_COLD_PAGES pages, hot instance takes the rest.
+    Often changed records are kept in hot instance, so compaction of it doesn`t copy cold records.
+*/
+#define FS_COLD_PAGES 3
+#define FS_HOT_PAGES (FS_PARTITION_PAGES - FS_COLD_PAGES)
+
+/* Size of RAM index of every instance (name -> newest header). Must be a power of two. */
+#define FS_INDEX_SIZE 64
+
+/* Compaction is started in background when free space drops below this value */
+#define FS_COMPACTION_THRESHOLD_BYTES (CODE_PAGE_SIZE / 4)
+/* Free pages which can be opened only by compaction, so it always has space for live records */
+#define FS_RESERVED_PAGES 1
+
+/* Max number of queued writes: fs_write_async() and friends, synchronous calls, write-behind flushes and counters */
+#define FS_WRITE_QUEUE_SIZE 8
+/* Max record payload. Header and payload are staged in RAM and written by one operation */
+#define FS_RECORD_MAX_LENGTH 512
+/*
+    Value and extent payload of at least this size in word aligned RAM is written from source,
+    only header and padded last word are staged
+*/
+#define FS_DIRECT_WRITE_MIN_LENGTH 64
+/* fs_write_packed() tries to pack values of at least this size */
+#define FS_PACK_MIN_LENGTH 16
+/*
+    Worst case stack use of fs calls, record buffers are static. Checked by make -C tests stack:
+    -fstack-usage frames are summed along the deepest chain of -fcallgraph-info call graph.
+    Measured 1048 bytes on x86-64 host at -O3, chain fs_init() -> write_sync() -> fs_process() ->
+    gc_start_background() -> gc_select_victim() -> get_page_live_bytes() -> get_copy_size() ->
+    resolve_value() -> rle_unpack(). Cortex-M4 frames are smaller, registers and pointers take 4 bytes.
+    Library calls and nrf_log are not counted.
+*/
+#define FS_STACK_MAX_BYTES 1152
+
+/* Write-behind cache: records not written yet, including fs_stats of each instance, and max payload of each one */
+#define FS_DEFERRED_SLOTS 4
+#define FS_DEFERRED_MAX_LENGTH 16
+/* Deferred record is written when it was not updated for this time */
+#define FS_DEFERRED_QUIET_MS 2000
+
+/*
+    Flash counters: words of bits cleared by increments in every counter record,
+    and counters which increments are kept in RAM until they are written
+*/
+#define FS_COUNTER_WORDS 16
+#define FS_COUNTER_SLOTS 4
+
+/* Opened page starts with checkpoint of index, mount walks only active page when it is present */
+#define FS_CHECKPOINT_ENABLED 1
+
+/*
+    Large object API. Stored large objects are kept by mount and compaction
+    even if it is disabled, so flag doesn`t change flash format.
+*/
+#ifndef FS_LARGE_ENABLED
+#define FS_LARGE_ENABLED 1
+#endif
+/* Large object is written by chunks, every chunk is split to extents not bigger than FS_LARGE_EXTENT_SIZE */
+#define FS_LARGE_EXTENT_SIZE 512
+#define FS_LARGE_MAX_EXTENTS 64
+
+/* Patches chained to one value record. Longer chain is folded to new value record */
+#define FS_PATCH_MAX_CHAIN 32
+
+/* Batch holds up to FS_BATCH_MAX_RECORDS records, FS_BATCH_MAX_LENGTH bytes with their headers and names */
+#define FS_BATCH_MAX_RECORDS 8
+#define FS_BATCH_MAX_LENGTH 512
+
+/*
+    Deferrable flash operations (background compaction, write-behind flushes) are started after
+    FS_SCHED_QUIET_MS without BLE or USB traffic, but not later than FS_SCHED_MAX_DEFER_MS
+*/
+#define FS_SCHED_QUIET_MS 500
+#define FS_SCHED_MAX_DEFER_MS 10000
+
+/* Lifetime counters of fs_stats_t are saved to this record by write-behind cache after compaction and on shutdown */
+#define FS_STATS_RECORD_NAME "fs_stats"
+
+
+/*
+    Record types. Name record maps name_id to record name, it is written once per page
+    before first value record with that name_id. Large record takes place of value record,
+    it holds offsets of extent records with object data. Patch record holds changed byte range
+    of value and offset of previous version. Batch record holds name and value records written
+    together, its crc commits all of them. Counter record holds base value and words of bits,
+    increment clears bits in place, compaction folds them to base. Checkpoint, extent and batch records have name_id 0.
+    name_id is 8 bit, it numbers names held by index, not every name ever written: id of deleted
+    or dropped name is taken again, so instance holds any number of names over time, up to FS_INDEX_SIZE at once.
+*/
+#define FS_RECORD_VALUE 0x5A
+#define FS_RECORD_NAME 0xA5
+#define FS_RECORD_CHECKPOINT 0xC3
+#define FS_RECORD_LARGE 0x69
+#define FS_RECORD_EXTENT 0x96
+#define FS_RECORD_PATCH 0x3C
+#define FS_RECORD_BATCH 0xB4
+#define FS_RECORD_COUNTER 0x87
 
 typedef union {
     uint8_t _val[FS_HEADER_SIZE_BYTES];
 
     struct {
-        uint8_t id;
-        uint8_t nid; // inverted id
-        char record_name[RECORDNAME_MAX_LENGTH + 1]; // 1 byte for \0
-        size_t length;
-        uint8_t _crc8;
+        uint8_t type;
+        uint8_t name_id;
+        uint16_t length;
+        uint32_t crc;   // CRC-32 of header fields and data
+        uint8_t value[FS_INLINE_VALUE_SIZE]; // Data of record not longer than FS_INLINE_VALUE_SIZE
     };
 } fs_header_t;
 
 
+typedef enum {
+    FS_PART_HOT,
+    FS_PART_COLD,
+    FS_PARTS_COUNT
+} fs_part_id_t;
+
+/* Selects instance of record, it must return the same instance for the same name */
+typedef fs_part_id_t (*fs_part_policy_t)(const char *record_name);
+
+/*
+    Called from fs_process() when queued write is finished, once per queued write.
+    phead points to written record, it is NULL if result is not NRF_SUCCESS.
+*/
+typedef void (*fs_write_cb_t)(ret_code_t result, fs_header_t *phead, void *p_context);
+
+/*
+    Read-only view of record payload in memory-mapped flash. View is valid while mapped version
+    is the newest one: newer version, delete and copy by compaction make it invalid, erase changes
+    generation. View must be checked by fs_map_is_valid() after fs_process() was called.
+*/
+typedef struct {
+    const void *data;
+    size_t length;
+    const fs_header_t *header;  // Mapped version
+    uint32_t generation;
+} fs_map_t;
+
+/*
+    Value records committed at once. Data is copied to batch by fs_batch_stage(), after reset
+    either every record of committed batch is visible or none of them.
+*/
+typedef struct {
+    uint8_t count;
+    fs_part_id_t part;      // Instance of first staged record
+    uint16_t size;          // Size of batch record payload if every record needs name record
+    uint16_t data_length;
+    struct {
+        char record_name[RECORDNAME_MAX_LENGTH + 1];
+        uint16_t offset;    // Offset of value in data
+        uint16_t length;
+    } records[FS_BATCH_MAX_RECORDS];
+    uint8_t data[FS_BATCH_MAX_LENGTH];
+} fs_batch_t;
+
+/*
+    Storage statistics of instance. Lifetime counters are restored on mount, others are counted from boot.
+    Live and dead bytes are computed for active page when fs_get_stats() is called.
+    Waits for flash are shared by instances.
+*/
+typedef struct {
+    uint32_t bytes_written;     // Lifetime
+    uint32_t pages_erased;      // Lifetime
+    uint32_t compactions;       // Lifetime
+    uint32_t wait_total_ms;     // Time spent waiting for flash by synchronous calls
+    uint32_t wait_max_us;
+    uint32_t lookups;
+    uint32_t headers_scanned;   // Index entries checked by lookups, more than one per lookup on hash collisions
+    uint32_t active_live_bytes;
+    uint32_t active_dead_bytes;
+    uint32_t urgent_latency_avg_us;     // Time from request of flash operation to its start
+    uint32_t urgent_latency_max_us;
+    uint32_t deferrable_latency_avg_ms;
+    uint32_t deferrable_latency_max_ms;
+} fs_stats_t;
+
+/*
+    Large object streaming state. Only one object can be written at time,
+    it becomes visible for readers when fs_large_commit() is done.
+*/
+typedef struct {
+    char record_name[RECORDNAME_MAX_LENGTH + 1];
+    fs_part_id_t part;
+    uint32_t length;
+    uint32_t crc;
+    uint16_t extents_count;
+    uint16_t extents[FS_LARGE_MAX_EXTENTS]; // Moved by compaction while writer is open
+} fs_large_writer_t;
+
+#if FS_LARGE_ENABLED
+typedef struct {
+    char record_name[RECORDNAME_MAX_LENGTH + 1];
+    fs_map_t desc;          // Large record payload, it is mapped again after compaction
+    uint32_t length;
+    uint32_t crc;           // Tells moved object from replaced one
+    uint32_t position;
+} fs_large_reader_t;
+#endif
+
+
+/*
+    Functions taking record name use instance selected by policy, default policy keeps every record
+    in hot instance. Policy must be set before fs_init(), records kept in other instance are moved on mount.
+*/
+void fs_set_part_policy(fs_part_policy_t policy);
 fs_header_t *fs_find_record(char *record_name);
 ret_code_t fs_read(fs_header_t *header, void* dest, size_t bytes_count);
+/* Value length, header->length is length of last patch for patched record */
+size_t fs_record_length(fs_header_t *header);
+/*
+    Returns NRF_ERROR_NOT_FOUND if record doesn`t exist or is deleted,
+    NRF_ERROR_INVALID_STATE if it is patched, packed or counter and can be read only by fs_read()
+*/
+ret_code_t fs_map(char *record_name, fs_map_t *p_map);
+bool fs_map_is_valid(const fs_map_t *p_map);
+#if FS_LARGE_ENABLED
+/*
+    Large objects. fs_find_record() returns their large record, fs_delete() removes them,
+    fs_read() and fs_map() don`t accept them. Functions wait for flash like fs_write().
+*/
+ret_code_t fs_large_open_write(fs_large_writer_t *p_writer, char *record_name);
+ret_code_t fs_large_append(fs_large_writer_t *p_writer, const void *src, size_t bytes_count);
+ret_code_t fs_large_commit(fs_large_writer_t *p_writer);
+void fs_large_abort(fs_large_writer_t *p_writer);
+ret_code_t fs_large_open_read(fs_large_reader_t *p_reader, char *record_name);
+/* Reads next chunk, p_bytes_read is 0 at the end of object */
+ret_code_t fs_large_read(fs_large_reader_t *p_reader, void *dest, size_t bytes_count, size_t *p_bytes_read);
+#endif
 fs_header_t *fs_write(char *record_name, void *src, size_t bytes_count);
+/*
+    Writes value packed by run-length codec if it takes less flash, fs_read() and fs_record_length()
+    unpack it transparently, fs_map() returns NRF_ERROR_INVALID_STATE for packed record.
+*/
+fs_header_t *fs_write_packed(char *record_name, void *src, size_t bytes_count);
+/*
+    Keeps record in RAM and writes it after FS_DEFERRED_QUIET_MS without updates.
+    Value equal to stored one is not written. fs_find_record() returns stored version until then.
+    Pending records are written by shutdown handler, so reset must go through nrf_pwr_mgmt_shutdown(),
+    like reset command of CLI. Power loss, NVIC_SystemReset() and app_error handler lose them.
+*/
+ret_code_t fs_write_deferred(char *record_name, void *src, size_t bytes_count);
+/*
+    Writes only bytes_count bytes at offset of existing record. Offset must not exceed record length,
+    record grows if range ends beyond it. Returns NULL if record doesn`t exist.
+*/
+fs_header_t *fs_patch(char *record_name, size_t offset, const void *src, size_t bytes_count);
+/* Patch at the end of record, its length is taken when queued write starts */
+fs_header_t *fs_append(char *record_name, const void *src, size_t bytes_count);
+/*
+    Queue write and return immediately, so main loop keeps serving BLE and USB while flash is busy.
+    Write is done by fs_process(), src must stay unchanged until cb is called (cb may be NULL).
+    Returns NRF_ERROR_NO_MEM if queue of FS_WRITE_QUEUE_SIZE writes is full. Synchronous
+    functions above queue the same operations and wait for them.
+*/
+ret_code_t fs_write_async(char *record_name, void *src, size_t bytes_count, fs_write_cb_t cb, void *p_context);
+ret_code_t fs_write_packed_async(char *record_name, void *src, size_t bytes_count, fs_write_cb_t cb, void *p_context);
+/* Missing record or invalid offset are reported to cb by NRF_ERROR_NOT_FOUND and NRF_ERROR_INVALID_PARAM */
+ret_code_t fs_patch_async(char *record_name, size_t offset, const void *src, size_t bytes_count, fs_write_cb_t cb, void *p_context);
+/*
+    Flash counter. Increment clears bits of erased words stored after counter base, so it takes no
+    new record. Word can be written twice between erases, so record takes up to 2 * FS_COUNTER_WORDS
+    writes before it is folded to new one. Increments are summed in RAM and written like deferred
+    records, fs_counter_add() can be called from interrupt handlers. fs_read() of counter record
+    gives its stored value as uint32_t.
+*/
+ret_code_t fs_counter_add(char *record_name, uint32_t increment);
+/* Stored value with increments not written yet */
+uint32_t fs_counter_get(char *record_name);
+/* Writes every deferred record and counter without waiting for quiet window. Can be called from event handlers */
+void fs_flush_request();
+/*
+    Batch of value records, zero length record deletes it. Record can be staged once per batch.
+    Commit writes batch by one flash operation and waits for it like fs_write().
+    Every record of batch must belong to the same instance.
+*/
+void fs_batch_begin(fs_batch_t *p_batch);
+ret_code_t fs_batch_stage(fs_batch_t *p_batch, char *record_name, const void *src, size_t bytes_count);
+ret_code_t fs_batch_commit(fs_batch_t *p_batch);
+/* Queues commit like fs_write_async(), batch must stay unchanged until cb is called */
+ret_code_t fs_batch_commit_async(fs_batch_t *p_batch, fs_write_cb_t cb, void *p_context);
 ret_code_t fs_delete(fs_header_t *header);
+/*
+    Called on BLE or USB traffic, it can be called from interrupt handlers. Deferrable operations
+    wait for quiet window, so flash doesn`t stall CPU while radio or USB is busy.
+*/
+void fs_sched_traffic();
+/* Deferrable flash operation of other module, ready since ready_ticks, follows the same quiet window */
+bool fs_sched_allowed(uint32_t ready_ticks);
+void fs_get_stats(fs_part_id_t part, fs_stats_t *p_stats);
+/* Formats every instance */
 ret_code_t fs_format();
 
 ret_code_t fs_init();
+void fs_process();
 
 
 #endif
\ No newline at end of file
@@ -0,0 +1,239 @@
+#include "fs_flash.h"
+#include "fs.h"
+
+#include "nrf_log.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+#include "sdk_config.h"
+#include <inttypes.h>
+
+static void fs_flash_evt_handler(nrf_fstorage_evt_t *p_evt);
+
+NRF_FSTORAGE_DEF(nrf_fstorage_t fstorage_instance) = {
+    .evt_handler = fs_flash_evt_handler,
+    .start_addr = FS_FLASH_START,
+    .end_addr = FS_FLASH_END
+};
+
+/*
+    Operations of fs and log in order. fstorage queue of NRF_FSTORAGE_SD_QUEUE_SIZE slots is shared
+    with fds, so operation is pending until fstorage accepts it. Started operations are the first
+    ones, fstorage executes them in order, so first one is completed by next event.
+*/
+
+typedef struct {
+    uintptr_t addr;
+    const void *src;        // NULL for erase
+    size_t length;
+    fs_flash_cb_t cb;
+    void *p_param;
+} fs_flash_op_t;
+
+static struct {
+    fs_flash_op_t ops[FS_FLASH_QUEUE_SIZE];
+    uint8_t head;
+    volatile uint8_t count;
+    volatile uint8_t started;
+} flash_s;
+
+static fs_flash_op_t *get_op(uint8_t i) {
+    /*
+        Event handler moves head and decrements started and count together, so position of
+        first pending operation and end of queue don`t change. Callers read them in critical region.
+    */
+    return &flash_s.ops[(flash_s.head + i) % FS_FLASH_QUEUE_SIZE];
+}
+
+static void op_drop_first_pending() {
+    // Pending operations after it move up, they keep order
+    uint8_t first, moved;
+    CRITICAL_REGION_ENTER();
+    first = (flash_s.head + flash_s.started) % FS_FLASH_QUEUE_SIZE;
+    moved = flash_s.count - flash_s.started - 1;
+    CRITICAL_REGION_EXIT();
+    for (uint8_t i = 0; i < moved; i++) {
+        flash_s.ops[(first + i) % FS_FLASH_QUEUE_SIZE] = flash_s.ops[(first + i + 1) % FS_FLASH_QUEUE_SIZE];
+    }
+    CRITICAL_REGION_ENTER();
+    flash_s.count--;
+    CRITICAL_REGION_EXIT();
+}
+
+static ret_code_t op_start_pending() {
+    /*
+        Starts pending operations in order until fstorage queue is full.
+        Started counter goes first, event of operation can come before fstorage call returns.
+        Returns result of first operation which was not started.
+    */
+    for (;;) {
+        fs_flash_op_t *op = NULL;
+        CRITICAL_REGION_ENTER();
+        if (flash_s.started < flash_s.count) {
+            op = get_op(flash_s.started);
+            flash_s.started++;
+        }
+        CRITICAL_REGION_EXIT();
+        if (op == NULL) {
+            return NRF_SUCCESS;
+        }
+
+        ret_code_t err_code = op->src == NULL ?
+            nrf_fstorage_erase(&fstorage_instance, op->addr, 1, op->p_param) :
+            nrf_fstorage_write(&fstorage_instance, op->addr, op->src, op->length, op->p_param);
+        if (err_code != NRF_SUCCESS) {
+            CRITICAL_REGION_ENTER();
+            flash_s.started--;
+            CRITICAL_REGION_EXIT();
+            return err_code;
+        }
+    }
+}
+
+static ret_code_t op_push(uintptr_t addr, const void *src, size_t length, fs_flash_cb_t cb, void *p_param) {
+    /*
+        Operation is started at once if nothing is pending before it, its start error is returned then.
+        Operation waiting for free slot of fstorage queue is started by fs_flash_process().
+    */
+    fs_flash_op_t *op = NULL;
+    bool has_pending;
+    CRITICAL_REGION_ENTER();
+    if (flash_s.count < FS_FLASH_QUEUE_SIZE) {
+        op = get_op(flash_s.count);
+    }
+    has_pending = flash_s.started < flash_s.count;
+    CRITICAL_REGION_EXIT();
+    if (op == NULL) {
+        return NRF_ERROR_NO_MEM;
+    }
+
+    *op = (fs_flash_op_t) {.addr = addr, .src = src, .length = length, .cb = cb, .p_param = p_param};
+    CRITICAL_REGION_ENTER();
+    flash_s.count++;
+    CRITICAL_REGION_EXIT();
+    if (has_pending) {
+        return NRF_SUCCESS;
+    }
+
+    ret_code_t err_code = op_start_pending();
+    if (err_code == NRF_ERROR_NO_MEM) {
+        NRF_LOG_DEBUG("fs_flash: fstorage queue is full, operation at 0x%" PRIXPTR " is pending", addr);
+        return NRF_SUCCESS;
+    }
+    if (err_code != NRF_SUCCESS) {
+        op_drop_first_pending();
+    }
+    return err_code;
+}
+
+static void fs_flash_evt_handler(nrf_fstorage_evt_t *p_evt) {
+    fs_flash_cb_t cb = NULL;
+    if (flash_s.started > 0) {
+        cb = get_op(0)->cb;
+        flash_s.head = (flash_s.head + 1) % FS_FLASH_QUEUE_SIZE;
+        flash_s.started--;
+        flash_s.count--;
+    }
+
+    if (cb != NULL) {
+        cb(p_evt->result, p_evt->p_param);
+    }
+}
+
+/*
+    NOR rules impl
+*/
+
+static bool is_erase_pending(uintptr_t addr) {
+    // Erase is queued, but not done yet, so page still holds old data
+    for (uint8_t i = 0; i < flash_s.count; i++) {
+        fs_flash_op_t *op = get_op(i);
+        if (op->src == NULL && addr >= op->addr && addr < op->addr + CODE_PAGE_SIZE) {
+            return true;
+        }
+    }
+    return false;
+}
+
+static bool is_write_allowed(uintptr_t addr, const void *src, size_t length) {
+    if (addr % WORD_SIZE != 0 || (uintptr_t) src % WORD_SIZE != 0 || length % WORD_SIZE != 0 || length == 0) {
+        NRF_LOG_ERROR("fs_flash: Unaligned write of %" PRIu32 " bytes to 0x%" PRIXPTR, (uint32_t) length, addr);
+        return false;
+    }
+    if (addr < FS_FLASH_START || addr + length > FS_FLASH_END) {
+        NRF_LOG_ERROR("fs_flash: Write to 0x%" PRIXPTR " is out of fs and log partitions", addr);
+        return false;
+    }
+    if (is_erase_pending(addr)) {
+        return true;
+    }
+
+    const uint32_t *src_words = src;
+    for (size_t i = 0; i < length / WORD_SIZE; i++) {
+        uint32_t flash_word = ((const uint32_t*) addr)[i];
+        if ((flash_word & src_words[i]) != src_words[i]) {
+            NRF_LOG_ERROR("fs_flash: Write sets cleared bits at 0x%" PRIXPTR, addr + i * WORD_SIZE);
+            return false;
+        }
+    }
+    return true;
+}
+
+/*
+    Backend functions impl
+*/
+
+ret_code_t fs_flash_init() {
+    /*
+        Called by fs and log. Nothing of them is started or pending while fstorage is idle,
+        so queue is reset only then and second call keeps operations of the first user.
+    */
+    if (!nrf_fstorage_is_busy(&fstorage_instance)) {
+        flash_s.head = 0;
+        flash_s.count = 0;
+        flash_s.started = 0;
+    }
+    return nrf_fstorage_init(&fstorage_instance, &nrf_fstorage_sd, NULL);
+}
+
+ret_code_t fs_flash_write(uintptr_t addr, const void *src, size_t length, fs_flash_cb_t cb, void *p_param) {
+#if FS_FLASH_NOR_CHECKS
+    if (!is_write_allowed(addr, src, length)) {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+#endif
+    return op_push(addr, src, length, cb, p_param);
+}
+
+ret_code_t fs_flash_erase(uintptr_t page_addr, fs_flash_cb_t cb, void *p_param) {
+#if FS_FLASH_NOR_CHECKS
+    if (page_addr % CODE_PAGE_SIZE != 0 || page_addr < FS_FLASH_START || page_addr >= FS_FLASH_END) {
+        NRF_LOG_ERROR("fs_flash: Invalid page 0x%" PRIXPTR " to erase", page_addr);
+        return NRF_ERROR_INVALID_ADDR;
+    }
+#endif
+    return op_push(page_addr, NULL, 0, cb, p_param);
+}
+
+void fs_flash_process() {
+    ret_code_t err_code = op_start_pending();
+    if (err_code != NRF_SUCCESS && err_code != NRF_ERROR_NO_MEM) {
+        // Operation was checked when it was queued, so it is not expected
+        fs_flash_op_t *op;
+        CRITICAL_REGION_ENTER();
+        op = get_op(flash_s.started);
+        CRITICAL_REGION_EXIT();
+        fs_flash_cb_t cb = op->cb;
+        void *p_param = op->p_param;
+        NRF_LOG_ERROR("fs_flash: Pending operation at 0x%" PRIXPTR " failed, error %" PRIu32, op->addr, err_code);
+        op_drop_first_pending();
+        if (cb != NULL) {
+            cb(err_code, p_param);
+        }
+    }
+}
+
+bool fs_flash_is_busy() {
+    return flash_s.count > 0;
+}
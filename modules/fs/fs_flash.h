@@ -0,0 +1,51 @@
+#ifndef _FS_FLASH
+#define _FS_FLASH
+
+
+#include "fs_partition.h"
+#include "sdk_errors.h"
+#include "sdk_config.h"
+
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+
+/*
+    Flash backend of fs and log. fs.c and fs_log.c reach flash only through these functions and
+    read records by pointers into FS_FLASH_START..FS_FLASH_END region. Host build in tests/ links fs.c and fs_flash.c
+    with nrf_fstorage emulated over RAM mapped at partition addresses, see tests/flash_emu.h.
+*/
+
+/* Every operation is checked against NOR rules: word alignment, bits only go from 1 to 0 */
+#define FS_FLASH_NOR_CHECKS 1
+/* Log and fs partitions are next to each other, one fstorage instance covers them */
+#define FS_FLASH_START FS_LOG_START
+#define FS_FLASH_END FS_PARTITION_END
+/*
+    Operations of fs and log, started or waiting for free slot of fstorage queue. fs and log have
+    no more operations in flight than fstorage queue takes, NRF_ERROR_NO_MEM is returned only if
+    they exceed this size.
+*/
+#define FS_FLASH_QUEUE_SIZE NRF_FSTORAGE_SD_QUEUE_SIZE
+
+/* Called from flash event handler, p_param is the one passed to operation */
+typedef void (*fs_flash_cb_t)(ret_code_t result, void *p_param);
+
+
+/* Called by fs and log, fstorage is initialized once */
+ret_code_t fs_flash_init();
+/*
+    Operation is queued when fstorage queue, shared with fds, is full. It is started later
+    by fs_flash_process(), its error is passed to cb then. addr, src and length must be word aligned.
+*/
+ret_code_t fs_flash_write(uintptr_t addr, const void *src, size_t length, fs_flash_cb_t cb, void *p_param);
+ret_code_t fs_flash_erase(uintptr_t page_addr, fs_flash_cb_t cb, void *p_param);
+/* Starts pending operations, called from main loop and from waits for flash */
+void fs_flash_process();
+/* Operations of fs or log are queued or in progress */
+bool fs_flash_is_busy();
+
+
+#endif
@@ -0,0 +1,358 @@
+#include "fs_log.h"
+#include "fs_flash.h"
+#include "fs.h"
+
+#include "nrf_log.h"
+#include "app_timer.h"
+#include "crc16.h"
+#include "app_util.h"
+#include "app_util_platform.h"
+#include <string.h>
+#include <inttypes.h>
+
+#define FS_LOG_MAGIC 0x314C5346 // "FSL1"
+#define FS_LOG_SEQ_FREE 0xFFFFFFFF
+#define FS_LOG_TYPE_FREE 0xFF
+#define FS_LOG_PAGE_HEADER_SIZE 16
+#define FS_LOG_SLOTS ((CODE_PAGE_SIZE - FS_LOG_PAGE_HEADER_SIZE) / FS_LOG_ENTRY_SIZE)
+#define FS_LOG_PAGE_ADDR(page) ((uintptr_t) FS_LOG_START + CODE_PAGE_SIZE * (page))
+
+typedef struct {
+    uint32_t magic;
+    uint32_t seq;       // Grows by one with every opened page
+    uint32_t reserved[2];
+} fs_log_page_header_t;
+
+STATIC_ASSERT(sizeof(fs_log_entry_t) == FS_LOG_ENTRY_SIZE);
+STATIC_ASSERT(sizeof(fs_log_page_header_t) == FS_LOG_PAGE_HEADER_SIZE);
+STATIC_ASSERT(FS_LOG_ENTRY_SIZE % sizeof(uint32_t) == 0);
+STATIC_ASSERT(FS_LOG_DATA_SIZE <= UINT8_MAX);
+STATIC_ASSERT(FS_LOG_PAGES >= 2 && FS_LOG_PAGES <= INT8_MAX);
+
+typedef enum {
+    LOG_OP_NONE,
+    LOG_OP_ERASE,
+    LOG_OP_HEADER,
+    LOG_OP_ENTRY
+} fs_log_op_t;
+
+static struct {
+    uint32_t seqs[FS_LOG_PAGES];     // FS_LOG_SEQ_FREE for erased or reused page
+    uint32_t max_seq;
+    int8_t head_page;               // Page entries are appended to, -1 if log is empty
+    uint16_t head_slot;             // Next free slot of head page
+    int8_t open_page;               // Page being erased and opened, -1 if none
+    uint32_t open_ticks;            // Time open_page was selected, its erase waits for quiet window of fs
+    /*
+        Appended entries, the first one stays in queue until it is written, so it is
+        the source of write operation. Kept as words, fs_flash writes only aligned data.
+    */
+    uint32_t queue[FS_LOG_QUEUE_SIZE][FS_LOG_ENTRY_SIZE / sizeof(uint32_t)];
+    uint8_t queue_head;
+    volatile uint8_t queue_count;
+    fs_log_page_header_t page_header;
+    fs_log_op_t op;
+    volatile bool op_done;
+    volatile ret_code_t op_result;
+} log_s;
+
+static void fs_log_evt_handler(ret_code_t result, void *p_param) {
+    // Operation is finished by fs_log_process()
+    log_s.op_result = result;
+    log_s.op_done = true;
+}
+
+/*
+    Entries impl
+*/
+
+static const fs_log_entry_t *entry_ptr(int8_t page, int16_t slot) {
+    return (const fs_log_entry_t*) (FS_LOG_PAGE_ADDR(page) + FS_LOG_PAGE_HEADER_SIZE + FS_LOG_ENTRY_SIZE * slot);
+}
+
+static uint16_t entry_crc(const fs_log_entry_t *p_entry) {
+    uint16_t crc = crc16_compute(&p_entry->type, offsetof(fs_log_entry_t, crc), NULL);
+    return crc16_compute(p_entry->data, FS_LOG_DATA_SIZE, &crc);
+}
+
+static bool is_entry_valid(const fs_log_entry_t *p_entry) {
+    // Free and torn entries are skipped
+    return p_entry->type != FS_LOG_TYPE_FREE && p_entry->length <= FS_LOG_DATA_SIZE && p_entry->crc == entry_crc(p_entry);
+}
+
+static bool is_erased(const void *addr, size_t length) {
+    const uint32_t *words = addr;
+    for (size_t i = 0; i < length / sizeof(uint32_t); i++) {
+        if (words[i] != 0xFFFFFFFF) {
+            return false;
+        }
+    }
+    return true;
+}
+
+ret_code_t fs_log_append(uint8_t type, const void *data, uint8_t length) {
+    if (type == FS_LOG_TYPE_FREE || length > FS_LOG_DATA_SIZE) {
+        return NRF_ERROR_INVALID_PARAM;
+    }
+
+    fs_log_entry_t entry = {
+        .type = type,
+        .length = length
+    };
+    if (length > 0) {
+        memcpy(entry.data, data, length);
+    }
+    entry.crc = entry_crc(&entry);
+
+    ret_code_t err_code = NRF_ERROR_NO_MEM;
+    CRITICAL_REGION_ENTER();
+    if (log_s.queue_count < FS_LOG_QUEUE_SIZE) {
+        memcpy(log_s.queue[(log_s.queue_head + log_s.queue_count) % FS_LOG_QUEUE_SIZE], &entry, sizeof(entry));
+        log_s.queue_count++;
+        err_code = NRF_SUCCESS;
+    }
+    CRITICAL_REGION_EXIT();
+    return err_code;
+}
+
+/*
+    Iterator impl
+*/
+
+static int8_t oldest_page() {
+    int8_t oldest = -1;
+    for (int8_t i = 0; i < FS_LOG_PAGES; i++) {
+        if (log_s.seqs[i] != FS_LOG_SEQ_FREE && (oldest < 0 || log_s.seqs[i] < log_s.seqs[oldest])) {
+            oldest = i;
+        }
+    }
+    return oldest;
+}
+
+static bool iter_start(fs_log_iter_t *p_iter) {
+    int8_t page = p_iter->backward ? log_s.head_page : oldest_page();
+    if (page < 0) {
+        return false;
+    }
+    p_iter->page = page;
+    p_iter->seq = log_s.seqs[page];
+    p_iter->slot = p_iter->backward ? log_s.head_slot : -1;
+    return true;
+}
+
+static bool iter_step(fs_log_iter_t *p_iter) {
+    if (p_iter->page < 0 || log_s.seqs[p_iter->page] != p_iter->seq) {
+        /*
+            Page was reused while iterating. Its entries were older than the rest of log,
+            so forward iteration goes on from the oldest page, backward one is over.
+        */
+        if ((p_iter->page >= 0 && p_iter->backward) || !iter_start(p_iter)) {
+            return false;
+        }
+    }
+
+    for (;;) {
+        if (p_iter->backward) {
+            if (p_iter->slot > 0) {
+                p_iter->slot--;
+                return true;
+            }
+            int8_t prev = (p_iter->page + FS_LOG_PAGES - 1) % FS_LOG_PAGES;
+            if (p_iter->seq == 0 || log_s.seqs[prev] != p_iter->seq - 1) {
+                return false;
+            }
+            p_iter->page = prev;
+            p_iter->seq--;
+            p_iter->slot = FS_LOG_SLOTS;
+        }
+        else {
+            int16_t end_slot = (p_iter->page == log_s.head_page) ? log_s.head_slot : FS_LOG_SLOTS;
+            if (p_iter->slot + 1 < end_slot) {
+                p_iter->slot++;
+                return true;
+            }
+            int8_t next = (p_iter->page + 1) % FS_LOG_PAGES;
+            if (p_iter->page == log_s.head_page || log_s.seqs[next] != p_iter->seq + 1) {
+                return false;
+            }
+            p_iter->page = next;
+            p_iter->seq++;
+            p_iter->slot = -1;
+        }
+    }
+}
+
+void fs_log_iter_init(fs_log_iter_t *p_iter, bool backward) {
+    p_iter->page = -1;
+    p_iter->seq = 0;
+    p_iter->slot = 0;
+    p_iter->backward = backward;
+}
+
+bool fs_log_iter_next(fs_log_iter_t *p_iter, fs_log_entry_t *p_entry, uint32_t *p_index) {
+    while (iter_step(p_iter)) {
+        const fs_log_entry_t *p_flash_entry = entry_ptr(p_iter->page, p_iter->slot);
+        if (is_entry_valid(p_flash_entry)) {
+            memcpy(p_entry, p_flash_entry, sizeof(fs_log_entry_t));
+            if (p_index != NULL) {
+                *p_index = p_iter->seq * FS_LOG_SLOTS + p_iter->slot;
+            }
+            return true;
+        }
+    }
+    return false;
+}
+
+/*
+    Flash operations impl
+*/
+
+static void op_finish() {
+    ret_code_t result = log_s.op_result;
+    fs_log_op_t op = log_s.op;
+    log_s.op = LOG_OP_NONE;
+
+    switch (op) {
+    case LOG_OP_ERASE:
+        if (result != NRF_SUCCESS) {
+            NRF_LOG_ERROR("fs_log: Erase of page %d failed: %d", log_s.open_page, result);
+        }
+        break;
+    case LOG_OP_HEADER:
+        if (result == NRF_SUCCESS) {
+            log_s.seqs[log_s.open_page] = log_s.page_header.seq;
+            log_s.max_seq = log_s.page_header.seq;
+            log_s.head_page = log_s.open_page;
+            log_s.head_slot = 0;
+            log_s.open_page = -1;
+        }
+        else {
+            // Page is erased again by next open attempt
+            NRF_LOG_ERROR("fs_log: Header write to page %d failed: %d", log_s.open_page, result);
+        }
+        break;
+    case LOG_OP_ENTRY:
+        // Failed write can leave torn entry, so slot is skipped and entry is written again
+        log_s.head_slot++;
+        if (result == NRF_SUCCESS) {
+            CRITICAL_REGION_ENTER();
+            log_s.queue_head = (log_s.queue_head + 1) % FS_LOG_QUEUE_SIZE;
+            log_s.queue_count--;
+            CRITICAL_REGION_EXIT();
+        }
+        else {
+            NRF_LOG_ERROR("fs_log: Entry write failed: %d", result);
+        }
+        break;
+    default:
+        break;
+    }
+}
+
+static ret_code_t op_start(fs_log_op_t op, uintptr_t addr, const void *src, size_t length) {
+    // Event can come before fs_flash call returns
+    log_s.op = op;
+    log_s.op_done = false;
+    ret_code_t err_code = (op == LOG_OP_ERASE) ?
+        fs_flash_erase(addr, fs_log_evt_handler, NULL) :
+        fs_flash_write(addr, src, length, fs_log_evt_handler, NULL);
+    if (err_code == NRF_ERROR_NO_MEM) {
+        // Queue of fs_flash is shared with fs, operation is started again later
+        log_s.op = LOG_OP_NONE;
+    }
+    else if (err_code != NRF_SUCCESS) {
+        // Rejected operation is finished as failed one, so entry slot is skipped or page is erased again
+        fs_log_evt_handler(err_code, NULL);
+    }
+    return err_code;
+}
+
+static void open_page_start() {
+    uintptr_t page_addr = FS_LOG_PAGE_ADDR(log_s.open_page);
+    if (!is_erased((const void*) page_addr, CODE_PAGE_SIZE)) {
+        // Erase stalls CPU, so it waits for quiet window like background compaction of fs
+        if (fs_sched_allowed(log_s.open_ticks)) {
+            op_start(LOG_OP_ERASE, page_addr, NULL, 0);
+        }
+        return;
+    }
+
+    log_s.page_header.magic = FS_LOG_MAGIC;
+    log_s.page_header.seq = (log_s.head_page < 0) ? 0 : log_s.max_seq + 1;
+    log_s.page_header.reserved[0] = 0xFFFFFFFF;
+    log_s.page_header.reserved[1] = 0xFFFFFFFF;
+    op_start(LOG_OP_HEADER, page_addr, &log_s.page_header, sizeof(log_s.page_header));
+}
+
+void fs_log_process() {
+    /*
+        One flash operation at time. Appending is constant time: entry takes next slot
+        of head page, full head page is followed by the oldest one in ring order.
+    */
+    if (log_s.op != LOG_OP_NONE) {
+        if (!log_s.op_done) {
+            return;
+        }
+        op_finish();
+    }
+
+    if (log_s.open_page >= 0) {
+        open_page_start();
+        return;
+    }
+    if (log_s.queue_count == 0) {
+        return;
+    }
+    if (log_s.head_page < 0 || log_s.head_slot >= FS_LOG_SLOTS) {
+        log_s.open_page = (log_s.head_page + 1) % FS_LOG_PAGES;
+        log_s.open_ticks = app_timer_cnt_get();
+        // Reused page is dropped before erase, so iterators don`t read it
+        log_s.seqs[log_s.open_page] = FS_LOG_SEQ_FREE;
+        open_page_start();
+        return;
+    }
+
+    uintptr_t addr = (uintptr_t) entry_ptr(log_s.head_page, log_s.head_slot);
+    op_start(LOG_OP_ENTRY, addr, log_s.queue[log_s.queue_head], FS_LOG_ENTRY_SIZE);
+}
+
+/*
+    Mount impl
+*/
+
+ret_code_t fs_log_init() {
+    log_s.head_page = -1;
+    log_s.head_slot = 0;
+    log_s.open_page = -1;
+    log_s.max_seq = 0;
+    log_s.op = LOG_OP_NONE;
+    log_s.queue_head = 0;
+    log_s.queue_count = 0;
+
+    ret_code_t err_code = fs_flash_init();
+    if (err_code != NRF_SUCCESS) {
+        return err_code;
+    }
+
+    for (int8_t i = 0; i < FS_LOG_PAGES; i++) {
+        const fs_log_page_header_t *p_header = (const fs_log_page_header_t*) FS_LOG_PAGE_ADDR(i);
+        log_s.seqs[i] = (p_header->magic == FS_LOG_MAGIC) ? p_header->seq : FS_LOG_SEQ_FREE;
+        if (log_s.seqs[i] != FS_LOG_SEQ_FREE && (log_s.head_page < 0 || log_s.seqs[i] > log_s.max_seq)) {
+            log_s.head_page = i;
+            log_s.max_seq = log_s.seqs[i];
+        }
+    }
+
+    if (log_s.head_page >= 0) {
+        // Entries are written in slot order, so head slot follows the last written one
+        int16_t slot = FS_LOG_SLOTS;
+        while (slot > 0 && is_erased(entry_ptr(log_s.head_page, slot - 1), FS_LOG_ENTRY_SIZE)) {
+            slot--;
+        }
+        log_s.head_slot = slot;
+    }
+
+    NRF_LOG_INFO("fs_log: %d pages of %d entries, head page %d, slot %d",
+                 FS_LOG_PAGES, FS_LOG_SLOTS, log_s.head_page, log_s.head_slot);
+    return NRF_SUCCESS;
+}
@@ -0,0 +1,58 @@
+#ifndef _FS_LOG
+#define _FS_LOG
+
+
+#include "fs_partition.h"
+#include "sdk_errors.h"
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+    Circular append-only log in its own partition next to fs. Page starts with header
+    holding sequence number, the rest is split to fixed size entries which are written
+    in order and never changed. When log is full, page with the lowest sequence number
+    is erased and reused, so appending never copies entries and takes constant time.
+    Flash is reached through fs_flash.h like fs, erase of reused page waits for quiet
+    window of fs scheduler, see fs_sched_traffic().
+*/
+
+/* Entry payload, entry is FS_LOG_ENTRY_SIZE bytes with its header */
+#define FS_LOG_DATA_SIZE 12
+#define FS_LOG_ENTRY_SIZE 16
+/* Entries appended but not written to flash yet */
+#define FS_LOG_QUEUE_SIZE 16
+
+typedef struct {
+    uint8_t type;       // Set by application, 0xFF is not allowed
+    uint8_t length;     // Bytes of data used
+    uint16_t crc;       // crc16 of type, length and data
+    uint8_t data[FS_LOG_DATA_SIZE];
+} fs_log_entry_t;
+
+/* Iterator walks entries on flash, it stays valid while pages it visits are not reused */
+typedef struct {
+    int8_t page;        // -1 when iteration is not started
+    uint32_t seq;
+    int16_t slot;
+    bool backward;
+} fs_log_iter_t;
+
+
+/*
+    Entry is queued and written by fs_log_process(), so it can be called from interrupt handlers.
+    Returns NRF_ERROR_NO_MEM if queue is full.
+*/
+ret_code_t fs_log_append(uint8_t type, const void *data, uint8_t length);
+/* Forward iteration starts at the oldest entry, backward one at the newest entry */
+void fs_log_iter_init(fs_log_iter_t *p_iter, bool backward);
+/* Returns false when there are no more entries. p_index receives entry number, it grows with every append. */
+bool fs_log_iter_next(fs_log_iter_t *p_iter, fs_log_entry_t *p_entry, uint32_t *p_index);
+
+ret_code_t fs_log_init();
+void fs_log_process();
+
+
+#endif
@@ -0,0 +1,60 @@
+#include "fs_partition.h"
+
+#include "nrf.h"
+#include "nrf_log.h"
+#include "app_util.h"
+#include <inttypes.h>
+#include <stdbool.h>
+
+/* fds, log and fs partitions are disjoint */
+STATIC_ASSERT(FDS_PARTITION_END <= FS_LOG_START);
+STATIC_ASSERT(FS_PARTITION_PAGES > 0);
+STATIC_ASSERT(FS_LOG_PAGES >= 2);
+STATIC_ASSERT(FDS_PARTITION_PAGE_SIZE % CODE_PAGE_SIZE == 0);
+
+/* Defined by nrf_common.ld, initial values of .data are stored after code */
+extern uint32_t __data_start__;
+extern uint32_t __data_end__;
+
+#define DFU_PRESERVED_START (BOOTLOADER_ADDR - NRF_DFU_APP_DATA_AREA_SIZE)
+
+static bool is_preserved(const char *name, uint32_t start) {
+    // Bootloader keeps only pages above DFU_PRESERVED_START, new image may be stored below it
+    if (start < DFU_PRESERVED_START) {
+        NRF_LOG_ERROR("fs_partition: %s starts at 0x%" PRIX32 ", below DFU preserved area 0x%" PRIX32,
+                      name, start, (uint32_t) DFU_PRESERVED_START);
+        return false;
+    }
+    return true;
+}
+
+ret_code_t fs_partition_check() {
+    /*
+        fds puts its pages below bootloader address from UICR, or below end of flash if there is no bootloader.
+        fs partition is placed below BOOTLOADER_ADDR, both must be the same address.
+    */
+    uint32_t bootloader_addr = NRF_UICR->NRFFW[0];
+    if (bootloader_addr != BOOTLOADER_ADDR) {
+        NRF_LOG_ERROR("fs_partition: Bootloader is at 0x%" PRIX32 ", partitions expect it at 0x%" PRIX32,
+                      bootloader_addr, (uint32_t) BOOTLOADER_ADDR);
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    uint32_t image_end = CODE_END + ((uint32_t) &__data_end__ - (uint32_t) &__data_start__);
+    if (image_end > FDS_PARTITION_START) {
+        NRF_LOG_ERROR("fs_partition: Application ends at 0x%" PRIX32 ", after start of fds pages 0x%" PRIX32,
+                      image_end, (uint32_t) FDS_PARTITION_START);
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    if (!is_preserved("fds (bonds)", FDS_PARTITION_START) || !is_preserved("log", FS_LOG_START) ||
+        !is_preserved("fs", FS_PARTITION_START)) {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+
+    NRF_LOG_INFO("fs_partition: fds 0x%" PRIX32 "-0x%" PRIX32 ", log 0x%" PRIX32 "-0x%" PRIX32 ", fs 0x%" PRIX32 "-0x%" PRIX32,
+                 (uint32_t) FDS_PARTITION_START, (uint32_t) FDS_PARTITION_END,
+                 (uint32_t) FS_LOG_START, (uint32_t) FS_LOG_END,
+                 (uint32_t) FS_PARTITION_START, (uint32_t) FS_PARTITION_END);
+    return NRF_SUCCESS;
+}
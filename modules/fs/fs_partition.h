@@ -0,0 +1,48 @@
+#ifndef _FS_PARTITION
+#define _FS_PARTITION
+
+
+#include "nrf_dfu_types.h"
+#include "sdk_config.h"
+#include "sdk_errors.h"
+
+
+/*
+    Flash below bootloader is split between partitions, from top to bottom:
+    fs pages, log pages, then fds pages of peer manager bonds. fds takes its pages below
+    FDS_VIRTUAL_PAGES_RESERVED virtual pages at the end of flash, so reserved pages must cover fs and log partitions.
+    Bootloader keeps only NRF_DFU_APP_DATA_AREA_SIZE bytes on DFU, they must cover every partition,
+    fs_partition_check() fails otherwise.
+*/
+
+#define BOOTLOADER_ADDR 0xE0000
+
+#ifndef FS_PARTITION_PAGES
+#define FS_PARTITION_PAGES 6
+#endif
+#define FS_PARTITION_END BOOTLOADER_ADDR
+#define FS_PARTITION_START (FS_PARTITION_END - FS_PARTITION_PAGES * CODE_PAGE_SIZE)
+
+/* Circular log of fs_log.h, oldest page is erased when it is full */
+#ifndef FS_LOG_PAGES
+#define FS_LOG_PAGES 4
+#endif
+#define FS_LOG_END FS_PARTITION_START
+#define FS_LOG_START (FS_LOG_END - FS_LOG_PAGES * CODE_PAGE_SIZE)
+
+/* FDS_VIRTUAL_PAGE_SIZE is in words */
+#define FDS_PARTITION_PAGE_SIZE (FDS_VIRTUAL_PAGE_SIZE * 4)
+#define FDS_PARTITION_END (BOOTLOADER_ADDR - FDS_VIRTUAL_PAGES_RESERVED * FDS_PARTITION_PAGE_SIZE)
+#define FDS_PARTITION_START (FDS_PARTITION_END - FDS_VIRTUAL_PAGES * FDS_PARTITION_PAGE_SIZE)
+
+
+/*
+    Checks partitions against layout known only at run time: bootloader address taken by fds from UICR
+    and end of application image. Must be called before pm_init() initializes fds.
+    Returns NRF_ERROR_INVALID_ADDR if partitions overlap bootloader or application,
+    or if they are outside of DFU preserved area.
+*/
+ret_code_t fs_partition_check();
+
+
+#endif
@@ -0,0 +1,188 @@
+#include "fs_vars.h"
+
+#include "nrf_log.h"
+#include "nrf_pwr_mgmt.h"
+#include "app_timer.h"
+#include "app_util_platform.h"
+#include <string.h>
+#include <inttypes.h>
+
+NRF_SECTION_DEF(fs_vars, const fs_var_t);
+
+#define FS_VARS_COUNT NRF_SECTION_ITEM_COUNT(fs_vars, const fs_var_t)
+#define FS_VAR_GET(i) NRF_SECTION_ITEM_GET(fs_vars, const fs_var_t, i)
+
+static struct {
+    volatile uint32_t dirty;    // Bit of variable is its index in section
+    volatile uint32_t changed_ticks;
+    volatile bool flush_requested;
+    bool shutdown_pending;
+    uint32_t batch_vars;        // Variables of queued batch, batch is not changed while it is not 0
+    fs_batch_t batch;
+} vars_s;
+
+static bool is_var_stored(const fs_var_t *var) {
+    fs_map_t map;
+    return fs_map(var->record_name, &map) == NRF_SUCCESS && map.length == var->size &&
+           memcmp(map.data, var->p_data, var->size) == 0;
+}
+
+static void vars_retry(uint32_t failed, bool now) {
+    // Failed variables are retried after next quiet window, left over ones on next fs_vars_process()
+    if (failed == 0 || (!now && vars_s.shutdown_pending)) {
+        return;
+    }
+    CRITICAL_REGION_ENTER();
+    vars_s.dirty |= failed;
+    if (now) {
+        vars_s.flush_requested = true;
+    }
+    else {
+        vars_s.changed_ticks = app_timer_cnt_get();
+    }
+    CRITICAL_REGION_EXIT();
+}
+
+static void batch_write_cb(ret_code_t result, fs_header_t *phead, void *p_context) {
+    uint32_t written = vars_s.batch_vars;
+    vars_s.batch_vars = 0;
+    fs_batch_begin(&vars_s.batch);
+    if (result != NRF_SUCCESS) {
+        NRF_LOG_WARNING("fs_vars: Batch is not written, error %" PRIu32, result);
+        vars_retry(written, false);
+    }
+}
+
+static void vars_write(uint32_t dirty) {
+    /*
+        Variables equal to stored ones are skipped. Batch is queued with variables which fit it
+        and belong to instance of the first one, the rest are written by next batch when it is finished.
+    */
+    uint32_t staged = 0;
+    uint32_t left = 0;
+    uint32_t failed = 0;
+    fs_batch_begin(&vars_s.batch);
+    for (size_t i = 0; i < FS_VARS_COUNT; i++) {
+        const fs_var_t *var = FS_VAR_GET(i);
+        if ((dirty & (1UL << i)) == 0 || is_var_stored(var)) {
+            continue;
+        }
+        if (fs_batch_stage(&vars_s.batch, var->record_name, var->p_data, var->size) == NRF_SUCCESS) {
+            staged |= 1UL << i;
+        }
+        else if (staged != 0) {
+            left |= 1UL << i;
+        }
+        else {
+            failed |= 1UL << i;
+        }
+    }
+
+    if (staged != 0) {
+        ret_code_t err_code = fs_batch_commit_async(&vars_s.batch, batch_write_cb, NULL);
+        if (err_code == NRF_SUCCESS) {
+            vars_s.batch_vars = staged;
+        }
+        else if (err_code == NRF_ERROR_NO_MEM) {
+            // Write queue is full, batch is queued again when it has room
+            left |= staged;
+        }
+        else {
+            NRF_LOG_WARNING("fs_vars: Batch is not queued, error %" PRIu32, err_code);
+            failed |= staged;
+        }
+    }
+    vars_retry(left, true);
+    vars_retry(failed, false);
+}
+
+ret_code_t fs_var_changed(const void *p_data) {
+    for (size_t i = 0; i < FS_VARS_COUNT; i++) {
+        if (FS_VAR_GET(i)->p_data == p_data) {
+            CRITICAL_REGION_ENTER();
+            vars_s.dirty |= 1UL << i;
+            vars_s.changed_ticks = app_timer_cnt_get();
+            CRITICAL_REGION_EXIT();
+            return NRF_SUCCESS;
+        }
+    }
+    return NRF_ERROR_NOT_FOUND;
+}
+
+const fs_var_t *fs_var_find(const char *record_name) {
+    for (size_t i = 0; i < FS_VARS_COUNT; i++) {
+        if (strcmp(FS_VAR_GET(i)->record_name, record_name) == 0) {
+            return FS_VAR_GET(i);
+        }
+    }
+    return NULL;
+}
+
+void fs_vars_flush_request() {
+    vars_s.flush_requested = true;
+}
+
+ret_code_t fs_vars_init() {
+    /*
+        Called after fs_init(). Variable which is not stored or stored with other size keeps its default.
+    */
+    if (FS_VARS_COUNT > FS_VARS_MAX) {
+        NRF_LOG_ERROR("fs_vars: %" PRIu32 " variables are registered, FS_VARS_MAX is %" PRIu32,
+                      (uint32_t) FS_VARS_COUNT, (uint32_t) FS_VARS_MAX);
+        return NRF_ERROR_NO_MEM;
+    }
+
+    vars_s.dirty = 0;
+    vars_s.flush_requested = false;
+    vars_s.shutdown_pending = false;
+    vars_s.batch_vars = 0;
+    for (size_t i = 0; i < FS_VARS_COUNT; i++) {
+        const fs_var_t *var = FS_VAR_GET(i);
+        fs_header_t *phead = fs_find_record(var->record_name);
+        if (phead != NULL && fs_record_length(phead) == var->size) {
+            fs_read(phead, var->p_data, var->size);
+        }
+        else {
+            NRF_LOG_INFO("fs_vars: \"%s\" is not stored, default is used", var->record_name);
+        }
+    }
+    return NRF_SUCCESS;
+}
+
+void fs_vars_process() {
+    /*
+        Batch is queued by fs_batch_commit_async(), fs_process() writes it while main loop keeps running.
+        Next batch is queued after previous one is finished.
+    */
+    if (vars_s.batch_vars == 0 && vars_s.dirty != 0 &&
+        (vars_s.flush_requested || app_timer_cnt_diff_compute(app_timer_cnt_get(), vars_s.changed_ticks) >= APP_TIMER_TICKS(FS_VARS_QUIET_MS))) {
+        uint32_t dirty;
+        CRITICAL_REGION_ENTER();
+        dirty = vars_s.dirty;
+        vars_s.dirty = 0;
+        vars_s.flush_requested = false;
+        CRITICAL_REGION_EXIT();
+
+        vars_write(dirty);
+    }
+
+    if (vars_s.shutdown_pending && vars_s.dirty == 0 && vars_s.batch_vars == 0) {
+        vars_s.shutdown_pending = false;
+        nrf_pwr_mgmt_shutdown(NRF_PWR_MGMT_SHUTDOWN_CONTINUE);
+    }
+}
+
+static bool fs_vars_shutdown_handler(nrf_pwr_mgmt_evt_t event) {
+    /*
+        Shutdown is postponed until dirty variables are written by fs_vars_process(),
+        variables which failed to be written are dropped then.
+    */
+    if (vars_s.dirty == 0 && vars_s.batch_vars == 0) {
+        return true;
+    }
+    vars_s.flush_requested = true;
+    vars_s.shutdown_pending = true;
+    return false;
+}
+
+NRF_PWR_MGMT_HANDLER_REGISTER(fs_vars_shutdown_handler, 0);
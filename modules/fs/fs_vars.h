@@ -0,0 +1,55 @@
+#ifndef _FS_VARS
+#define _FS_VARS
+
+
+#include "fs.h"
+#include "nrf_section.h"
+#include "nordic_common.h"
+#include "sdk_errors.h"
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+    Persistent variables. FS_VAR_DEF() defines RAM variable and registers its descriptor
+    in fs_vars section, fs_vars_init() restores every registered variable by one pass after
+    fs_init(). Variable changed by its owner is marked by fs_var_changed(), dirty variables
+    are queued by fs_vars_process() when none of them was changed for FS_VARS_QUIET_MS,
+    every instance by one batch written by fs_process(). Stored variable keeps its value
+    only while its size is the same.
+    Dirty variables are written on nrf_pwr_mgmt_shutdown() too, other resets and power loss lose
+    changes of the last FS_VARS_QUIET_MS.
+*/
+
+#define FS_VARS_MAX 32
+#define FS_VARS_QUIET_MS FS_DEFERRED_QUIET_MS
+
+typedef struct {
+    char *record_name;
+    void *p_data;
+    uint16_t size;
+} fs_var_t;
+
+/* Initializer is the default value, it is kept if variable is not stored */
+#define FS_VAR_DEF(_type, _name, _record_name, ...)                                          \
+    _type _name = __VA_ARGS__;                                                                \
+    NRF_SECTION_ITEM_REGISTER(fs_vars, static const fs_var_t CONCAT_2(_name, _fs_var)) = {    \
+        .record_name = _record_name,                                                          \
+        .p_data = &_name,                                                                     \
+        .size = sizeof(_type)                                                                 \
+    }
+
+/* Can be called from interrupt handlers. Returns NRF_ERROR_NOT_FOUND if p_data is not registered. */
+ret_code_t fs_var_changed(const void *p_data);
+/* Returns NULL if no variable is stored in record_name */
+const fs_var_t *fs_var_find(const char *record_name);
+/* Writes dirty variables on next fs_vars_process() without waiting for quiet window */
+void fs_vars_flush_request();
+
+ret_code_t fs_vars_init();
+void fs_vars_process();
+
+
+#endif
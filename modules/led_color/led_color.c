@@ -1,5 +1,48 @@
 #include "led_color.h"
 #include "../led_control/led_control.h"
+#include "app_util.h"
+
+/* Slowest base clock which gives PWM_MIN_REFRESH_HZ with PWM_TOP_VALUE counts */
+#define PWM_MIN_BASE_CLOCK_HZ (PWM_TOP_VALUE * PWM_MIN_REFRESH_HZ)
+
+#if PWM_TOP_VALUE > 0x7FFF
+#error "PWM_TOP_VALUE doesn`t fit 15 bit COUNTERTOP"
+#elif PWM_MIN_BASE_CLOCK_HZ <= 125000
+#define PWM_BASE_CLOCK NRF_PWM_CLK_125kHz
+#elif PWM_MIN_BASE_CLOCK_HZ <= 250000
+#define PWM_BASE_CLOCK NRF_PWM_CLK_250kHz
+#elif PWM_MIN_BASE_CLOCK_HZ <= 500000
+#define PWM_BASE_CLOCK NRF_PWM_CLK_500kHz
+#elif PWM_MIN_BASE_CLOCK_HZ <= 1000000
+#define PWM_BASE_CLOCK NRF_PWM_CLK_1MHz
+#elif PWM_MIN_BASE_CLOCK_HZ <= 2000000
+#define PWM_BASE_CLOCK NRF_PWM_CLK_2MHz
+#elif PWM_MIN_BASE_CLOCK_HZ <= 4000000
+#define PWM_BASE_CLOCK NRF_PWM_CLK_4MHz
+#elif PWM_MIN_BASE_CLOCK_HZ <= 8000000
+#define PWM_BASE_CLOCK NRF_PWM_CLK_8MHz
+#elif PWM_MIN_BASE_CLOCK_HZ <= 16000000
+#define PWM_BASE_CLOCK NRF_PWM_CLK_16MHz
+#else
+#error "PWM_TOP_VALUE is too big for PWM_MIN_REFRESH_HZ with 16 MHz base clock"
+#endif
+
+/*
+    CIE lightness l from 0 to 1 to relative luminance, cube above l = 0.08 and linear below.
+    Table is folded by compiler, nothing of it is computed at run time.
+*/
+#define GAMMA_CIE_CUBE_ROOT(l) (((l) * 100 + 16) / 116)
+#define GAMMA_LINEAR(l) ((l) > 0.08 ? GAMMA_CIE_CUBE_ROOT(l) * GAMMA_CIE_CUBE_ROOT(l) * GAMMA_CIE_CUBE_ROOT(l) \
+                                    : (l) * 100 / 903.3)
+#define GAMMA_LUT_ENTRY(i) (uint16_t) (GAMMA_LINEAR((i) / (double) GAMMA_LUT_SIZE) * UINT16_MAX + 0.5)
+#define GAMMA_LUT_4(i) GAMMA_LUT_ENTRY(i), GAMMA_LUT_ENTRY((i) + 1), GAMMA_LUT_ENTRY((i) + 2), GAMMA_LUT_ENTRY((i) + 3)
+#define GAMMA_LUT_16(i) GAMMA_LUT_4(i), GAMMA_LUT_4((i) + 4), GAMMA_LUT_4((i) + 8), GAMMA_LUT_4((i) + 12)
+#define GAMMA_LUT_64(i) GAMMA_LUT_16(i), GAMMA_LUT_16((i) + 16), GAMMA_LUT_16((i) + 32), GAMMA_LUT_16((i) + 48)
+#define GAMMA_LUT_256(i) GAMMA_LUT_64(i), GAMMA_LUT_64((i) + 64), GAMMA_LUT_64((i) + 128), GAMMA_LUT_64((i) + 192)
+
+STATIC_ASSERT(GAMMA_LUT_SIZE == 256);
+
+static const uint16_t gamma_lut[GAMMA_LUT_SIZE + 1] = {GAMMA_LUT_256(0), GAMMA_LUT_ENTRY(GAMMA_LUT_SIZE)};
 
 static nrf_pwm_values_individual_t seq_values;
 
@@ -21,9 +64,40 @@ static struct {
 
 static hsv_data_t current_hsv_color = {.0};
 static rgb_data_t current_rgb_color = {0};
+static rgb16_data_t current_linear_color = {0};
+static uint8_t led1_brightness = 0;
 static bool color_was_changed = false;
 
 
+static uint16_t perceptual_to_linear(uint16_t perceptual) {
+    /*
+        Table points are 256 apart, perceptual value is stretched to 0..65536 so
+        UINT16_MAX hits the last point.
+    */
+    uint32_t position = perceptual + (perceptual >> 15);
+    uint32_t index = position >> 8;
+    uint32_t fraction = position & 0xFF;
+    if (index == GAMMA_LUT_SIZE) {
+        return gamma_lut[GAMMA_LUT_SIZE];
+    }
+    return gamma_lut[index] + (((gamma_lut[index + 1] - gamma_lut[index]) * fraction + 0x80) >> 8);
+}
+
+static uint16_t linear_to_pwm(uint16_t linear) {
+    return ((uint32_t) linear * PWM_TOP_VALUE + UINT16_MAX / 2) / UINT16_MAX;
+}
+
+static void set_led2_linear(const rgb16_data_t* rgb16) {
+    current_linear_color = (rgb16_data_t) {.r = perceptual_to_linear(rgb16->r), .g = perceptual_to_linear(rgb16->g),
+                                           .b = perceptual_to_linear(rgb16->b)};
+
+    *led_values_pointers_s.led2_red = linear_to_pwm(current_linear_color.r);
+    *led_values_pointers_s.led2_blue = linear_to_pwm(current_linear_color.b);
+    *led_values_pointers_s.led2_green = linear_to_pwm(current_linear_color.g);
+    color_was_changed = true;
+}
+
+
 bool led_color_was_color_changed() {
     if (color_was_changed) {
         color_was_changed = false;
@@ -42,6 +116,7 @@ nrfx_pwm_t pwm_control_init() {
     pwm_conf.output_pins[1] = LED2_G;
     pwm_conf.output_pins[2] = LED2_B;
     pwm_conf.output_pins[3] = LED1;
+    pwm_conf.base_clock = PWM_BASE_CLOCK;
     pwm_conf.top_value = PWM_TOP_VALUE;
 
     nrfx_pwm_init(&driver_instance, &pwm_conf, NULL);
@@ -58,24 +133,27 @@ rgb_data_t get_current_rgb_color() {
 }
 
 void set_led2_color_by_rgb(const rgb_data_t* rgb) {
-    *led_values_pointers_s.led2_red = rgb->r;
-    *led_values_pointers_s.led2_blue = rgb->b;
-    *led_values_pointers_s.led2_green = rgb->g;
+    rgb16_data_t rgb16 = get_rgb16_from_rgb(rgb);
+    set_led2_linear(&rgb16);
 
     current_rgb_color = *rgb;
-    color_was_changed = true;
     current_hsv_color = get_hsv_from_rgb(rgb);
 }
 
 void set_led2_color_by_hsv(const hsv_data_t* hsv) {
-    rgb_data_t rgb = get_rgb_from_hsv(hsv);
-    set_led2_color_by_rgb(&rgb);
+    /* 16 bit conversion keeps steps of dim colors which 8 bit rgb merges */
+    rgb16_data_t rgb16 = get_rgb16_from_hsv(hsv);
+    set_led2_linear(&rgb16);
+
+    current_rgb_color = get_rgb_from_hsv(hsv);
+    current_hsv_color = *hsv;
 }
 
 void set_led1_brightness(uint8_t brightness) {
-    *led_values_pointers_s.led1 = brightness;
+    led1_brightness = brightness;
+    *led_values_pointers_s.led1 = linear_to_pwm(perceptual_to_linear(brightness * 257));
 }
 
 uint16_t get_led1_brightness() {
-    return *led_values_pointers_s.led1;
+    return led1_brightness;
 }
@@ -1,7 +1,22 @@
 #include "nrfx_pwm.h"
 #include "../color_types/color_types.h"
 
-#define PWM_TOP_VALUE 255
+/*
+    Colors are kept as 16 bit linear intensities, perceptual 16 bit values are converted by
+    GAMMA_LUT_SIZE + 1 point CIE lightness table generated at compile time and interpolated
+    between points. Compare values are linear intensities scaled to PWM_TOP_VALUE.
+    PWM base clock is the slowest one which keeps refresh rate not less than PWM_MIN_REFRESH_HZ.
+*/
+
+#ifndef PWM_TOP_VALUE
+#define PWM_TOP_VALUE 4000
+#endif
+#define PWM_MIN_REFRESH_HZ 1500
+
+#define GAMMA_LUT_SIZE 256
+
+/* Scale of 8 bit brightness of led1 */
+#define LED1_BRIGHTNESS_MAX UINT8_MAX
 
 
 nrfx_pwm_t pwm_control_init();
@@ -15,4 +30,4 @@ uint16_t get_led1_brightness();
 hsv_data_t get_current_hsv_color();
 rgb_data_t get_current_rgb_color();
 
-bool led_color_was_color_changed();
\ No newline at end of file
+bool led_color_was_color_changed();
@@ -0,0 +1,40 @@
+#include "../modules/color_types/color_types.h"
+#include "color_types_float.h"
+#include "cycles.h"
+
+#include <stdio.h>
+
+/* Host cycles per conversion of fixed-point and float versions over spread of inputs */
+
+#define BENCH_RGB_STEP 7
+#define BENCH_HSV_INPUTS (360 * 101 * 101)
+
+static volatile uint32_t sink;
+
+static double bench_rgb_to_hsv(hsv_data_t (*convert)(const rgb_data_t*)) {
+    uint32_t count = 0;
+    uint64_t start = cycles_now();
+    for (uint32_t i = 0; i < (1u << 24); i += BENCH_RGB_STEP, count++) {
+        rgb_data_t rgb = new_rgb(i >> 16, i >> 8, i);
+        sink += convert(&rgb).h;
+    }
+    return (double) (cycles_now() - start) / count;
+}
+
+static double bench_hsv_to_rgb(rgb_data_t (*convert)(const hsv_data_t*)) {
+    uint64_t start = cycles_now();
+    for (uint32_t i = 0; i < BENCH_HSV_INPUTS; i++) {
+        hsv_data_t hsv = new_hsv(i % 360, i / 360 % 101, i / (360 * 101));
+        sink += convert(&hsv).r;
+    }
+    return (double) (cycles_now() - start) / BENCH_HSV_INPUTS;
+}
+
+int main(void) {
+    printf("%-10s %14s %14s\n", "", "fixed-point", "float");
+    printf("%-10s %8.1f %-5s %8.1f %-5s\n", "rgb->hsv", bench_rgb_to_hsv(get_hsv_from_rgb), CYCLES_UNIT,
+           bench_rgb_to_hsv(float_get_hsv_from_rgb), CYCLES_UNIT);
+    printf("%-10s %8.1f %-5s %8.1f %-5s\n", "hsv->rgb", bench_hsv_to_rgb(get_rgb_from_hsv), CYCLES_UNIT,
+           bench_hsv_to_rgb(float_get_rgb_from_hsv), CYCLES_UNIT);
+    return 0;
+}
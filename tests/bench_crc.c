@@ -0,0 +1,49 @@
+/* Module is included, so benchmark reaches crc8() and crc32_update() */
+#include "../modules/fs/fs.c"
+
+#include "cycles.h"
+
+#include <stdio.h>
+
+/*
+    Bit-serial crc8 of previous record format against table-driven CRC-32 of current one,
+    over payload sizes of fs records and a whole page.
+*/
+
+#define BENCH_BYTES (16 * 1024 * 1024)
+
+static uint8_t data[CODE_PAGE_SIZE];
+static volatile uint32_t sink;
+
+static double bench_crc8(size_t length) {
+    uint64_t start = cycles_now();
+    for (size_t done = 0; done < BENCH_BYTES; done += length) {
+        sink += crc8(0xFF, data, length);
+        CYCLES_BARRIER();
+    }
+    return (double) BENCH_BYTES / (cycles_now() - start);
+}
+
+static double bench_crc32(size_t length) {
+    uint64_t start = cycles_now();
+    for (size_t done = 0; done < BENCH_BYTES; done += length) {
+        sink += crc32_update(0xFFFFFFFF, data, length);
+        CYCLES_BARRIER();
+    }
+    return (double) BENCH_BYTES / (cycles_now() - start);
+}
+
+int main(void) {
+    static const size_t lengths[] = {FS_INLINE_VALUE_SIZE + 4, 64, FS_RECORD_MAX_LENGTH, CODE_PAGE_SIZE};
+    for (size_t i = 0; i < sizeof(data); i++) {
+        data[i] = i * 7;
+    }
+
+    printf("%-8s %16s %16s %8s\n", "bytes", "crc8 B/" CYCLES_UNIT, "crc32 B/" CYCLES_UNIT, "speedup");
+    for (size_t i = 0; i < sizeof(lengths) / sizeof(lengths[0]); i++) {
+        double crc8_rate = bench_crc8(lengths[i]);
+        double crc32_rate = bench_crc32(lengths[i]);
+        printf("%-8zu %16.3f %16.3f %7.1fx\n", lengths[i], crc8_rate, crc32_rate, crc32_rate / crc8_rate);
+    }
+    return 0;
+}
@@ -0,0 +1,235 @@
+#include "fs.h"
+#include "flash_emu.h"
+#include "../modules/color_types/color_types.h"
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/*
+    Workloads of application replayed on emulated flash. Every operation is followed by
+    BENCH_LOOP_US of main loop, fs_process() runs then like in main.c. Time is emulated,
+    so numbers don`t depend on host and are the same on every run.
+*/
+
+#define BENCH_OPS 20000
+#define BENCH_LOOP_US 2000
+#define BENCH_DELETE_NAMES 24
+
+typedef struct {
+    const char *name;
+    uint32_t ops;
+    uint64_t payload_bytes;     // Bytes passed to fs calls
+    uint64_t max_call_us;       // Longest time spent in one fs call, it is waiting for flash
+    uint64_t start_us;
+    flash_emu_stats_t start_stats;
+} bench_t;
+
+static fs_part_id_t part_policy(const char *record_name) {
+    return strcmp(record_name, "rgb_array") == 0 ? FS_PART_COLD : FS_PART_HOT;
+}
+
+static void bench_start(bench_t *p_bench, const char *name) {
+    memset(p_bench, 0, sizeof(bench_t));
+    p_bench->name = name;
+    p_bench->start_us = flash_emu_time_us();
+    p_bench->start_stats = *flash_emu_get_stats();
+}
+
+static void bench_call_done(bench_t *p_bench, uint64_t call_start_us, size_t payload_bytes) {
+    uint64_t call_us = flash_emu_time_us() - call_start_us;
+    p_bench->max_call_us = call_us > p_bench->max_call_us ? call_us : p_bench->max_call_us;
+    p_bench->payload_bytes += payload_bytes;
+    p_bench->ops++;
+
+    fs_process();
+    flash_emu_advance(BENCH_LOOP_US);
+    fs_process();
+}
+
+static void bench_report(const bench_t *p_bench) {
+    /* Queued operations are finished, so their bytes are counted */
+    while (flash_emu_queue_count() > 0) {
+        flash_emu_advance(BENCH_LOOP_US);
+        fs_process();
+    }
+    const flash_emu_stats_t *p_stats = flash_emu_get_stats();
+    uint64_t bytes_written = p_stats->bytes_written - p_bench->start_stats.bytes_written;
+    uint32_t erases = p_stats->erases - p_bench->start_stats.erases;
+    double seconds = (flash_emu_time_us() - p_bench->start_us) / 1e6;
+    double flash_seconds = (p_stats->busy_us - p_bench->start_stats.busy_us) / 1e6;
+
+    printf("%-16s %8u %10.0f %8.2f %11.2f %9.1f %12.2f\n", p_bench->name, p_bench->ops, p_bench->ops / seconds,
+           (double) bytes_written / p_bench->payload_bytes, erases * 1000.0 / p_bench->ops,
+           p_bench->max_call_us / 1000.0, p_bench->ops / flash_seconds);
+}
+
+/*
+    Workloads impl
+*/
+
+static void bench_hsv_churn() {
+    /* last_hsv is written on every color change of hue sweep */
+    bench_t bench;
+    bench_start(&bench, "last_hsv churn");
+    for (uint32_t i = 0; i < BENCH_OPS; i++) {
+        hsv_data_t hsv = {.h = i % 360, .s = 100, .v = 100 - i / 360 % 100};
+        uint64_t start_us = flash_emu_time_us();
+        if (fs_write("last_hsv", &hsv, sizeof(hsv)) == NULL) {
+            fprintf(stderr, "bench_fs: last_hsv write failed\n");
+            exit(1);
+        }
+        bench_call_done(&bench, start_us, sizeof(hsv));
+    }
+    bench_report(&bench);
+}
+
+static void palette_save(bench_t *p_bench, const rgb_data_array_t *p_array, size_t offset, size_t length) {
+    /* Changed range is patched like by palette commands, see save_colors_range() in commands.c */
+    uint64_t start_us = flash_emu_time_us();
+    if (fs_patch("rgb_array", offset, (const uint8_t*) p_array + offset, length) == NULL &&
+        fs_write_packed("rgb_array", (void*) p_array, sizeof(rgb_data_array_t)) == NULL) {
+        fprintf(stderr, "bench_fs: rgb_array write failed\n");
+        exit(1);
+    }
+    bench_call_done(p_bench, start_us, length);
+}
+
+static void bench_palette_edits() {
+    /* Colors are added to the end and deleted from the middle, deletion shifts the rest */
+    static rgb_data_array_t palette;
+    memset(&palette, 0, sizeof(palette));
+    fs_write_packed("rgb_array", &palette, sizeof(palette));
+
+    bench_t bench;
+    bench_start(&bench, "palette edits");
+    srand(1);
+    for (uint32_t i = 0; i < BENCH_OPS / 4; i++) {
+        if (palette.count < COLORS_COUNT && (palette.count == 0 || rand() % 3 != 0)) {
+            char name[COLOR_NAME_SIZE];
+            snprintf(name, sizeof(name), "color%" PRIu32, i);
+            rgb_data_with_name_t *p_color = &palette.colors_array[palette.count];
+            p_color->rgb = (rgb_data_t) {rand(), rand(), rand()};
+            strcpy(p_color->color_name, name);
+            palette_save(&bench, &palette, palette.count * sizeof(rgb_data_with_name_t), sizeof(rgb_data_with_name_t));
+            palette.count++;
+            palette_save(&bench, &palette, offsetof(rgb_data_array_t, count), sizeof(palette.count));
+        }
+        else {
+            size_t index = rand() % palette.count;
+            memmove(&palette.colors_array[index], &palette.colors_array[index + 1],
+                    (palette.count - index - 1) * sizeof(rgb_data_with_name_t));
+            palette.count--;
+            memset(&palette.colors_array[palette.count], 0, sizeof(rgb_data_with_name_t));
+            size_t offset = index * sizeof(rgb_data_with_name_t);
+            palette_save(&bench, &palette, offset, sizeof(rgb_data_array_t) - offset);
+        }
+    }
+    bench_report(&bench);
+}
+
+static void bench_delete_mix() {
+    /* Short lived records: every write is followed by deletion of random record */
+    bench_t bench;
+    bench_start(&bench, "delete-heavy");
+    srand(2);
+    for (uint32_t i = 0; i < BENCH_OPS / 2; i++) {
+        char name[RECORDNAME_MAX_LENGTH + 1];
+        uint32_t value[4] = {i, i * 3, i * 7, i * 13};
+        size_t length = sizeof(uint32_t) * (1 + rand() % 4);
+        snprintf(name, sizeof(name), "tmp%d", rand() % BENCH_DELETE_NAMES);
+
+        uint64_t start_us = flash_emu_time_us();
+        if (fs_write(name, value, length) == NULL) {
+            fprintf(stderr, "bench_fs: %s write failed\n", name);
+            exit(1);
+        }
+        bench_call_done(&bench, start_us, length);
+
+        snprintf(name, sizeof(name), "tmp%d", rand() % BENCH_DELETE_NAMES);
+        fs_header_t *header = fs_find_record(name);
+        if (header != NULL) {
+            start_us = flash_emu_time_us();
+            fs_delete(header);
+            bench_call_done(&bench, start_us, 0);
+        }
+    }
+    bench_report(&bench);
+}
+
+/*
+    Hot and cold instances impl
+*/
+
+static void churn_palette_copies(const char *name, fs_part_policy_t policy) {
+    /* Palette is stored once, every move of its record under last_hsv churn is a copy by compaction */
+    static rgb_data_array_t palette;
+    memset(&palette, 0, sizeof(palette));
+    for (palette.count = 0; palette.count < COLORS_COUNT / 2; palette.count++) {
+        palette.colors_array[palette.count].rgb = (rgb_data_t) {palette.count * 40, 255 - palette.count * 40, 128};
+        snprintf(palette.colors_array[palette.count].color_name, COLOR_NAME_SIZE, "color%zu", palette.count);
+    }
+
+    flash_emu_init();
+    fs_set_part_policy(policy);
+    fs_init();
+    fs_header_t *phead = fs_write("rgb_array", &palette, sizeof(palette));
+    if (phead == NULL) {
+        fprintf(stderr, "bench_fs: rgb_array write failed\n");
+        exit(1);
+    }
+
+    uint32_t copies = 0;
+    uint32_t start_erases = flash_emu_get_stats()->erases;
+    fs_stats_t hot_start, cold_start;
+    fs_get_stats(FS_PART_HOT, &hot_start);
+    fs_get_stats(FS_PART_COLD, &cold_start);
+    for (uint32_t i = 0; i < BENCH_OPS; i++) {
+        hsv_data_t hsv = {.h = i % 360, .s = 100, .v = 100};
+        if (fs_write("last_hsv", &hsv, sizeof(hsv)) == NULL) {
+            fprintf(stderr, "bench_fs: last_hsv write failed\n");
+            exit(1);
+        }
+        fs_process();
+        flash_emu_advance(BENCH_LOOP_US);
+        fs_process();
+
+        fs_header_t *pcurr = fs_find_record("rgb_array");
+        if (pcurr != phead) {
+            copies++;
+            phead = pcurr;
+        }
+    }
+    while (flash_emu_queue_count() > 0) {
+        flash_emu_advance(BENCH_LOOP_US);
+        fs_process();
+    }
+
+    fs_stats_t hot_stats, cold_stats;
+    fs_get_stats(FS_PART_HOT, &hot_stats);
+    fs_get_stats(FS_PART_COLD, &cold_stats);
+    printf("%-16s %15" PRIu32 " %15" PRIu64 " %12" PRIu32 " %12" PRIu32 " %12" PRIu32 "\n", name, copies,
+           (uint64_t) copies * sizeof(palette), flash_emu_get_stats()->erases - start_erases,
+           hot_stats.compactions - hot_start.compactions, cold_stats.compactions - cold_start.compactions);
+}
+
+int main(void) {
+    flash_emu_init();
+    fs_set_part_policy(part_policy);
+    fs_init();
+
+    printf("Emulated nRF52840 flash: write %d us/word, erase %d ms/page, main loop %d us per operation\n",
+           FLASH_EMU_WRITE_WORD_US, FLASH_EMU_ERASE_PAGE_US / 1000, BENCH_LOOP_US);
+    printf("%-16s %8s %10s %8s %11s %9s %12s\n", "workload", "ops", "ops/s", "write_x", "erases/1k", "stall_ms", "ops/flash_s");
+    bench_hsv_churn();
+    bench_palette_edits();
+    bench_delete_mix();
+
+    printf("\n%d last_hsv writes with %zu bytes palette stored\n", BENCH_OPS, sizeof(rgb_data_array_t));
+    printf("%-16s %15s %15s %12s %12s %12s\n", "instances", "palette copies", "copied bytes", "erases",
+           "hot gc", "cold gc");
+    churn_palette_copies("single", NULL);
+    churn_palette_copies("hot/cold", part_policy);
+    return 0;
+}
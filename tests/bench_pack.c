@@ -0,0 +1,78 @@
+/* Module is included, so benchmark reaches rle_pack() and rle_unpack() */
+#include "../modules/fs/fs.c"
+
+#include "cycles.h"
+#include "flash_emu.h"
+#include "../modules/color_types/color_types.h"
+
+#include <stdio.h>
+
+/*
+    Run-length codec on palettes saved by palette commands: compression ratio, host cycles
+    per unpacked byte and size of record written by fs_write() and fs_write_packed().
+*/
+
+#define BENCH_REPEATS 10000
+
+static const char *const color_names[COLORS_COUNT] = {"red", "green", "blue", "warm_white", "sunset_orange",
+                                                      "ocean", "purple", "mint", "pink", "lemon_yellow"};
+
+static void make_palette(rgb_data_array_t *p_palette, size_t count) {
+    memset(p_palette, 0, sizeof(rgb_data_array_t));
+    for (p_palette->count = 0; p_palette->count < count; p_palette->count++) {
+        rgb_data_with_name_t *p_color = &p_palette->colors_array[p_palette->count];
+        p_color->rgb = (rgb_data_t) {rand(), rand(), rand()};
+        strcpy(p_color->color_name, color_names[p_palette->count]);
+    }
+}
+
+static size_t record_size(fs_header_t *(*write)(char*, void*, size_t), rgb_data_array_t *p_palette) {
+    /* Name record is written once per page, only value record is counted */
+    fs_header_t *phead = write("rgb_array", p_palette, sizeof(rgb_data_array_t));
+    if (phead == NULL) {
+        fprintf(stderr, "bench_pack: rgb_array write failed\n");
+        exit(1);
+    }
+    return get_record_size(phead);
+}
+
+int main(void) {
+    static rgb_data_array_t palette, unpacked;
+    static uint8_t packed[FS_RECORD_MAX_LENGTH];
+    flash_emu_init();
+    fs_init();
+    srand(1);
+
+    printf("palette %zu bytes\n", sizeof(rgb_data_array_t));
+    printf("%-7s %7s %7s %13s %13s %12s %13s\n", "colors", "packed", "ratio", "pack/B", "unpack/B",
+           "record raw", "record packed");
+    for (size_t count = 0; count <= COLORS_COUNT; count++) {
+        make_palette(&palette, count);
+        size_t packed_length = 0;
+
+        uint64_t start = cycles_now();
+        for (uint32_t i = 0; i < BENCH_REPEATS; i++) {
+            packed_length = rle_pack((const uint8_t*) &palette, sizeof(palette), packed, sizeof(packed));
+            CYCLES_BARRIER();
+        }
+        uint64_t pack_cycles = cycles_now() - start;
+
+        start = cycles_now();
+        for (uint32_t i = 0; i < BENCH_REPEATS; i++) {
+            rle_unpack(packed, packed_length, (uint8_t*) &unpacked, sizeof(unpacked));
+            CYCLES_BARRIER();
+        }
+        uint64_t unpack_cycles = cycles_now() - start;
+        if (memcmp(&palette, &unpacked, sizeof(palette)) != 0) {
+            fprintf(stderr, "bench_pack: palette of %zu colors isn`t restored\n", count);
+            return 1;
+        }
+
+        printf("%-7zu %7zu %7.2f %7.2f %-5s %7.2f %-5s %12zu %13zu\n", count, packed_length,
+               (double) sizeof(palette) / packed_length,
+               (double) pack_cycles / BENCH_REPEATS / sizeof(palette), CYCLES_UNIT,
+               (double) unpack_cycles / BENCH_REPEATS / sizeof(palette), CYCLES_UNIT,
+               record_size(fs_write, &palette), record_size(fs_write_packed, &palette));
+    }
+    return 0;
+}
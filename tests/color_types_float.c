@@ -0,0 +1,17 @@
+/*
+    Float version of color_types.c under float_ names, it is linked next to fixed-point one
+    so tests and benchmarks compare them
+*/
+#define COLOR_TYPES_FIXED_POINT 0
+
+#define new_hsv float_new_hsv
+#define new_rgb float_new_rgb
+#define new_rgb_with_name float_new_rgb_with_name
+#define get_rgb_from_hsv float_get_rgb_from_hsv
+#define get_rgb16_from_hsv float_get_rgb16_from_hsv
+#define get_rgb16_from_rgb float_get_rgb16_from_rgb
+#define get_hsv_from_rgb float_get_hsv_from_rgb
+#define put_rgb_in_array float_put_rgb_in_array
+#define delete_color_from_array float_delete_color_from_array
+
+#include "../modules/color_types/color_types.c"
@@ -0,0 +1,13 @@
+#ifndef _COLOR_TYPES_FLOAT
+#define _COLOR_TYPES_FLOAT
+
+
+#include "../modules/color_types/color_types.h"
+
+
+/* Float conversions of color_types.c built with COLOR_TYPES_FIXED_POINT 0, see color_types_float.c */
+rgb_data_t float_get_rgb_from_hsv(const hsv_data_t* hsv_data);
+hsv_data_t float_get_hsv_from_rgb(const rgb_data_t* rgb_data);
+
+
+#endif
@@ -0,0 +1,37 @@
+#ifndef _CYCLES
+#define _CYCLES
+
+
+#include <stdint.h>
+#include <time.h>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+
+/*
+    Host cycle counter for micro-benchmarks: TSC on x86, nanoseconds elsewhere.
+    Numbers compare implementations on one host, they are not Cortex-M4 cycles.
+*/
+#if defined(__x86_64__) || defined(__i386__)
+#define CYCLES_UNIT "cycle"
+
+static inline uint64_t cycles_now(void) {
+    return __rdtsc();
+}
+#else
+#define CYCLES_UNIT "ns"
+
+static inline uint64_t cycles_now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+#endif
+
+/* Keeps compiler from dropping or merging benchmarked calls */
+#define CYCLES_BARRIER() __asm__ volatile("" ::: "memory")
+
+
+#endif
@@ -0,0 +1,249 @@
+#include "flash_emu.h"
+
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
+#include "nrf_soc.h"
+#include "app_timer.h"
+#include "sdk_config.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+
+#define FLASH_EMU_PAGES ((FLASH_EMU_END - FLASH_EMU_START) / CODE_PAGE_SIZE)
+#define FLASH_EMU_WORDS ((FLASH_EMU_END - FLASH_EMU_START) / sizeof(uint32_t))
+
+nrf_fstorage_api_t nrf_fstorage_sd;
+
+typedef struct {
+    nrf_fstorage_t const *p_fs;
+    bool erase;
+    uint32_t addr;
+    void const *p_src;
+    uint32_t len;
+    void *p_param;
+} flash_emu_op_t;
+
+static struct {
+    bool mapped;
+    uint64_t time_us;
+    uint64_t head_finish_us;    // Completion time of first queued operation
+    flash_emu_op_t ops[NRF_FSTORAGE_SD_QUEUE_SIZE];
+    uint32_t head;
+    uint32_t count;
+    uint8_t word_writes[FLASH_EMU_WORDS];
+    uint32_t page_erases[FLASH_EMU_PAGES];
+    flash_emu_stats_t stats;
+} emu_s;
+
+static void fail(const char *msg, uint32_t addr) {
+    fprintf(stderr, "flash_emu: %s at 0x%X\n", msg, (unsigned) addr);
+    abort();
+}
+
+static uint32_t op_duration_us(const flash_emu_op_t *op) {
+    return op->erase ? FLASH_EMU_ERASE_PAGE_US * op->len : FLASH_EMU_WRITE_WORD_US * (op->len / sizeof(uint32_t));
+}
+
+/*
+    Operations impl
+*/
+
+static void op_execute(const flash_emu_op_t *op) {
+    if (op->erase) {
+        for (uint32_t page = 0; page < op->len; page++) {
+            uint32_t page_addr = op->addr + page * CODE_PAGE_SIZE;
+            memset((void*) (uintptr_t) page_addr, 0xFF, CODE_PAGE_SIZE);
+            memset(&emu_s.word_writes[(page_addr - FLASH_EMU_START) / sizeof(uint32_t)], 0, CODE_PAGE_SIZE / sizeof(uint32_t));
+            emu_s.page_erases[(page_addr - FLASH_EMU_START) / CODE_PAGE_SIZE]++;
+        }
+        emu_s.stats.erases += op->len;
+        return;
+    }
+
+    uint32_t *dest = (uint32_t*) (uintptr_t) op->addr;
+    const uint32_t *src = op->p_src;
+    for (uint32_t i = 0; i < op->len / sizeof(uint32_t); i++) {
+        uint32_t addr = op->addr + i * sizeof(uint32_t);
+        if ((~dest[i] & src[i]) != 0) {
+            fail("Write sets cleared bits", addr);
+        }
+        if (++emu_s.word_writes[(addr - FLASH_EMU_START) / sizeof(uint32_t)] > FLASH_EMU_WORD_WRITES) {
+            fail("Word is written more than FLASH_EMU_WORD_WRITES times", addr);
+        }
+        dest[i] &= src[i];
+    }
+    emu_s.stats.writes++;
+    emu_s.stats.bytes_written += op->len;
+}
+
+static void op_complete() {
+    /* Queue slot is free before event, handler can start next operation */
+    flash_emu_op_t op = emu_s.ops[emu_s.head];
+    emu_s.head = (emu_s.head + 1) % NRF_FSTORAGE_SD_QUEUE_SIZE;
+    emu_s.count--;
+    op_execute(&op);
+    emu_s.stats.busy_us += op_duration_us(&op);
+    if (emu_s.count > 0) {
+        emu_s.head_finish_us = emu_s.time_us + op_duration_us(&emu_s.ops[emu_s.head]);
+    }
+
+    nrf_fstorage_evt_t evt = {
+        .id = op.erase ? NRF_FSTORAGE_EVT_ERASE_RESULT : NRF_FSTORAGE_EVT_WRITE_RESULT,
+        .result = NRF_SUCCESS,
+        .addr = op.addr,
+        .p_src = op.p_src,
+        .len = op.len,
+        .p_param = op.p_param
+    };
+    if (op.p_fs->evt_handler != NULL) {
+        op.p_fs->evt_handler(&evt);
+    }
+}
+
+static ret_code_t op_push(const flash_emu_op_t *op) {
+    if (emu_s.count == NRF_FSTORAGE_SD_QUEUE_SIZE) {
+        return NRF_ERROR_NO_MEM;
+    }
+    emu_s.ops[(emu_s.head + emu_s.count) % NRF_FSTORAGE_SD_QUEUE_SIZE] = *op;
+    if (emu_s.count++ == 0) {
+        emu_s.head_finish_us = emu_s.time_us + op_duration_us(op);
+    }
+    return NRF_SUCCESS;
+}
+
+static bool is_in_bounds(nrf_fstorage_t const *p_fs, uint32_t addr, uint32_t len) {
+    return addr >= p_fs->start_addr && addr + len <= p_fs->end_addr &&
+           addr >= FLASH_EMU_START && addr + len <= FLASH_EMU_END;
+}
+
+/*
+    fstorage impl
+*/
+
+ret_code_t nrf_fstorage_init(nrf_fstorage_t *p_fs, nrf_fstorage_api_t *p_api, void *p_param) {
+    if (p_fs->start_addr % CODE_PAGE_SIZE != 0 || p_fs->end_addr % CODE_PAGE_SIZE != 0) {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+    p_fs->p_api = p_api;
+    return NRF_SUCCESS;
+}
+
+ret_code_t nrf_fstorage_write(nrf_fstorage_t const *p_fs, uint32_t dest, void const *p_src, uint32_t len, void *p_param) {
+    if (p_fs->p_api == NULL) {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if (dest % sizeof(uint32_t) != 0 || (uintptr_t) p_src % sizeof(uint32_t) != 0 || !is_in_bounds(p_fs, dest, len)) {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+    if (len == 0 || len % sizeof(uint32_t) != 0) {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    flash_emu_op_t op = {p_fs, false, dest, p_src, len, p_param};
+    return op_push(&op);
+}
+
+ret_code_t nrf_fstorage_erase(nrf_fstorage_t const *p_fs, uint32_t page_addr, uint32_t len, void *p_param) {
+    if (p_fs->p_api == NULL) {
+        return NRF_ERROR_INVALID_STATE;
+    }
+    if (page_addr % CODE_PAGE_SIZE != 0 || !is_in_bounds(p_fs, page_addr, len * CODE_PAGE_SIZE)) {
+        return NRF_ERROR_INVALID_ADDR;
+    }
+    if (len == 0) {
+        return NRF_ERROR_INVALID_LENGTH;
+    }
+    flash_emu_op_t op = {p_fs, true, page_addr, NULL, len, p_param};
+    return op_push(&op);
+}
+
+bool nrf_fstorage_is_busy(nrf_fstorage_t const *p_fs) {
+    /* SoftDevice backend tells about any operation, not only of the instance */
+    return emu_s.count > 0;
+}
+
+uint32_t sd_app_evt_wait(void) {
+    if (!flash_emu_step()) {
+        flash_emu_advance(FLASH_EMU_IDLE_WAKEUP_US);
+    }
+    return NRF_SUCCESS;
+}
+
+uint32_t app_timer_cnt_get(void) {
+    return (uint32_t) (emu_s.time_us * APP_TIMER_TICKS(1000) / 1000000) & APP_TIMER_MAX_CNT_VAL;
+}
+
+/*
+    Emulator control impl
+*/
+
+void flash_emu_init(void) {
+    if (!emu_s.mapped) {
+        void *p = mmap((void*) (uintptr_t) FLASH_EMU_START, FLASH_EMU_END - FLASH_EMU_START, PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0);
+        if (p != (void*) (uintptr_t) FLASH_EMU_START) {
+            perror("flash_emu: mmap");
+            abort();
+        }
+        emu_s.mapped = true;
+    }
+    memset((void*) (uintptr_t) FLASH_EMU_START, 0xFF, FLASH_EMU_END - FLASH_EMU_START);
+    memset(emu_s.word_writes, 0, sizeof(emu_s.word_writes));
+    memset(emu_s.page_erases, 0, sizeof(emu_s.page_erases));
+    memset(&emu_s.stats, 0, sizeof(emu_s.stats));
+    emu_s.time_us = 0;
+    emu_s.head = 0;
+    emu_s.count = 0;
+}
+
+void flash_emu_power_cut(void) {
+    emu_s.head = 0;
+    emu_s.count = 0;
+}
+
+void flash_emu_power_cut_during(uint32_t words) {
+    if (emu_s.count > 0 && !emu_s.ops[emu_s.head].erase) {
+        flash_emu_op_t op = emu_s.ops[emu_s.head];
+        op.len = words * sizeof(uint32_t) < op.len ? words * sizeof(uint32_t) : op.len;
+        op_execute(&op);
+    }
+    flash_emu_power_cut();
+}
+
+void flash_emu_advance(uint32_t us) {
+    uint64_t end_us = emu_s.time_us + us;
+    while (emu_s.count > 0 && emu_s.head_finish_us <= end_us) {
+        emu_s.time_us = emu_s.head_finish_us;
+        op_complete();
+    }
+    emu_s.time_us = end_us;
+}
+
+bool flash_emu_step(void) {
+    if (emu_s.count == 0) {
+        return false;
+    }
+    emu_s.time_us = emu_s.head_finish_us;
+    op_complete();
+    return true;
+}
+
+uint64_t flash_emu_time_us(void) {
+    return emu_s.time_us;
+}
+
+uint32_t flash_emu_queue_count(void) {
+    return emu_s.count;
+}
+
+const flash_emu_stats_t *flash_emu_get_stats(void) {
+    return &emu_s.stats;
+}
+
+uint32_t flash_emu_page_erases(uintptr_t page_addr) {
+    if (page_addr < FLASH_EMU_START || page_addr >= FLASH_EMU_END) {
+        return 0;
+    }
+    return emu_s.page_erases[(page_addr - FLASH_EMU_START) / CODE_PAGE_SIZE];
+}
@@ -0,0 +1,58 @@
+#ifndef _FLASH_EMU
+#define _FLASH_EMU
+
+
+#include "fs_partition.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+    nrf_fstorage over RAM mapped at flash addresses of log and fs partitions, so modules read
+    records by the same pointers as on device. Operations are checked against nRF52840 NOR rules:
+    word alignment, bits only go from 1 to 0, page erase and at most FLASH_EMU_WORD_WRITES
+    writes of word between erases. Violation stops test.
+
+    Operations are queued like by SoftDevice backend: the queue of NRF_FSTORAGE_SD_QUEUE_SIZE
+    slots is shared by every fstorage instance, NRF_ERROR_NO_MEM is returned when it is full.
+    Operations are executed one by one, each takes time of nRF52840 flash, events are delivered
+    when emulated time passes their completion.
+*/
+
+#define FLASH_EMU_START FS_LOG_START
+#define FLASH_EMU_END FS_PARTITION_END
+
+/* nRF52840 product specification, maximum values */
+#define FLASH_EMU_WRITE_WORD_US 41
+#define FLASH_EMU_ERASE_PAGE_US 85000
+#define FLASH_EMU_WORD_WRITES 2
+/* Time passed by sd_app_evt_wait() without flash operations, like wakeup by app_timer */
+#define FLASH_EMU_IDLE_WAKEUP_US 1000
+
+typedef struct {
+    uint32_t writes;
+    uint32_t bytes_written;
+    uint32_t erases;
+    uint64_t busy_us;       // Time flash was executing operations
+} flash_emu_stats_t;
+
+
+/* Erases flash, clears queue, statistics and time */
+void flash_emu_init(void);
+/* Drops queued operations like reset does, flash keeps written data */
+void flash_emu_power_cut(void);
+/* Reset in the middle of first queued write, only its first words are written */
+void flash_emu_power_cut_during(uint32_t words);
+/* Time goes on, operations finished by then are completed and their events are delivered */
+void flash_emu_advance(uint32_t us);
+/* Waits for completion of next operation, returns false if queue is empty */
+bool flash_emu_step(void);
+uint64_t flash_emu_time_us(void);
+uint32_t flash_emu_queue_count(void);
+const flash_emu_stats_t *flash_emu_get_stats(void);
+/* Erases of page since init */
+uint32_t flash_emu_page_erases(uintptr_t page_addr);
+
+
+#endif
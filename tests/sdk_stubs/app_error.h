@@ -0,0 +1,26 @@
+#ifndef _APP_ERROR_STUB
+#define _APP_ERROR_STUB
+
+
+#include "sdk_errors.h"
+#include "nrf_assert.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/* Error handler of firmware resets device, host build stops test */
+#define APP_ERROR_HANDLER(err_code) do { \
+        fprintf(stderr, "%s:%d: APP_ERROR 0x%X\n", __FILE__, __LINE__, (unsigned) (err_code)); \
+        abort(); \
+    } while (0)
+
+#define APP_ERROR_CHECK(err_code) do { \
+        ret_code_t local_err_code = (err_code); \
+        if (local_err_code != NRF_SUCCESS) { \
+            APP_ERROR_HANDLER(local_err_code); \
+        } \
+    } while (0)
+
+
+#endif
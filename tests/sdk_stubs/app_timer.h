@@ -0,0 +1,64 @@
+#ifndef _APP_TIMER_STUB
+#define _APP_TIMER_STUB
+
+
+#include "app_util.h"
+#include "nordic_common.h"
+#include "sdk_config.h"
+#include "sdk_errors.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* RTC counter of firmware, it follows time of emulated flash, see flash_emu.h */
+#define APP_TIMER_CLOCK_FREQ 32768
+#define APP_TIMER_MAX_CNT_VAL 0x00FFFFFF
+#define APP_TIMER_TICKS(ms) ((uint32_t) ROUNDED_DIV((ms) * (uint64_t) APP_TIMER_CLOCK_FREQ, \
+                                                    1000 * (APP_TIMER_CONFIG_RTC_FREQUENCY + 1)))
+
+uint32_t app_timer_cnt_get(void);
+
+static inline uint32_t app_timer_cnt_diff_compute(uint32_t ticks_to, uint32_t ticks_from) {
+    return (ticks_to - ticks_from) & APP_TIMER_MAX_CNT_VAL;
+}
+
+/* Timers don`t run on host. Timer keeps its handler and timeout of last start, test calls handler. */
+typedef void (*app_timer_timeout_handler_t)(void *p_context);
+
+typedef enum {
+    APP_TIMER_MODE_SINGLE_SHOT,
+    APP_TIMER_MODE_REPEATED
+} app_timer_mode_t;
+
+typedef struct {
+    app_timer_timeout_handler_t handler;
+    uint32_t timeout_ticks;
+    bool started;
+} app_timer_t;
+
+typedef app_timer_t *app_timer_id_t;
+
+#define APP_TIMER_DEF(timer_id)                                     \
+    static app_timer_t CONCAT_2(timer_id, _data);                   \
+    static const app_timer_id_t timer_id = &CONCAT_2(timer_id, _data)
+
+static inline ret_code_t app_timer_create(app_timer_id_t const *p_timer_id, app_timer_mode_t mode,
+                                          app_timer_timeout_handler_t timeout_handler) {
+    (*p_timer_id)->handler = timeout_handler;
+    return NRF_SUCCESS;
+}
+
+static inline ret_code_t app_timer_start(app_timer_id_t timer_id, uint32_t timeout_ticks, void *p_context) {
+    timer_id->timeout_ticks = timeout_ticks;
+    timer_id->started = true;
+    return NRF_SUCCESS;
+}
+
+static inline ret_code_t app_timer_stop(app_timer_id_t timer_id) {
+    timer_id->started = false;
+    return NRF_SUCCESS;
+}
+
+
+#endif
@@ -0,0 +1,23 @@
+#ifndef _APP_UTIL_STUB
+#define _APP_UTIL_STUB
+
+
+#include <stdint.h>
+
+
+#define STATIC_ASSERT(expr, ...) _Static_assert(expr, #expr)
+#define UNUSED_PARAMETER(x) ((void) (x))
+#define UNUSED_VARIABLE(x) ((void) (x))
+#define CEIL_DIV(a, b) ((((a) - 1) / (b)) + 1)
+#define ROUNDED_DIV(a, b) (((a) + ((b) / 2)) / (b))
+#define ALIGN_NUM(alignment, number) (((number) - 1) + (alignment) - (((number) - 1) % (alignment)))
+#define ARRAY_SIZE(arr) (sizeof(arr) / sizeof((arr)[0]))
+#ifndef MIN
+#define MIN(a, b) ((a) < (b) ? (a) : (b))
+#endif
+#ifndef MAX
+#define MAX(a, b) ((a) < (b) ? (b) : (a))
+#endif
+
+
+#endif
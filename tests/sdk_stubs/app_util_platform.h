@@ -0,0 +1,10 @@
+#ifndef _APP_UTIL_PLATFORM_STUB
+#define _APP_UTIL_PLATFORM_STUB
+
+
+/* Host build is single threaded, flash events are delivered from sd_app_evt_wait() */
+#define CRITICAL_REGION_ENTER() {
+#define CRITICAL_REGION_EXIT() }
+
+
+#endif
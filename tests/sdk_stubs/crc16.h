@@ -0,0 +1,23 @@
+#ifndef _CRC16_STUB
+#define _CRC16_STUB
+
+
+#include <stddef.h>
+#include <stdint.h>
+
+
+/* CRC-16-CCITT of nRF5 SDK */
+static inline uint16_t crc16_compute(uint8_t const *p_data, uint32_t size, uint16_t const *p_crc) {
+    uint16_t crc = (p_crc == NULL) ? 0xFFFF : *p_crc;
+    for (uint32_t i = 0; i < size; i++) {
+        crc = (uint8_t) (crc >> 8) | (crc << 8);
+        crc ^= p_data[i];
+        crc ^= (uint8_t) (crc & 0xFF) >> 4;
+        crc ^= (crc << 8) << 4;
+        crc ^= ((crc & 0xFF) << 4) << 1;
+    }
+    return crc;
+}
+
+
+#endif
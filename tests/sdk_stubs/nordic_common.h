@@ -0,0 +1,13 @@
+#ifndef _NORDIC_COMMON_STUB
+#define _NORDIC_COMMON_STUB
+
+
+#include "app_util.h"
+
+#define CONCAT_2_(p1, p2) p1##p2
+#define CONCAT_2(p1, p2) CONCAT_2_(p1, p2)
+#define STRINGIFY_(val) #val
+#define STRINGIFY(val) STRINGIFY_(val)
+
+
+#endif
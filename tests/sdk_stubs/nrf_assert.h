@@ -0,0 +1,17 @@
+#ifndef _NRF_ASSERT_STUB
+#define _NRF_ASSERT_STUB
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+#define ASSERT(expr) do { \
+        if (!(expr)) { \
+            fprintf(stderr, "%s:%d: ASSERT %s\n", __FILE__, __LINE__, #expr); \
+            abort(); \
+        } \
+    } while (0)
+
+
+#endif
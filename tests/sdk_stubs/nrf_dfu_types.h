@@ -0,0 +1,16 @@
+#ifndef _NRF_DFU_TYPES_STUB
+#define _NRF_DFU_TYPES_STUB
+
+
+#include "app_util.h"
+#include "sdk_config.h"
+
+
+/* nRF52840 values */
+#define CODE_PAGE_SIZE 4096
+#ifndef NRF_DFU_APP_DATA_AREA_SIZE
+#define NRF_DFU_APP_DATA_AREA_SIZE 12288
+#endif
+
+
+#endif
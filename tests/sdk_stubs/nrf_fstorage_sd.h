@@ -0,0 +1,12 @@
+#ifndef _NRF_FSTORAGE_SD_STUB
+#define _NRF_FSTORAGE_SD_STUB
+
+
+#include "nrf_fstorage.h"
+
+
+/* Backend is emulated by flash_emu.c */
+extern nrf_fstorage_api_t nrf_fstorage_sd;
+
+
+#endif
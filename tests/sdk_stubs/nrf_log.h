@@ -0,0 +1,19 @@
+#ifndef _NRF_LOG_STUB
+#define _NRF_LOG_STUB
+
+
+/*
+    Errors and warnings are always printed, info is printed when nrf_log_verbose is set.
+    Like nrf_log, arguments are not checked against format.
+*/
+extern int nrf_log_verbose;
+
+void nrf_log_printf(int level, const char *format, ...);
+
+#define NRF_LOG_ERROR(...) nrf_log_printf(0, __VA_ARGS__)
+#define NRF_LOG_WARNING(...) nrf_log_printf(1, __VA_ARGS__)
+#define NRF_LOG_INFO(...) nrf_log_printf(2, __VA_ARGS__)
+#define NRF_LOG_DEBUG(...) nrf_log_printf(3, __VA_ARGS__)
+
+
+#endif
@@ -0,0 +1,39 @@
+#ifndef _NRF_PWR_MGMT_STUB
+#define _NRF_PWR_MGMT_STUB
+
+
+#include "nordic_common.h"
+
+#include <stdbool.h>
+
+
+typedef enum {
+    NRF_PWR_MGMT_EVT_PREPARE_WAKEUP,
+    NRF_PWR_MGMT_EVT_PREPARE_SYSOFF,
+    NRF_PWR_MGMT_EVT_PREPARE_DFU,
+    NRF_PWR_MGMT_EVT_PREPARE_RESET
+} nrf_pwr_mgmt_evt_t;
+
+typedef enum {
+    NRF_PWR_MGMT_SHUTDOWN_GOTO_SYSOFF,
+    NRF_PWR_MGMT_SHUTDOWN_STAY_IN_SYSOFF,
+    NRF_PWR_MGMT_SHUTDOWN_GOTO_DFU,
+    NRF_PWR_MGMT_SHUTDOWN_RESET,
+    NRF_PWR_MGMT_SHUTDOWN_CONTINUE
+} nrf_pwr_mgmt_shutdown_t;
+
+typedef bool (*nrf_pwr_mgmt_shutdown_handler_t)(nrf_pwr_mgmt_evt_t event);
+
+/* Registered handlers are called by nrf_pwr_mgmt_shutdown() until every one returns true */
+#define NRF_PWR_MGMT_HANDLER_REGISTER(handler, priority) \
+    static void __attribute__((constructor)) CONCAT_2(handler, _register)(void) { \
+        nrf_pwr_mgmt_handler_register(handler); \
+    }
+
+void nrf_pwr_mgmt_handler_register(nrf_pwr_mgmt_shutdown_handler_t handler);
+void nrf_pwr_mgmt_shutdown(nrf_pwr_mgmt_shutdown_t shutdown_type);
+/* Number of completed shutdowns */
+unsigned nrf_pwr_mgmt_shutdown_count(void);
+
+
+#endif
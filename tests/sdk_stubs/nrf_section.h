@@ -0,0 +1,21 @@
+#ifndef _NRF_SECTION_STUB
+#define _NRF_SECTION_STUB
+
+
+#include <stddef.h>
+
+
+/* Section name without dot, so GNU ld defines __start_ and __stop_ symbols of it */
+#define NRF_SECTION_DEF(section_name, data_type) \
+    extern data_type __start_##section_name[]; \
+    extern data_type __stop_##section_name[]
+
+/* Alignment is given, so compiler doesn`t align items beyond their type and they are packed like an array */
+#define NRF_SECTION_ITEM_REGISTER(section_name, section_var) \
+    section_var __attribute__((section(#section_name), used, aligned(sizeof(void*))))
+
+#define NRF_SECTION_ITEM_COUNT(section_name, data_type) ((size_t) (__stop_##section_name - __start_##section_name))
+#define NRF_SECTION_ITEM_GET(section_name, data_type, i) (&__start_##section_name[i])
+
+
+#endif
@@ -0,0 +1,12 @@
+#ifndef _NRF_SOC_STUB
+#define _NRF_SOC_STUB
+
+
+#include <stdint.h>
+
+
+/* Completes next emulated flash operation, see flash_emu.h */
+uint32_t sd_app_evt_wait(void);
+
+
+#endif
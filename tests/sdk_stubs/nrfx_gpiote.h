@@ -0,0 +1,44 @@
+#ifndef _NRFX_GPIOTE_STUB
+#define _NRFX_GPIOTE_STUB
+
+
+#include "nrf_gpio.h"
+#include "sdk_errors.h"
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/* GPIOTE driver doesn`t run on host, test calls pin handler of module */
+
+typedef uint32_t nrfx_gpiote_pin_t;
+
+typedef enum {
+    NRF_GPIOTE_POLARITY_LOTOHI = 1,
+    NRF_GPIOTE_POLARITY_HITOLO,
+    NRF_GPIOTE_POLARITY_TOGGLE
+} nrf_gpiote_polarity_t;
+
+typedef struct {
+    nrf_gpiote_polarity_t sense;
+    nrf_gpio_pin_pull_t pull;
+    bool is_watcher;
+    bool hi_accuracy;
+    bool skip_gpio_setup;
+} nrfx_gpiote_in_config_t;
+
+#define NRFX_GPIOTE_CONFIG_IN_SENSE_TOGGLE(hi_accu) \
+    {.sense = NRF_GPIOTE_POLARITY_TOGGLE, .pull = NRF_GPIO_PIN_NOPULL, .hi_accuracy = (hi_accu)}
+
+typedef void (*nrfx_gpiote_evt_handler_t)(nrfx_gpiote_pin_t pin, nrf_gpiote_polarity_t action);
+
+static inline ret_code_t nrfx_gpiote_in_init(nrfx_gpiote_pin_t pin, nrfx_gpiote_in_config_t const *p_config,
+                                             nrfx_gpiote_evt_handler_t evt_handler) {
+    return NRF_SUCCESS;
+}
+
+static inline void nrfx_gpiote_in_event_enable(nrfx_gpiote_pin_t pin, bool int_enable) {
+}
+
+
+#endif
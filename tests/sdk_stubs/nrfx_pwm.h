@@ -0,0 +1,84 @@
+#ifndef _NRFX_PWM_STUB
+#define _NRFX_PWM_STUB
+
+
+#include <stdbool.h>
+#include <stdint.h>
+
+
+/*
+    PWM driver doesn`t run on host. Configuration of last nrfx_pwm_init() is kept in
+    nrfx_pwm_config, compare values are read from played sequence.
+*/
+
+typedef struct {
+    uint8_t drv_inst_idx;
+} nrfx_pwm_t;
+
+#define NRFX_PWM_INSTANCE(id) {.drv_inst_idx = (id)}
+
+typedef enum {
+    NRF_PWM_CLK_16MHz,
+    NRF_PWM_CLK_8MHz,
+    NRF_PWM_CLK_4MHz,
+    NRF_PWM_CLK_2MHz,
+    NRF_PWM_CLK_1MHz,
+    NRF_PWM_CLK_500kHz,
+    NRF_PWM_CLK_250kHz,
+    NRF_PWM_CLK_125kHz
+} nrf_pwm_clk_t;
+
+typedef enum {
+    NRF_PWM_LOAD_COMMON,
+    NRF_PWM_LOAD_GROUPED,
+    NRF_PWM_LOAD_INDIVIDUAL,
+    NRF_PWM_LOAD_WAVE_FORM
+} nrf_pwm_dec_load_t;
+
+typedef struct {
+    uint16_t channel_0;
+    uint16_t channel_1;
+    uint16_t channel_2;
+    uint16_t channel_3;
+} nrf_pwm_values_individual_t;
+
+typedef struct {
+    union {
+        nrf_pwm_values_individual_t const *p_individual;
+        uint16_t const *p_raw;
+    } values;
+    uint16_t length;
+    uint32_t repeats;
+    uint32_t end_delay;
+} nrf_pwm_sequence_t;
+
+#define NRF_PWM_VALUES_LENGTH(array) (sizeof(array) / sizeof(uint16_t))
+
+typedef struct {
+    uint8_t output_pins[4];
+    nrf_pwm_clk_t base_clock;
+    uint16_t top_value;
+    nrf_pwm_dec_load_t load_mode;
+} nrfx_pwm_config_t;
+
+#define NRFX_PWM_DEFAULT_CONFIG {.base_clock = NRF_PWM_CLK_1MHz, .top_value = 1000, .load_mode = NRF_PWM_LOAD_COMMON}
+
+#define NRFX_PWM_FLAG_LOOP 0x01
+
+typedef void (*nrfx_pwm_handler_t)(int event_type);
+
+extern nrfx_pwm_config_t nrfx_pwm_config;
+
+static inline uint32_t nrfx_pwm_init(nrfx_pwm_t const *p_instance, nrfx_pwm_config_t const *p_config,
+                                     nrfx_pwm_handler_t handler) {
+    nrfx_pwm_config = *p_config;
+    return 0;
+}
+
+static inline uint32_t nrfx_pwm_simple_playback(nrfx_pwm_t const *p_instance, nrf_pwm_sequence_t const *p_sequence,
+                                                uint16_t playback_count, uint32_t flags) {
+    return 0;
+}
+
+
+#endif
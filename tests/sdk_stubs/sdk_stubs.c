@@ -0,0 +1,77 @@
+#include "nrf_log.h"
+#include "nrf_pwr_mgmt.h"
+#include "nrfx_pwm.h"
+
+#include <stdarg.h>
+#include <stddef.h>
+#include <stdio.h>
+
+#define PWR_MGMT_HANDLERS_MAX 8
+
+int nrf_log_verbose;
+nrfx_pwm_config_t nrfx_pwm_config;
+
+void nrf_log_printf(int level, const char *format, ...) {
+    static const char *const levels[] = {"error", "warning", "info", "debug"};
+    if (level > 1 && level > nrf_log_verbose + 1) {
+        return;
+    }
+    FILE *out = level <= 1 ? stderr : stdout;
+    va_list args;
+    va_start(args, format);
+    fprintf(out, "<%s> ", levels[level]);
+    vfprintf(out, format, args);
+    fputc('\n', out);
+    va_end(args);
+}
+
+/*
+    Power management impl
+    Shutdown goes on when every handler returned true or called nrf_pwr_mgmt_shutdown(NRF_PWR_MGMT_SHUTDOWN_CONTINUE).
+*/
+
+static struct {
+    nrf_pwr_mgmt_shutdown_handler_t handlers[PWR_MGMT_HANDLERS_MAX];
+    size_t count;
+    bool started;
+    nrf_pwr_mgmt_evt_t evt;
+    unsigned completed;
+} pwr_mgmt_s;
+
+void nrf_pwr_mgmt_handler_register(nrf_pwr_mgmt_shutdown_handler_t handler) {
+    if (pwr_mgmt_s.count < PWR_MGMT_HANDLERS_MAX) {
+        pwr_mgmt_s.handlers[pwr_mgmt_s.count++] = handler;
+    }
+}
+
+void nrf_pwr_mgmt_shutdown(nrf_pwr_mgmt_shutdown_t shutdown_type) {
+    if (shutdown_type != NRF_PWR_MGMT_SHUTDOWN_CONTINUE) {
+        if (pwr_mgmt_s.started) {
+            return;
+        }
+        static const nrf_pwr_mgmt_evt_t evts[] = {
+            [NRF_PWR_MGMT_SHUTDOWN_GOTO_SYSOFF] = NRF_PWR_MGMT_EVT_PREPARE_WAKEUP,
+            [NRF_PWR_MGMT_SHUTDOWN_STAY_IN_SYSOFF] = NRF_PWR_MGMT_EVT_PREPARE_SYSOFF,
+            [NRF_PWR_MGMT_SHUTDOWN_GOTO_DFU] = NRF_PWR_MGMT_EVT_PREPARE_DFU,
+            [NRF_PWR_MGMT_SHUTDOWN_RESET] = NRF_PWR_MGMT_EVT_PREPARE_RESET
+        };
+        pwr_mgmt_s.started = true;
+        pwr_mgmt_s.evt = evts[shutdown_type];
+    }
+    else if (!pwr_mgmt_s.started) {
+        return;
+    }
+
+    for (size_t i = 0; i < pwr_mgmt_s.count; i++) {
+        if (!pwr_mgmt_s.handlers[i](pwr_mgmt_s.evt)) {
+            return;
+        }
+    }
+    /* Device is reset here, host build only counts it */
+    pwr_mgmt_s.started = false;
+    pwr_mgmt_s.completed++;
+}
+
+unsigned nrf_pwr_mgmt_shutdown_count(void) {
+    return pwr_mgmt_s.completed;
+}
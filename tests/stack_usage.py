@@ -0,0 +1,95 @@
+#!/usr/bin/env python3
+"""
+Worst case stack use of call chains from gcc -fstack-usage -fcallgraph-info=su output.
+
+Frame of every function is taken from .ci files, chain depth is the sum of frames from
+entry function to the deepest callee. Functions outside of given files (libc, SDK) are
+counted with 0 bytes and listed. Indirect calls are resolved to --indirect functions.
+Recursion is reported as error, its depth can`t be bounded.
+"""
+
+import argparse
+import re
+import sys
+
+NODE_RE = re.compile(r'node: \{ title: "([^"]+)" label: "([^"]*)"')
+EDGE_RE = re.compile(r'edge: \{ sourcename: "([^"]+)" targetname: "([^"]+)"')
+SIZE_RE = re.compile(r'\\n(\d+) bytes \((static|dynamic[^)]*)\)')
+INDIRECT = '__indirect_call'
+
+
+def short_name(title):
+    return title.rsplit(':', 1)[-1]
+
+
+def load(files):
+    frames = {}
+    dynamic = set()
+    calls = {}
+    for path in files:
+        with open(path) as f:
+            for line in f:
+                node = NODE_RE.match(line)
+                if node:
+                    name = short_name(node.group(1))
+                    size = SIZE_RE.search(node.group(2))
+                    if size:
+                        frames[name] = int(size.group(1))
+                        if size.group(2) != 'static':
+                            dynamic.add(name)
+                    calls.setdefault(name, set())
+                    continue
+                edge = EDGE_RE.match(line)
+                if edge:
+                    calls.setdefault(short_name(edge.group(1)), set()).add(short_name(edge.group(2)))
+    return frames, dynamic, calls
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.strip().splitlines()[0])
+    parser.add_argument('ci_files', nargs='+')
+    parser.add_argument('--entry', default='fs_', help='prefix of entry functions')
+    parser.add_argument('--indirect', default='', help='comma separated targets of indirect calls')
+    parser.add_argument('--limit', type=int, help='fail if worst chain is deeper')
+    args = parser.parse_args()
+
+    frames, dynamic, calls = load(args.ci_files)
+    calls[INDIRECT] = set(filter(None, args.indirect.split(',')))
+    externals = sorted(name for name in calls if name not in frames and name != INDIRECT)
+
+    depths = {}
+
+    def depth(name, stack):
+        if name in stack:
+            sys.exit('stack_usage: recursion ' + ' -> '.join(stack + [name]))
+        if name not in depths:
+            deepest = (0, [])
+            for callee in calls.get(name, ()):
+                callee_depth = depth(callee, stack + [name])
+                if callee_depth[0] > deepest[0]:
+                    deepest = callee_depth
+            depths[name] = (frames.get(name, 0) + deepest[0], [name] + deepest[1])
+        return depths[name]
+
+    entries = sorted(name for name in frames if name.startswith(args.entry))
+    for name in entries:
+        depth(name, [])
+    entries.sort(key=lambda name: -depths[name][0])
+
+    for name in entries:
+        print('%6d  %s' % (depths[name][0], name))
+    worst = entries[0]
+    print('\nWorst chain, %d bytes:' % depths[worst][0])
+    for name in depths[worst][1]:
+        if name != INDIRECT:
+            print('%6d  %s' % (frames.get(name, 0), name))
+    if dynamic:
+        print('\nDynamic frames: ' + ', '.join(sorted(dynamic)))
+    print('\nNot counted: ' + ', '.join(externals))
+
+    if args.limit is not None and depths[worst][0] > args.limit:
+        sys.exit('stack_usage: %s takes %d bytes, limit is %d' % (worst, depths[worst][0], args.limit))
+
+
+if __name__ == '__main__':
+    main()
@@ -0,0 +1,23 @@
+#ifndef _TEST
+#define _TEST
+
+
+#include <stdio.h>
+#include <stdlib.h>
+
+
+/* Host tests stop at first failed check, state of module after it is undefined */
+#define CHECK(cond) do {                                                            \
+        if (!(cond)) {                                                              \
+            fprintf(stderr, "%s:%d: CHECK(%s) failed\n", __FILE__, __LINE__, #cond); \
+            exit(1);                                                                \
+        }                                                                           \
+    } while (0)
+
+#define RUN_TEST(test) do {             \
+        test();                         \
+        printf("  %s ok\n", #test);     \
+    } while (0)
+
+
+#endif
@@ -0,0 +1,107 @@
+#include "../modules/color_types/color_types.h"
+#include "color_types_float.h"
+#include "test.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+/*
+    Every RGB and HSV input is converted and compared with exact result computed in double:
+    RGB components are floors and HSV components are ceilings of formula values.
+    Float version may differ from it by one where float rounding crosses an integer.
+*/
+
+#define RGB_INPUTS_COUNT (1u << 24)
+
+static hsv_data_t get_exact_hsv(const rgb_data_t *rgb) {
+    double r = rgb->r, g = rgb->g, b = rgb->b;
+    double max = fmax(fmax(r, g), b);
+    double delta = max - fmin(fmin(r, g), b);
+    double h = 0;
+    if (delta > 0) {
+        if (b == max) {
+            h = 60 * ((r - g) / delta + 4);
+        }
+        else if (r == max) {
+            h = 60 * (g - b) / delta + (g < b ? 360 : 0);
+        }
+        else {
+            h = 60 * ((b - r) / delta + 2);
+        }
+    }
+    // Exact ratios are computed with rounding error, it must not lift them to next integer
+    return new_hsv((int) ceil(h - 1e-9) % 360, max == 0 ? 0 : (int) ceil(delta / max * 100 - 1e-9),
+                   (int) ceil(max / 255 * 100 - 1e-9));
+}
+
+static rgb_data_t get_exact_rgb(const hsv_data_t *hsv) {
+    double c = hsv->v * hsv->s / 10000.0;
+    double x = c * (1 - fabs(fmod(hsv->h / 60.0, 2) - 1));
+    double m = hsv->v / 100.0 - c;
+    double components[6][3] = {{c, x, 0}, {x, c, 0}, {0, c, x}, {0, x, c}, {x, 0, c}, {c, 0, x}};
+    const double *rgb = components[hsv->h / 60];
+    return new_rgb(floor((rgb[0] + m) * 255 + 1e-9), floor((rgb[1] + m) * 255 + 1e-9),
+                   floor((rgb[2] + m) * 255 + 1e-9));
+}
+
+static int hue_diff(int a, int b) {
+    int diff = abs(a - b);
+    return diff > 180 ? 360 - diff : diff;
+}
+
+static void test_rgb_to_hsv_is_exact() {
+    uint32_t float_diffs = 0;
+    for (uint32_t i = 0; i < RGB_INPUTS_COUNT; i++) {
+        rgb_data_t rgb = new_rgb(i >> 16, i >> 8, i);
+        hsv_data_t hsv = get_hsv_from_rgb(&rgb);
+        hsv_data_t exact = get_exact_hsv(&rgb);
+        CHECK(hsv.h == exact.h && hsv.s == exact.s && hsv.v == exact.v);
+
+        hsv_data_t float_hsv = float_get_hsv_from_rgb(&rgb);
+        CHECK(hue_diff(hsv.h, float_hsv.h) <= 1 && abs(hsv.s - float_hsv.s) <= 1 && abs(hsv.v - float_hsv.v) <= 1);
+        float_diffs += hsv.h != float_hsv.h || hsv.s != float_hsv.s || hsv.v != float_hsv.v;
+    }
+    printf("    %u RGB inputs, float version is off by one in %" PRIu32 "\n", RGB_INPUTS_COUNT, float_diffs);
+}
+
+static void test_hsv_to_rgb_is_exact() {
+    uint32_t inputs = 0, float_diffs = 0;
+    for (uint16_t h = 0; h < 360; h++) {
+        for (uint8_t s = 0; s <= 100; s++) {
+            for (uint8_t v = 0; v <= 100; v++) {
+                hsv_data_t hsv = new_hsv(h, s, v);
+                rgb_data_t rgb = get_rgb_from_hsv(&hsv);
+                rgb_data_t exact = get_exact_rgb(&hsv);
+                CHECK(rgb.r == exact.r && rgb.g == exact.g && rgb.b == exact.b);
+
+                rgb_data_t float_rgb = float_get_rgb_from_hsv(&hsv);
+                CHECK(abs(rgb.r - float_rgb.r) <= 1 && abs(rgb.g - float_rgb.g) <= 1 && abs(rgb.b - float_rgb.b) <= 1);
+                float_diffs += rgb.r != float_rgb.r || rgb.g != float_rgb.g || rgb.b != float_rgb.b;
+                inputs++;
+            }
+        }
+    }
+    printf("    %" PRIu32 " HSV inputs, float version is off by one in %" PRIu32 "\n", inputs, float_diffs);
+}
+
+static void test_rgb16_ends() {
+    /* 16 bit components span the full scale like 8 bit ones */
+    hsv_data_t white = new_hsv(0, 0, 100);
+    hsv_data_t red = new_hsv(0, 100, 100);
+    rgb16_data_t rgb16 = get_rgb16_from_hsv(&white);
+    CHECK(rgb16.r == UINT16_MAX && rgb16.g == UINT16_MAX && rgb16.b == UINT16_MAX);
+    rgb16 = get_rgb16_from_hsv(&red);
+    CHECK(rgb16.r == UINT16_MAX && rgb16.g == 0 && rgb16.b == 0);
+    rgb_data_t rgb = new_rgb(255, 1, 0);
+    rgb16 = get_rgb16_from_rgb(&rgb);
+    CHECK(rgb16.r == UINT16_MAX && rgb16.g == 257 && rgb16.b == 0);
+}
+
+int main(void) {
+    RUN_TEST(test_rgb_to_hsv_is_exact);
+    RUN_TEST(test_hsv_to_rgb_is_exact);
+    RUN_TEST(test_rgb16_ends);
+    return 0;
+}
@@ -0,0 +1,1098 @@
+/* Module is included, so tests reach its static functions and state */
+#include "../modules/fs/fs.c"
+
+#include "flash_emu.h"
+#include "fs_log.h"
+#include "test.h"
+#include "nrf_fstorage.h"
+#include "nrf_fstorage_sd.h"
+#include "../modules/color_types/color_types.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define PART_HOT (&parts_s[FS_PART_HOT])
+#define PART_COLD (&parts_s[FS_PART_COLD])
+/* Log page starts with 16 byte header */
+#define LOG_SLOTS ((CODE_PAGE_SIZE - 16) / FS_LOG_ENTRY_SIZE)
+
+/* Erased flash, mounted like on first boot */
+static void mount_erased(fs_part_policy_t policy) {
+    flash_emu_init();
+    fs_set_part_policy(policy);
+    CHECK(fs_init() == NRF_SUCCESS);
+}
+
+/* Main loop runs until flash is idle */
+static void settle() {
+    do {
+        fs_process();
+    } while (flash_emu_step());
+    fs_process();
+}
+
+static size_t count_page_headers(fs_part_t *part) {
+    size_t count = 0;
+    for (fs_header_t *phead = next_header_on_page(part->curr_page, NULL); phead != NULL;
+         phead = next_header_on_page(part->curr_page, phead)) {
+        count++;
+    }
+    return count;
+}
+
+/*
+    Index tests
+*/
+
+static void test_lookup_is_constant() {
+    /* Superseded versions fill active page, lookup checks the same number of index entries */
+    static char *const names[] = {"last_hsv", "rgb_array", "brightness", "mode", "color0", "color1"};
+    const size_t names_count = sizeof(names) / sizeof(names[0]);
+    uint32_t first_scanned = 0;
+
+    mount_erased(NULL);
+    for (uint32_t round = 0; round < 6; round++) {
+        for (uint32_t i = 0; i < 40; i++) {
+            uint32_t value = round * 1000 + i;
+            CHECK(fs_write(names[i % names_count], &value, sizeof(value)) != NULL);
+        }
+        settle();
+
+        fs_stats_t before, after;
+        fs_get_stats(FS_PART_HOT, &before);
+        for (size_t i = 0; i < names_count; i++) {
+            uint32_t value = 0;
+            fs_header_t *phead = fs_find_record(names[i]);
+            CHECK(phead != NULL);
+            CHECK(fs_read(phead, &value, sizeof(value)) == NRF_SUCCESS);
+            CHECK(value == round * 1000 + 39 - (39 - i) % names_count);
+        }
+        fs_get_stats(FS_PART_HOT, &after);
+
+        uint32_t scanned = after.headers_scanned - before.headers_scanned;
+        CHECK(after.lookups - before.lookups == names_count);
+        printf("    %3zu headers on active page: %" PRIu32 " index entries checked by %zu lookups\n",
+               count_page_headers(PART_HOT), scanned, names_count);
+        if (round == 0) {
+            first_scanned = scanned;
+        }
+        CHECK(scanned == first_scanned);
+    }
+}
+
+static void test_lookup_after_delete_and_remount() {
+    uint32_t value = 7;
+    mount_erased(NULL);
+    CHECK(fs_write("kept", &value, sizeof(value)) != NULL);
+    CHECK(fs_write("deleted", &value, sizeof(value)) != NULL);
+    CHECK(fs_delete(fs_find_record("deleted")) == NRF_SUCCESS);
+    CHECK(fs_find_record("deleted") == NULL);
+    CHECK(fs_find_record("missing") == NULL);
+    settle();
+
+    /* Index is rebuilt from flash */
+    CHECK(fs_init() == NRF_SUCCESS);
+    CHECK(fs_find_record("deleted") == NULL);
+    fs_header_t *phead = fs_find_record("kept");
+    CHECK(phead != NULL);
+    value = 0;
+    CHECK(fs_read(phead, &value, sizeof(value)) == NRF_SUCCESS && value == 7);
+}
+
+static void test_name_ids_are_reused() {
+    /*
+        More distinct names than 8 bit name ids are created and deleted, only FS_INDEX_SIZE / 4 of them
+        are live at once. Ids of deleted names are taken again across compactions and remount.
+    */
+    const uint32_t names_count = 3 * FS_NAME_ID_MAX;
+    const uint32_t live_count = FS_INDEX_SIZE / 4;
+    char name[RECORDNAME_MAX_LENGTH + 1];
+    mount_erased(NULL);
+    fs_stats_t before, after;
+    fs_get_stats(FS_PART_HOT, &before);
+    for (uint32_t i = 0; i < names_count; i++) {
+        snprintf(name, sizeof(name), "name%" PRIu32, i);
+        CHECK(fs_write(name, &i, sizeof(i)) != NULL);
+        if (i >= live_count) {
+            snprintf(name, sizeof(name), "name%" PRIu32, i - live_count);
+            CHECK(fs_delete(fs_find_record(name)) == NRF_SUCCESS);
+        }
+        if (i == names_count / 2) {
+            settle();
+            CHECK(fs_init() == NRF_SUCCESS);
+        }
+        fs_process();
+    }
+    settle();
+    fs_get_stats(FS_PART_HOT, &after);
+    CHECK(after.compactions > before.compactions);
+
+    for (int remount = 0; remount < 2; remount++) {
+        for (uint32_t i = 0; i < names_count; i++) {
+            snprintf(name, sizeof(name), "name%" PRIu32, i);
+            fs_header_t *phead = fs_find_record(name);
+            if (i < names_count - live_count) {
+                CHECK(phead == NULL);
+                continue;
+            }
+            uint32_t value = 0;
+            CHECK(phead != NULL && fs_read(phead, &value, sizeof(value)) == NRF_SUCCESS && value == i);
+        }
+        CHECK(fs_init() == NRF_SUCCESS);
+    }
+}
+
+/*
+    Checkpoint tests
+*/
+
+#define CP_NAMES 16
+#define CP_LENGTH 16
+
+static uint32_t cp_values[CP_NAMES];
+
+static void cp_write(uint32_t i) {
+    char name[RECORDNAME_MAX_LENGTH + 1];
+    uint8_t value[CP_LENGTH];
+    snprintf(name, sizeof(name), "cp%" PRIu32, i % CP_NAMES);
+    memset(value, i, sizeof(value));
+    memcpy(value, &i, sizeof(i));
+    CHECK(fs_write(name, value, sizeof(value)) != NULL);
+    cp_values[i % CP_NAMES] = i;
+}
+
+static void cp_check() {
+    char name[RECORDNAME_MAX_LENGTH + 1];
+    uint8_t value[CP_LENGTH], read[CP_LENGTH];
+    for (uint32_t i = 0; i < CP_NAMES; i++) {
+        snprintf(name, sizeof(name), "cp%" PRIu32, i);
+        memset(value, cp_values[i], sizeof(value));
+        memcpy(value, &cp_values[i], sizeof(cp_values[i]));
+        fs_header_t *phead = fs_find_record(name);
+        CHECK(phead != NULL && fs_read(phead, read, sizeof(read)) == NRF_SUCCESS && memcmp(read, value, sizeof(read)) == 0);
+    }
+}
+
+static fs_header_t *cp_find_checkpoint() {
+    fs_header_t *phead = next_header_on_page(PART_HOT->curr_page, NULL);
+    return phead != NULL && phead->type == FS_RECORD_CHECKPOINT ? phead : NULL;
+}
+
+/* Writes until active page of hot instance is not the first one and has records after checkpoint */
+static void cp_fill() {
+    mount_erased(NULL);
+    uint32_t i = 0;
+    while (PART_HOT->curr_page == PART_HOT->first_page || count_page_headers(PART_HOT) < CP_NAMES) {
+        cp_write(i++);
+    }
+    settle();
+    CHECK(cp_find_checkpoint() != NULL);
+}
+
+static void test_mount_from_checkpoint_then_write() {
+    cp_fill();
+    uintptr_t used_ends[PAGES_COUNT];
+    for (int8_t page = 0; page < PAGES_COUNT; page++) {
+        used_ends[page] = pages_s[page].used_end;
+    }
+
+    /* Used ends of older pages are taken from checkpoint */
+    CHECK(fs_init() == NRF_SUCCESS);
+    CHECK(cp_find_checkpoint() != NULL);
+    for (int8_t page = PART_HOT->first_page; page < PART_HOT->end_page; page++) {
+        CHECK(!is_page_used(page) || page == PART_HOT->curr_page || pages_s[page].used_end == used_ends[page]);
+    }
+    cp_check();
+
+    /* Records written after mount go after the last one, next pages get own checkpoints */
+    int8_t page = PART_HOT->curr_page;
+    uint32_t i = 1000;
+    while (PART_HOT->curr_page == page) {
+        cp_write(i++);
+    }
+    for (uint32_t j = 0; j < CP_NAMES; j++) {
+        cp_write(i++);
+    }
+    settle();
+    cp_check();
+    CHECK(fs_init() == NRF_SUCCESS);
+    cp_check();
+}
+
+static void test_corrupted_checkpoint_falls_back_to_full_scan() {
+    cp_fill();
+
+    /* Bit of used end in checkpoint goes from 1 to 0, its crc doesn`t match any more */
+    fs_header_t *checkpoint = cp_find_checkpoint();
+    uint16_t *used_ends = (uint16_t*) get_record_data(checkpoint);
+    int8_t other = PART_HOT->curr_page == PART_HOT->first_page + 1 ? PART_HOT->first_page : PART_HOT->first_page + 1;
+    CHECK(used_ends[other - PART_HOT->first_page] != 0);
+    used_ends[other - PART_HOT->first_page] &= used_ends[other - PART_HOT->first_page] - 1;
+
+    CHECK(fs_init() == NRF_SUCCESS);
+    cp_check();
+    for (uint32_t i = 2000; i < 2000 + 4 * CP_NAMES; i++) {
+        cp_write(i);
+    }
+    settle();
+    CHECK(fs_init() == NRF_SUCCESS);
+    cp_check();
+}
+
+static void test_stale_checkpoint_is_checked_on_mount() {
+    /*
+        Compaction erases pages after checkpoint of active page is written, deleted records it lists are dropped.
+        Instance is remounted often, some mounts find checkpoint listing erased page.
+    */
+    char name[RECORDNAME_MAX_LENGTH + 1];
+    uint32_t stale_mounts = 0;
+    mount_erased(NULL);
+    for (uint32_t i = 0; i < 3000; i++) {
+        cp_write(i);
+        snprintf(name, sizeof(name), "gone%" PRIu32, i / 2 % 4);
+        if (i % 2 == 0) {
+            CHECK(fs_write(name, &i, sizeof(i)) != NULL);
+        }
+        else {
+            CHECK(fs_delete(fs_find_record(name)) == NRF_SUCCESS);
+        }
+        fs_process();
+
+        if (i % 24 == 23) {
+            settle();
+            fs_header_t *checkpoint = cp_find_checkpoint();
+            const uint16_t *used_ends = checkpoint != NULL ? (const uint16_t*) get_record_data(checkpoint) : NULL;
+            for (int8_t page = PART_HOT->first_page; used_ends != NULL && page < PART_HOT->end_page; page++) {
+                if (page != PART_HOT->curr_page && used_ends[page - PART_HOT->first_page] != 0 && !is_page_used(page)) {
+                    stale_mounts++;
+                    break;
+                }
+            }
+            CHECK(fs_init() == NRF_SUCCESS);
+            cp_check();
+            for (uint32_t j = 0; j < 4; j++) {
+                snprintf(name, sizeof(name), "gone%" PRIu32, j);
+                CHECK(fs_find_record(name) == NULL);
+            }
+        }
+    }
+    CHECK(stale_mounts > 0);
+}
+
+/*
+    Crc tests
+*/
+
+static void test_crc32_check_value() {
+    /* Check value of CRC-32/ISO-HDLC */
+    const char *check = "123456789";
+    CHECK((crc32_update(0xFFFFFFFF, (const uint8_t*) check, strlen(check)) ^ 0xFFFFFFFF) == 0xCBF43926);
+    /* Update by parts gives the same crc */
+    uint32_t crc = crc32_update(0xFFFFFFFF, (const uint8_t*) check, 4);
+    CHECK((crc32_update(crc, (const uint8_t*) check + 4, 5) ^ 0xFFFFFFFF) == 0xCBF43926);
+}
+
+static void flip_and_check(uint8_t *byte, uint8_t mask, fs_header_t *phead) {
+    /* Flash is RAM on host, bit is flipped in place and restored */
+    *byte ^= mask;
+    CHECK(!is_header_valid(phead));
+    *byte ^= mask;
+    CHECK(is_header_valid(phead));
+}
+
+static void test_crc_covers_header_and_payload() {
+    uint8_t value[20];
+    for (size_t i = 0; i < sizeof(value); i++) {
+        value[i] = i;
+    }
+    mount_erased(NULL);
+    fs_header_t *phead = fs_write("crc", value, sizeof(value));
+    CHECK(phead != NULL && is_header_valid(phead));
+
+    flip_and_check(&phead->type, 0x01, phead);
+    flip_and_check(&phead->name_id, 0x04, phead);
+    flip_and_check((uint8_t*) &phead->length, 0x01, phead);
+    flip_and_check(&phead->value[2], 0x80, phead);
+    flip_and_check(get_record_data(phead) + 17, 0x10, phead);
+
+    uint32_t inline_value = 0x12345678;
+    phead = fs_write("inline", &inline_value, sizeof(inline_value));
+    CHECK(phead != NULL);
+    flip_and_check(&phead->value[3], 0x02, phead);
+}
+
+static void test_corrupted_record_is_not_mounted() {
+    uint8_t value[20] = {1, 2, 3};
+    uint32_t newer = 5;
+    mount_erased(NULL);
+    CHECK(fs_write("old", value, sizeof(value)) != NULL);
+    fs_header_t *phead = fs_write("corrupted", value, sizeof(value));
+    CHECK(phead != NULL);
+    settle();
+
+    /* Payload bit is lost: mount keeps records before it and seals it like torn write, page stays appendable */
+    get_record_data(phead)[5] ^= 0x01;
+    CHECK(fs_init() == NRF_SUCCESS);
+    CHECK(fs_find_record("corrupted") == NULL);
+    CHECK(fs_find_record("old") != NULL);
+    CHECK(fs_write("newer", &newer, sizeof(newer)) != NULL);
+    CHECK(fs_find_record("newer") != NULL);
+}
+
+/*
+    Instances tests
+*/
+
+static fs_part_id_t palette_policy(const char *record_name) {
+    return strcmp(record_name, "rgb_array") == 0 ? FS_PART_COLD : FS_PART_HOT;
+}
+
+static void fill_palette(uint8_t *palette, size_t length, uint8_t seed) {
+    for (size_t i = 0; i < length; i++) {
+        palette[i] = seed + i * 7;
+    }
+}
+
+static void test_churn_doesnt_copy_cold_records() {
+    uint8_t palette[120], read[120];
+    fill_palette(palette, sizeof(palette), 1);
+    mount_erased(palette_policy);
+    fs_header_t *phead = fs_write("rgb_array", palette, sizeof(palette));
+    CHECK(phead != NULL);
+    CHECK(find_record(PART_COLD, "rgb_array") == phead && find_record(PART_HOT, "rgb_array") == NULL);
+
+    fs_stats_t hot_before, cold_before, hot_after, cold_after;
+    fs_get_stats(FS_PART_HOT, &hot_before);
+    fs_get_stats(FS_PART_COLD, &cold_before);
+    for (uint32_t i = 0; i < 3000; i++) {
+        CHECK(fs_write("last_hsv", &i, 3) != NULL);
+        fs_process();
+    }
+    settle();
+    fs_get_stats(FS_PART_HOT, &hot_after);
+    fs_get_stats(FS_PART_COLD, &cold_after);
+
+    CHECK(find_record(PART_HOT, "last_hsv") != NULL && find_record(PART_COLD, "last_hsv") == NULL);
+    CHECK(hot_after.compactions > hot_before.compactions);
+    CHECK(cold_after.compactions == cold_before.compactions);
+    CHECK(cold_after.bytes_written == cold_before.bytes_written);
+    CHECK(fs_find_record("rgb_array") == phead);
+    CHECK(fs_read(phead, read, sizeof(read)) == NRF_SUCCESS && memcmp(read, palette, sizeof(read)) == 0);
+}
+
+static void test_churn_spreads_erases_over_pages() {
+    /*
+        Records written once stay on their page while others are rewritten, compaction moves them,
+        so every page of instance is erased about the same number of times.
+    */
+    char name[RECORDNAME_MAX_LENGTH + 1];
+    uint32_t min_erases = UINT32_MAX, max_erases = 0;
+    mount_erased(NULL);
+    for (uint32_t i = 0; i < 8; i++) {
+        snprintf(name, sizeof(name), "static%" PRIu32, i);
+        CHECK(fs_write(name, &i, sizeof(i)) != NULL);
+    }
+    for (uint32_t i = 0; i < 20000; i++) {
+        snprintf(name, sizeof(name), "churn%" PRIu32, i % 4);
+        CHECK(fs_write(name, &i, sizeof(i)) != NULL);
+        fs_process();
+    }
+    settle();
+
+    for (int8_t page = PART_HOT->first_page; page < PART_HOT->end_page; page++) {
+        uint32_t erases = flash_emu_page_erases(PAGE_ADDR(page));
+        printf("    page %" PRIi8 ": %" PRIu32 " erases\n", page, erases);
+        CHECK(pages_s[page].erase_count == erases);
+        min_erases = FS_MIN(min_erases, erases);
+        max_erases = FS_MAX(max_erases, erases);
+    }
+    for (int8_t page = PART_COLD->first_page; page < PART_COLD->end_page; page++) {
+        CHECK(flash_emu_page_erases(PAGE_ADDR(page)) == 0);
+    }
+    CHECK(min_erases > 0 && max_erases - min_erases <= 1);
+
+    CHECK(fs_init() == NRF_SUCCESS);
+    for (uint32_t i = 0; i < 8; i++) {
+        uint32_t value = 0;
+        snprintf(name, sizeof(name), "static%" PRIu32, i);
+        CHECK(fs_read(fs_find_record(name), &value, sizeof(value)) == NRF_SUCCESS && value == i);
+    }
+}
+
+static void test_policy_change_moves_records_on_mount() {
+    uint8_t palette[120], read[120];
+    uint32_t hsv = 0x00640064;
+    fill_palette(palette, sizeof(palette), 2);
+    mount_erased(NULL);
+    CHECK(fs_write("rgb_array", palette, sizeof(palette)) != NULL);
+    CHECK(fs_write("last_hsv", &hsv, sizeof(hsv)) != NULL);
+    settle();
+    CHECK(find_record(PART_HOT, "rgb_array") != NULL);
+
+    fs_set_part_policy(palette_policy);
+    CHECK(fs_init() == NRF_SUCCESS);
+    CHECK(find_record(PART_COLD, "rgb_array") != NULL && find_record(PART_HOT, "rgb_array") == NULL);
+    CHECK(find_record(PART_HOT, "last_hsv") != NULL);
+    CHECK(fs_read(fs_find_record("rgb_array"), read, sizeof(read)) == NRF_SUCCESS);
+    CHECK(memcmp(read, palette, sizeof(read)) == 0);
+
+    /* Moved back when policy is dropped */
+    fs_set_part_policy(NULL);
+    CHECK(fs_init() == NRF_SUCCESS);
+    CHECK(find_record(PART_HOT, "rgb_array") != NULL && find_record(PART_COLD, "rgb_array") == NULL);
+    CHECK(fs_read(fs_find_record("rgb_array"), read, sizeof(read)) == NRF_SUCCESS);
+    CHECK(memcmp(read, palette, sizeof(read)) == 0);
+}
+
+/*
+    Map tests
+*/
+
+static void test_map_is_invalid_after_rewrite_and_compaction() {
+    uint8_t palette[120], newer[120];
+    fill_palette(palette, sizeof(palette), 7);
+    fill_palette(newer, sizeof(newer), 9);
+    mount_erased(NULL);
+    CHECK(fs_write("rgb_array", palette, sizeof(palette)) != NULL);
+
+    fs_map_t map;
+    CHECK(fs_map("rgb_array", &map) == NRF_SUCCESS && map.length == sizeof(palette));
+    CHECK(fs_map_is_valid(&map) && memcmp(map.data, palette, sizeof(palette)) == 0);
+    uint32_t value = 1;
+    CHECK(fs_write("last_hsv", &value, sizeof(value)) != NULL);
+    CHECK(fs_map_is_valid(&map));
+
+    /* Newer version */
+    CHECK(fs_write("rgb_array", newer, sizeof(newer)) != NULL);
+    CHECK(!fs_map_is_valid(&map));
+    CHECK(fs_map("rgb_array", &map) == NRF_SUCCESS && fs_map_is_valid(&map));
+    CHECK(memcmp(map.data, newer, sizeof(newer)) == 0);
+
+    /* Compaction copies record to active page, view is valid only while it is not copied and nothing is erased */
+    while (fs_find_record("rgb_array") == map.header) {
+        CHECK(!fs_map_is_valid(&map) || memcmp(map.data, newer, sizeof(newer)) == 0);
+        CHECK(fs_write("last_hsv", &value, sizeof(value)) != NULL);
+        value++;
+        fs_process();
+    }
+    CHECK(!fs_map_is_valid(&map));
+    CHECK(fs_map("rgb_array", &map) == NRF_SUCCESS && fs_map_is_valid(&map));
+    CHECK(memcmp(map.data, newer, sizeof(newer)) == 0);
+
+    /* Delete */
+    CHECK(fs_delete(fs_find_record("rgb_array")) == NRF_SUCCESS);
+    CHECK(!fs_map_is_valid(&map));
+    CHECK(fs_map("rgb_array", &map) == NRF_ERROR_NOT_FOUND);
+}
+
+/*
+    Migration tests
+*/
+
+/* Record of previous version is written at addr like old firmware did, addr goes past it */
+static void v1_write(uintptr_t *addr, uint8_t id, const char *name, const void *data, uint32_t length) {
+    fs_v1_header_t *phead = (fs_v1_header_t*) *addr;
+    memset(phead, 0, sizeof(*phead));
+    phead->id = id;
+    phead->nid = id ^ 0xFF;
+    strcpy(phead->record_name, name);
+    phead->length = length;
+    phead->_crc8 = crc8(0xFF, data, length);
+    if (length != 0) {
+        memcpy((uint8_t*) phead + sizeof(*phead), data, length);
+    }
+    *addr += sizeof(*phead) + get_rounded_length(length);
+}
+
+static void check_v1_migrated(const uint8_t *palette, size_t palette_length, const uint8_t *color0, size_t color0_length) {
+    uint8_t read[120];
+    uint32_t value = 0;
+    CHECK(fs_read(fs_find_record("last_hsv"), &value, sizeof(value)) == NRF_SUCCESS && value == 0x00640032);
+    CHECK(fs_read(fs_find_record("mode"), &value, sizeof(value)) == NRF_SUCCESS && value == 2);
+    CHECK(fs_record_length(fs_find_record("rgb_array")) == palette_length);
+    CHECK(fs_read(fs_find_record("rgb_array"), read, palette_length) == NRF_SUCCESS && memcmp(read, palette, palette_length) == 0);
+    CHECK(fs_record_length(fs_find_record("color0")) == color0_length);
+    CHECK(fs_read(fs_find_record("color0"), read, color0_length) == NRF_SUCCESS && memcmp(read, color0, color0_length) == 0);
+    CHECK(fs_find_record("brightness") == NULL);
+    for (int8_t page = PART_HOT->first_page; page < PART_HOT->end_page; page++) {
+        CHECK(((fs_page_header_t*) PAGE_ADDR(page))->magic == FS_PAGE_MAGIC && !pages_s[page].legacy);
+    }
+}
+
+static void test_v1_pages_are_migrated_on_mount() {
+    /*
+        Older page has no page header, newer one starts with "FSP1" header. Newest version of
+        every record is kept, record deleted by empty version is dropped.
+    */
+    uint8_t palette[120], color0[30];
+    uint32_t value;
+    fill_palette(palette, sizeof(palette), 3);
+    fill_palette(color0, sizeof(color0), 5);
+    flash_emu_init();
+    fs_set_part_policy(NULL);
+
+    uintptr_t addr = PAGE_ADDR(PART_HOT->first_page);
+    value = 0x00640064;
+    v1_write(&addr, 1, "last_hsv", &value, sizeof(value));
+    v1_write(&addr, 2, "rgb_array", palette, sizeof(palette));
+    value = 1;
+    v1_write(&addr, 3, "mode", &value, sizeof(value));
+    v1_write(&addr, 4, "brightness", &value, sizeof(value));
+    value = 2;
+    v1_write(&addr, 3, "mode", &value, sizeof(value));
+
+    fs_page_header_t *page_header = (fs_page_header_t*) PAGE_ADDR(PART_HOT->first_page + 1);
+    page_header->magic = FS_PAGE_MAGIC_V1;
+    page_header->erase_count = 7;
+    page_header->seq = 5;
+    addr = (uintptr_t) page_header + FS_PAGE_HEADER_SIZE_BYTES;
+    value = 0x00640032;
+    v1_write(&addr, 1, "last_hsv", &value, sizeof(value));
+    v1_write(&addr, 4, "brightness", NULL, 0);
+    /* Zeroed words of torn record are skipped */
+    memset((void*) addr, 0, 8);
+    addr += 8;
+    v1_write(&addr, 5, "color0", color0, sizeof(color0));
+
+    CHECK(fs_init() == NRF_SUCCESS);
+    check_v1_migrated(palette, sizeof(palette), color0, sizeof(color0));
+    CHECK(pages_s[PART_HOT->first_page + 1].erase_count >= 7);
+
+    /* Records are in compact format, nothing is migrated again */
+    settle();
+    CHECK(fs_init() == NRF_SUCCESS);
+    check_v1_migrated(palette, sizeof(palette), color0, sizeof(color0));
+    CHECK(fs_write("color1", color0, sizeof(color0)) != NULL);
+    settle();
+    CHECK(fs_init() == NRF_SUCCESS);
+    check_v1_migrated(palette, sizeof(palette), color0, sizeof(color0));
+    CHECK(fs_find_record("color1") != NULL);
+}
+
+/*
+    Packing and patch tests
+*/
+
+static void check_rle_round_trip(const uint8_t *src, size_t length) {
+    /* Literal run of FS_RLE_MAX_LITERAL bytes takes one control byte */
+    static uint8_t packed[FS_RECORD_MAX_LENGTH + FS_RECORD_MAX_LENGTH / FS_RLE_MAX_LITERAL + 1];
+    static uint8_t unpacked[FS_RECORD_MAX_LENGTH + 1];
+    size_t packed_length = rle_pack(src, length, packed, sizeof(packed));
+    CHECK(length == 0 || packed_length != 0);
+    CHECK(packed_length <= length + (length + FS_RLE_MAX_LITERAL - 1) / FS_RLE_MAX_LITERAL);
+
+    memset(unpacked, 0xA5, sizeof(unpacked));
+    rle_unpack(packed, packed_length, unpacked, length);
+    CHECK(memcmp(unpacked, src, length) == 0);
+    CHECK(unpacked[length] == 0xA5);
+
+    /* Capacity is never exceeded */
+    if (packed_length > 0) {
+        CHECK(rle_pack(src, length, packed, packed_length - 1) == 0);
+    }
+    /* Partial unpack stops at bytes_count */
+    if (length > 1) {
+        memset(unpacked, 0xA5, sizeof(unpacked));
+        rle_unpack(packed, packed_length, unpacked, length / 2);
+        CHECK(memcmp(unpacked, src, length / 2) == 0);
+        CHECK(unpacked[length / 2] == 0xA5);
+    }
+}
+
+static void test_rle_round_trip() {
+    static uint8_t src[FS_RECORD_MAX_LENGTH];
+    static const size_t runs[] = {1, FS_RLE_MIN_REPEAT - 1, FS_RLE_MIN_REPEAT, FS_RLE_MAX_REPEAT,
+                                  FS_RLE_MAX_REPEAT + 1, FS_RLE_MAX_LITERAL, FS_RLE_MAX_LITERAL + 1};
+    check_rle_round_trip(src, 0);
+
+    /* Runs of every boundary length, separated by literals */
+    for (size_t i = 0; i < ARRAY_SIZE(runs); i++) {
+        for (size_t j = 0; j < ARRAY_SIZE(runs); j++) {
+            size_t length = 0;
+            memset(src, 0x11, runs[i]);
+            length += runs[i];
+            for (size_t k = 0; k < runs[j]; k++) {
+                src[length++] = k * 31 + 1;
+            }
+            memset(src + length, 0x22, runs[i]);
+            length += runs[i];
+            check_rle_round_trip(src, length);
+        }
+    }
+
+    /* Random bytes with random runs */
+    srand(1);
+    for (size_t iteration = 0; iteration < 2000; iteration++) {
+        size_t length = rand() % (FS_RECORD_MAX_LENGTH + 1);
+        for (size_t pos = 0; pos < length; ) {
+            size_t run = rand() % 2 ? 1 : rand() % 200 + 1;
+            run = FS_MIN(run, length - pos);
+            memset(src + pos, rand() % 4, run);
+            pos += run;
+        }
+        check_rle_round_trip(src, length);
+    }
+}
+
+static void make_palette(rgb_data_array_t *p_palette, size_t count) {
+    static const char *const names[] = {"red", "green", "blue", "warm_white", "sunset_orange", "ocean", "purple",
+                                        "mint", "pink", "lemon_yellow"};
+    memset(p_palette, 0, sizeof(rgb_data_array_t));
+    for (p_palette->count = 0; p_palette->count < count; p_palette->count++) {
+        rgb_data_with_name_t *p_color = &p_palette->colors_array[p_palette->count];
+        p_color->rgb = (rgb_data_t) {p_palette->count * 25, 255 - p_palette->count * 13, p_palette->count * 77};
+        strcpy(p_color->color_name, names[p_palette->count]);
+    }
+}
+
+static void check_palette(const rgb_data_array_t *p_palette) {
+    static rgb_data_array_t read;
+    fs_header_t *phead = fs_find_record("rgb_array");
+    CHECK(phead != NULL && fs_record_length(phead) == sizeof(read));
+    memset(&read, 0xA5, sizeof(read));
+    CHECK(fs_read(phead, &read, sizeof(read)) == NRF_SUCCESS);
+    CHECK(memcmp(&read, p_palette, sizeof(read)) == 0);
+}
+
+static void test_packed_record_round_trip() {
+    static rgb_data_array_t palette;
+    uint8_t head[10];
+    make_palette(&palette, 3);
+    mount_erased(NULL);
+    fs_header_t *phead = fs_write_packed("rgb_array", &palette, sizeof(palette));
+    CHECK(phead != NULL);
+    CHECK(get_packed_length(phead) == sizeof(palette) && phead->length < sizeof(palette) / 2);
+    check_palette(&palette);
+    CHECK(fs_read(phead, head, sizeof(head)) == NRF_SUCCESS && memcmp(head, &palette, sizeof(head)) == 0);
+
+    fs_map_t map;
+    CHECK(fs_map("rgb_array", &map) == NRF_ERROR_INVALID_STATE);
+
+    /* Data which doesn`t pack is stored as is */
+    uint8_t noise[200], read[200];
+    srand(2);
+    for (size_t i = 0; i < sizeof(noise); i++) {
+        noise[i] = rand();
+    }
+    phead = fs_write_packed("noise", noise, sizeof(noise));
+    CHECK(phead != NULL && get_packed_length(phead) == 0);
+    CHECK(fs_read(phead, read, sizeof(read)) == NRF_SUCCESS && memcmp(read, noise, sizeof(read)) == 0);
+
+    settle();
+    CHECK(fs_init() == NRF_SUCCESS);
+    check_palette(&palette);
+}
+
+static void test_patch_applies_over_packed() {
+    static rgb_data_array_t palette;
+    make_palette(&palette, 3);
+    mount_erased(NULL);
+    CHECK(fs_write_packed("rgb_array", &palette, sizeof(palette)) != NULL);
+
+    /* Color is added like by palette commands: entry, then count */
+    make_palette(&palette, 4);
+    CHECK(fs_patch("rgb_array", offsetof(rgb_data_array_t, colors_array[3]), &palette.colors_array[3],
+                   sizeof(rgb_data_with_name_t)) != NULL);
+    fs_header_t *phead = fs_patch("rgb_array", offsetof(rgb_data_array_t, count), &palette.count, sizeof(palette.count));
+    CHECK(phead != NULL && phead->type == FS_RECORD_PATCH);
+    check_palette(&palette);
+
+    /* Chain longer than FS_PATCH_MAX_CHAIN is folded to value record */
+    for (size_t i = 0; i < 2 * FS_PATCH_MAX_CHAIN; i++) {
+        palette.colors_array[i % COLORS_COUNT].rgb.r = i;
+        CHECK(fs_patch("rgb_array", offsetof(rgb_data_array_t, colors_array[i % COLORS_COUNT].rgb.r),
+                       &palette.colors_array[i % COLORS_COUNT].rgb.r, 1) != NULL);
+        CHECK(get_patches_count(fs_find_record("rgb_array")) <= FS_PATCH_MAX_CHAIN);
+        check_palette(&palette);
+    }
+
+    /* Patch beyond the end grows record */
+    uint32_t tail = 0xDEADBEEF;
+    uint8_t read[sizeof(palette) + sizeof(tail)];
+    phead = fs_patch("rgb_array", sizeof(palette), &tail, sizeof(tail));
+    CHECK(phead != NULL && fs_record_length(phead) == sizeof(read));
+    CHECK(fs_read(phead, read, sizeof(read)) == NRF_SUCCESS);
+    CHECK(memcmp(read, &palette, sizeof(palette)) == 0 && memcmp(read + sizeof(palette), &tail, sizeof(tail)) == 0);
+    CHECK(fs_patch("rgb_array", sizeof(read) + 1, &tail, sizeof(tail)) == NULL);
+    CHECK(fs_patch("missing", 0, &tail, sizeof(tail)) == NULL);
+
+    settle();
+    CHECK(fs_init() == NRF_SUCCESS);
+    phead = fs_find_record("rgb_array");
+    CHECK(phead != NULL && fs_read(phead, read, sizeof(read)) == NRF_SUCCESS);
+    CHECK(memcmp(read, &palette, sizeof(palette)) == 0 && memcmp(read + sizeof(palette), &tail, sizeof(tail)) == 0);
+}
+
+static void test_append_grows_record() {
+    uint8_t expected[64], read[64];
+    for (size_t i = 0; i < sizeof(expected); i++) {
+        expected[i] = i;
+    }
+    mount_erased(NULL);
+    CHECK(fs_append("appended", expected, 8) == NULL);
+    CHECK(fs_write("appended", expected, 8) != NULL);
+
+    for (size_t length = 8; length < 48; length += 8) {
+        fs_header_t *phead = fs_append("appended", expected + length, 8);
+        CHECK(phead != NULL && fs_record_length(phead) == length + 8);
+        CHECK(get_patches_count(phead) <= FS_PATCH_MAX_CHAIN);
+    }
+    /* Offset is taken when write starts, so queued appends follow each other */
+    CHECK(fs_patch_async("appended", FS_PATCH_APPEND, expected + 48, 8, NULL, NULL) == NRF_SUCCESS);
+    CHECK(fs_patch_async("appended", FS_PATCH_APPEND, expected + 56, 8, NULL, NULL) == NRF_SUCCESS);
+    settle();
+    CHECK(fs_read(fs_find_record("appended"), read, sizeof(read)) == NRF_SUCCESS);
+    CHECK(memcmp(read, expected, sizeof(read)) == 0);
+
+    settle();
+    CHECK(fs_init() == NRF_SUCCESS);
+    fs_header_t *phead = fs_find_record("appended");
+    CHECK(fs_record_length(phead) == sizeof(read) && fs_read(phead, read, sizeof(read)) == NRF_SUCCESS);
+    CHECK(memcmp(read, expected, sizeof(read)) == 0);
+}
+
+/*
+    Batch tests
+*/
+
+static void test_batch_is_atomic_on_power_cut() {
+    /* Reset cuts batch write after every word, mount finds either every staged record or none of them */
+    static fs_batch_t batch;
+    static const uint8_t palette[20] = {1, 2, 3, 4, 5, 6, 7, 8, 9, 10};
+    uint32_t old_value = 1, new_value = 2;
+    uint32_t words = 0, total_words;
+    do {
+        mount_erased(NULL);
+        CHECK(fs_write("batch_a", &old_value, sizeof(old_value)) != NULL);
+        settle();
+
+        fs_batch_begin(&batch);
+        CHECK(fs_batch_stage(&batch, "batch_a", &new_value, sizeof(new_value)) == NRF_SUCCESS);
+        CHECK(fs_batch_stage(&batch, "batch_b", &new_value, sizeof(new_value)) == NRF_SUCCESS);
+        CHECK(fs_batch_stage(&batch, "batch_c", palette, sizeof(palette)) == NRF_SUCCESS);
+        CHECK(fs_batch_commit_async(&batch, NULL, NULL) == NRF_SUCCESS);
+        uintptr_t tail = PART_HOT->tail_addr;
+        fs_process();
+        CHECK(flash_emu_queue_count() == 1);
+        total_words = (PART_HOT->tail_addr - tail) / WORD_SIZE;
+
+        flash_emu_power_cut_during(words);
+        CHECK(fs_init() == NRF_SUCCESS);
+        fs_header_t *a = fs_find_record("batch_a");
+        fs_header_t *b = fs_find_record("batch_b");
+        fs_header_t *c = fs_find_record("batch_c");
+        CHECK(a != NULL);
+        if (words < total_words) {
+            CHECK(*(const uint32_t*) get_record_data(a) == old_value && b == NULL && c == NULL);
+        }
+        else {
+            CHECK(*(const uint32_t*) get_record_data(a) == new_value && b != NULL && c != NULL);
+            CHECK(*(const uint32_t*) get_record_data(b) == new_value);
+            CHECK(fs_record_length(c) == sizeof(palette) && memcmp(get_record_data(c), palette, sizeof(palette)) == 0);
+        }
+
+        /* Torn batch is sealed, next write goes after it */
+        CHECK(fs_write("after_cut", &new_value, sizeof(new_value)) != NULL);
+        settle();
+        CHECK(fs_init() == NRF_SUCCESS);
+        CHECK(fs_find_record("after_cut") != NULL);
+        CHECK((fs_find_record("batch_b") != NULL) == (words >= total_words));
+    } while (words++ < total_words);
+}
+
+/*
+    Large object tests
+*/
+
+#define LARGE_LENGTH (CODE_PAGE_SIZE + CODE_PAGE_SIZE / 2)
+
+static void fill_large(uint8_t *object) {
+    for (size_t i = 0; i < LARGE_LENGTH; i++) {
+        object[i] = i * 7 + i / 256;
+    }
+}
+
+static void check_large(const uint8_t *object) {
+    static uint8_t read[LARGE_LENGTH];
+    fs_large_reader_t reader;
+    CHECK(fs_large_open_read(&reader, "large") == NRF_SUCCESS);
+    size_t total = 0, bytes_read;
+    do {
+        CHECK(fs_large_read(&reader, read + total, FS_MIN(333, LARGE_LENGTH - total), &bytes_read) == NRF_SUCCESS);
+        total += bytes_read;
+    } while (bytes_read > 0 && total < LARGE_LENGTH);
+    CHECK(total == LARGE_LENGTH && memcmp(read, object, LARGE_LENGTH) == 0);
+    CHECK(fs_large_read(&reader, read, 1, &bytes_read) == NRF_SUCCESS && bytes_read == 0);
+}
+
+/* Writes until every page of hot instance is compacted at least once */
+static void churn_hot_pages() {
+    fs_stats_t before, after;
+    fs_get_stats(FS_PART_HOT, &before);
+    uint32_t i = 0;
+    do {
+        CHECK(fs_write("last_hsv", &i, 3) != NULL);
+        fs_process();
+        fs_get_stats(FS_PART_HOT, &after);
+        i++;
+    } while (after.compactions < before.compactions + 2 * (PART_HOT->end_page - PART_HOT->first_page));
+    settle();
+}
+
+static void test_large_object_survives_compaction_and_remount() {
+    static uint8_t object[LARGE_LENGTH];
+    fill_large(object);
+    mount_erased(NULL);
+
+    /* Half of chunks is written before compaction moves extents of open writer */
+    static fs_large_writer_t writer;
+    CHECK(fs_large_open_write(&writer, "large") == NRF_SUCCESS);
+    for (size_t offset = 0; offset < LARGE_LENGTH; offset += 700) {
+        CHECK(fs_large_append(&writer, object + offset, FS_MIN(700, LARGE_LENGTH - offset)) == NRF_SUCCESS);
+        if (offset == 2100) {
+            churn_hot_pages();
+        }
+    }
+    CHECK(writer.extents_count > CODE_PAGE_SIZE / FS_LARGE_EXTENT_SIZE);
+    CHECK(fs_large_commit(&writer) == NRF_SUCCESS);
+    CHECK(fs_find_record("large")->type == FS_RECORD_LARGE);
+    fs_large_abort(&writer);
+    check_large(object);
+
+    /* Open reader finds extents moved by compaction */
+    uint8_t head[100];
+    size_t bytes_read;
+    fs_large_reader_t reader;
+    CHECK(fs_large_open_read(&reader, "large") == NRF_SUCCESS);
+    CHECK(fs_large_read(&reader, head, sizeof(head), &bytes_read) == NRF_SUCCESS && bytes_read == sizeof(head));
+    fs_header_t *phead = fs_find_record("large");
+    churn_hot_pages();
+    CHECK(fs_find_record("large") != phead);
+    CHECK(fs_large_read(&reader, head, sizeof(head), &bytes_read) == NRF_SUCCESS && bytes_read == sizeof(head));
+    CHECK(memcmp(head, object + sizeof(head), sizeof(head)) == 0);
+    check_large(object);
+
+    CHECK(fs_init() == NRF_SUCCESS);
+    check_large(object);
+}
+
+/*
+    Counter tests
+*/
+
+static void test_counter_survives_compaction() {
+    /*
+        Main loop steps flash op by op, increments are flushed whenever compaction runs,
+        so some of them are written between copy of counter record and its update in index.
+    */
+    static const uint8_t filler[3] = {1, 2, 3};
+    mount_erased(NULL);
+    fs_stats_t before, after;
+    fs_get_stats(FS_PART_HOT, &before);
+    uint32_t value = 0;
+    for (uint32_t i = 0; i < 20000; i++) {
+        if (PART_HOT->gc.state == FS_GC_COPY || i % 64 == 0) {
+            CHECK(fs_counter_add("counter", 1) == NRF_SUCCESS);
+            fs_flush_request();
+            value++;
+        }
+        if (write_queue_s.count < FS_WRITE_QUEUE_SIZE / 2) {
+            CHECK(fs_write_async("last_hsv", (void*) filler, sizeof(filler), NULL, NULL) == NRF_SUCCESS);
+        }
+        fs_process();
+        flash_emu_step();
+    }
+    settle();
+    fs_get_stats(FS_PART_HOT, &after);
+    CHECK(after.compactions > before.compactions);
+    CHECK(fs_find_record("counter")->type == FS_RECORD_COUNTER);
+    CHECK(fs_counter_get("counter") == value);
+
+    CHECK(fs_init() == NRF_SUCCESS);
+    CHECK(fs_counter_get("counter") == value);
+}
+
+/*
+    Asynchronous write tests
+*/
+
+static struct {
+    uint32_t calls;
+    ret_code_t result;
+    fs_header_t *phead;
+} async_cbs[FS_WRITE_QUEUE_SIZE];
+
+static void async_write_cb(ret_code_t result, fs_header_t *phead, void *p_context) {
+    size_t i = (size_t) p_context;
+    async_cbs[i].calls++;
+    async_cbs[i].result = result;
+    async_cbs[i].phead = phead;
+}
+
+static void test_async_write_calls_back_once_per_op() {
+    static uint32_t values[FS_WRITE_QUEUE_SIZE];
+    char name[RECORDNAME_MAX_LENGTH + 1];
+    mount_erased(NULL);
+    memset(async_cbs, 0, sizeof(async_cbs));
+
+    for (size_t i = 0; i < FS_WRITE_QUEUE_SIZE; i++) {
+        values[i] = 0xA5000000 | i;
+        sprintf(name, "async%u", (unsigned) i);
+        CHECK(fs_write_async(name, &values[i], sizeof(values[i]), async_write_cb, (void*) i) == NRF_SUCCESS);
+    }
+    /* Queue is full until fs_process() finishes some write */
+    uint32_t extra = 0;
+    CHECK(fs_write_async("extra", &extra, sizeof(extra), async_write_cb, NULL) == NRF_ERROR_NO_MEM);
+    CHECK(fs_patch_async("async0", 0, &extra, sizeof(extra), async_write_cb, NULL) == NRF_ERROR_NO_MEM);
+    CHECK(fs_find_record("async0") == NULL);
+
+    settle();
+    for (size_t i = 0; i < FS_WRITE_QUEUE_SIZE; i++) {
+        sprintf(name, "async%u", (unsigned) i);
+        uint32_t read = 0;
+        CHECK(async_cbs[i].calls == 1 && async_cbs[i].result == NRF_SUCCESS);
+        CHECK(async_cbs[i].phead != NULL && async_cbs[i].phead == fs_find_record(name));
+        CHECK(fs_read(async_cbs[i].phead, &read, sizeof(read)) == NRF_SUCCESS && read == values[i]);
+    }
+
+    /* Failed write is reported by callback too */
+    memset(async_cbs, 0, sizeof(async_cbs));
+    CHECK(fs_patch_async("missing", 0, &extra, sizeof(extra), async_write_cb, NULL) == NRF_SUCCESS);
+    settle();
+    CHECK(async_cbs[0].calls == 1 && async_cbs[0].result != NRF_SUCCESS && async_cbs[0].phead == NULL);
+}
+
+/*
+    Shared fstorage queue tests
+*/
+
+static void foreign_evt_handler(nrf_fstorage_evt_t *p_evt) {
+}
+
+/* Other user of fstorage queue, like fds, writes to log pages */
+NRF_FSTORAGE_DEF(nrf_fstorage_t foreign_instance) = {
+    .evt_handler = foreign_evt_handler,
+    .start_addr = FS_LOG_START,
+    .end_addr = FS_LOG_END
+};
+
+static uint32_t foreign_fill_queue(uint32_t addr) {
+    /* Word takes the same value twice, so log pages take two passes without erase */
+    static const uint32_t word = 0x12345678;
+    while (nrf_fstorage_write(&foreign_instance, addr, &word, sizeof(word), NULL) == NRF_SUCCESS) {
+        addr = addr + sizeof(word) == FS_LOG_END ? FS_LOG_START : addr + sizeof(word);
+    }
+    CHECK(flash_emu_queue_count() == NRF_FSTORAGE_SD_QUEUE_SIZE);
+    return addr;
+}
+
+static void test_full_fstorage_queue_delays_operations() {
+    /* Deferred writes and compaction steps find queue full, operations wait instead of failing */
+    uint8_t value[FS_DEFERRED_MAX_LENGTH], read[FS_DEFERRED_MAX_LENGTH];
+    uint32_t foreign_addr = FS_LOG_START;
+    mount_erased(NULL);
+    CHECK(nrf_fstorage_init(&foreign_instance, &nrf_fstorage_sd, NULL) == NRF_SUCCESS);
+
+    fs_stats_t before, after;
+    fs_get_stats(FS_PART_HOT, &before);
+    for (uint32_t i = 0; i < 400; i++) {
+        memset(value, i, sizeof(value));
+        CHECK(fs_write_deferred("deferred", value, sizeof(value)) == NRF_SUCCESS);
+        fs_flush_request();
+
+        foreign_addr = foreign_fill_queue(foreign_addr);
+        fs_process();
+        CHECK(fs_flash_is_busy());
+        settle();
+    }
+    fs_get_stats(FS_PART_HOT, &after);
+    CHECK(after.compactions > before.compactions);
+
+    memset(value, 399, sizeof(value));
+    CHECK(fs_read(fs_find_record("deferred"), read, sizeof(read)) == NRF_SUCCESS);
+    CHECK(memcmp(read, value, sizeof(read)) == 0);
+}
+
+static void test_deferred_slot_is_freed_when_written() {
+    /* More records than slots go through write-behind cache one after another */
+    mount_erased(NULL);
+    for (uint32_t i = 0; i < 4 * FS_DEFERRED_SLOTS; i++) {
+        char name[RECORDNAME_MAX_LENGTH + 1];
+        snprintf(name, sizeof(name), "deferred%" PRIu32, i);
+        CHECK(fs_write_deferred(name, &i, sizeof(i)) == NRF_SUCCESS);
+        fs_flush_request();
+        settle();
+        CHECK(*(const uint32_t*) get_record_data(fs_find_record(name)) == i);
+    }
+    for (size_t i = 0; i < FS_DEFERRED_SLOTS; i++) {
+        CHECK(deferred_s.slots[i].record_name[0] == '\0');
+    }
+}
+
+static void log_settle() {
+    do {
+        fs_log_process();
+    } while (flash_emu_step());
+    fs_log_process();
+}
+
+static void test_log_erase_waits_for_quiet_window() {
+    fs_log_iter_t iter;
+    fs_log_entry_t entry;
+    uint32_t index, value;
+    flash_emu_init();
+    CHECK(fs_log_init() == NRF_SUCCESS);
+    for (value = 0; value < FS_LOG_PAGES * LOG_SLOTS; value++) {
+        CHECK(fs_log_append(1, &value, sizeof(value)) == NRF_SUCCESS);
+        log_settle();
+    }
+
+    // Every page is full, so next entry reuses the oldest page
+    fs_sched_traffic();
+    CHECK(fs_log_append(1, &value, sizeof(value)) == NRF_SUCCESS);
+    for (uint32_t i = 0; i < 10; i++) {
+        fs_log_process();
+        CHECK(!fs_flash_is_busy());
+        flash_emu_advance(FS_SCHED_QUIET_MS * 1000 / 20);
+    }
+    flash_emu_advance(FS_SCHED_QUIET_MS * 1000);
+    fs_log_process();
+    CHECK(fs_flash_is_busy());
+    log_settle();
+
+    fs_log_iter_init(&iter, true);
+    CHECK(fs_log_iter_next(&iter, &entry, &index));
+    CHECK(index == value && memcmp(entry.data, &value, sizeof(value)) == 0);
+    fs_log_iter_init(&iter, false);
+    CHECK(fs_log_iter_next(&iter, &entry, &index));
+    CHECK(index == LOG_SLOTS && memcmp(entry.data, &index, sizeof(index)) == 0);
+}
+
+int main(void) {
+    RUN_TEST(test_lookup_is_constant);
+    RUN_TEST(test_lookup_after_delete_and_remount);
+    RUN_TEST(test_name_ids_are_reused);
+    RUN_TEST(test_mount_from_checkpoint_then_write);
+    RUN_TEST(test_corrupted_checkpoint_falls_back_to_full_scan);
+    RUN_TEST(test_stale_checkpoint_is_checked_on_mount);
+    RUN_TEST(test_crc32_check_value);
+    RUN_TEST(test_crc_covers_header_and_payload);
+    RUN_TEST(test_corrupted_record_is_not_mounted);
+    RUN_TEST(test_churn_doesnt_copy_cold_records);
+    RUN_TEST(test_churn_spreads_erases_over_pages);
+    RUN_TEST(test_policy_change_moves_records_on_mount);
+    RUN_TEST(test_map_is_invalid_after_rewrite_and_compaction);
+    RUN_TEST(test_v1_pages_are_migrated_on_mount);
+    RUN_TEST(test_rle_round_trip);
+    RUN_TEST(test_packed_record_round_trip);
+    RUN_TEST(test_patch_applies_over_packed);
+    RUN_TEST(test_append_grows_record);
+    RUN_TEST(test_batch_is_atomic_on_power_cut);
+    RUN_TEST(test_large_object_survives_compaction_and_remount);
+    RUN_TEST(test_counter_survives_compaction);
+    RUN_TEST(test_async_write_calls_back_once_per_op);
+    RUN_TEST(test_full_fstorage_queue_delays_operations);
+    RUN_TEST(test_deferred_slot_is_freed_when_written);
+    RUN_TEST(test_log_erase_waits_for_quiet_window);
+    return 0;
+}
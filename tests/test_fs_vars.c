@@ -0,0 +1,179 @@
+/* Module is included, so tests reach its pin and timer handlers */
+#include "../modules/button_control/button_control.c"
+
+#include "fs_vars.h"
+#include "flash_emu.h"
+#include "nrf_pwr_mgmt.h"
+#include "test.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#define TEST_LEVEL_DEFAULT 100
+
+typedef struct {
+    uint8_t r, g, b;
+} test_rgb_t;
+
+FS_VAR_DEF(uint16_t, test_level, "test_level", TEST_LEVEL_DEFAULT);
+FS_VAR_DEF(test_rgb_t, test_rgb, "test_rgb", {1, 2, 3});
+
+static const test_rgb_t test_rgb_default = {1, 2, 3};
+
+/* Main loop runs until flash is idle, batch queued by fs_vars_process() is started by fs_process() */
+static void settle() {
+    do {
+        fs_vars_process();
+        fs_process();
+    } while (flash_emu_step());
+    fs_vars_process();
+    fs_process();
+}
+
+/* Reset, variables get initializers back and are restored from flash */
+static void boot() {
+    debouncing_timeout_ms = DEBOUNCING_TIMEOUT_MS;
+    test_level = TEST_LEVEL_DEFAULT;
+    test_rgb = test_rgb_default;
+    CHECK(fs_init() == NRF_SUCCESS);
+    CHECK(fs_vars_init() == NRF_SUCCESS);
+}
+
+static bool is_stored(const char *record_name, const void *data, size_t length) {
+    uint8_t read[16];
+    fs_header_t *phead = fs_find_record((char*) record_name);
+    return phead != NULL && fs_record_length(phead) == length &&
+           fs_read(phead, read, sizeof(read)) == NRF_SUCCESS && memcmp(read, data, length) == 0;
+}
+
+/*
+    Restore tests
+*/
+
+static void test_defaults_are_kept_when_not_stored() {
+    flash_emu_init();
+    boot();
+    CHECK(debouncing_timeout_ms == DEBOUNCING_TIMEOUT_MS);
+    CHECK(test_level == TEST_LEVEL_DEFAULT);
+    CHECK(memcmp(&test_rgb, &test_rgb_default, sizeof(test_rgb)) == 0);
+
+    /* Defaults are not written */
+    settle();
+    CHECK(fs_find_record("debounce_ms") == NULL && fs_find_record("test_level") == NULL && fs_find_record("test_rgb") == NULL);
+}
+
+static void test_stored_values_are_loaded() {
+    uint32_t debounce_ms = 20;
+    uint16_t level = 7;
+    uint32_t rgb_of_other_size = 0x00040506;
+    flash_emu_init();
+    boot();
+    CHECK(fs_write("debounce_ms", &debounce_ms, sizeof(debounce_ms)) != NULL);
+    CHECK(fs_write("test_level", &level, sizeof(level)) != NULL);
+    CHECK(fs_write("test_rgb", &rgb_of_other_size, sizeof(rgb_of_other_size)) != NULL);
+    settle();
+
+    boot();
+    CHECK(debouncing_timeout_ms == debounce_ms);
+    CHECK(test_level == level);
+    /* Stored with other size, default is kept */
+    CHECK(memcmp(&test_rgb, &test_rgb_default, sizeof(test_rgb)) == 0);
+
+    const fs_var_t *var = fs_var_find("test_level");
+    CHECK(var != NULL && var->p_data == &test_level && var->size == sizeof(test_level));
+    CHECK(fs_var_find("not_a_var") == NULL);
+}
+
+/*
+    Write tests
+*/
+
+static void test_changed_vars_are_written_after_quiet_window() {
+    static const test_rgb_t rgb = {7, 8, 9};
+    flash_emu_init();
+    boot();
+    test_level = 55;
+    CHECK(fs_var_changed(&test_level) == NRF_SUCCESS);
+    test_rgb = rgb;
+    CHECK(fs_var_changed(&test_rgb) == NRF_SUCCESS);
+    CHECK(fs_var_changed(&rgb) == NRF_ERROR_NOT_FOUND);
+
+    /* Nothing is written while variables keep changing */
+    settle();
+    CHECK(fs_find_record("test_level") == NULL && fs_find_record("test_rgb") == NULL);
+
+    flash_emu_advance((FS_VARS_QUIET_MS + 1) * 1000);
+    settle();
+    CHECK(is_stored("test_level", &test_level, sizeof(test_level)));
+    CHECK(is_stored("test_rgb", &rgb, sizeof(rgb)));
+    CHECK(fs_find_record("debounce_ms") == NULL);
+
+    /* Flush request doesn`t wait for quiet window */
+    test_level = 56;
+    CHECK(fs_var_changed(&test_level) == NRF_SUCCESS);
+    fs_vars_flush_request();
+    settle();
+    CHECK(is_stored("test_level", &test_level, sizeof(test_level)));
+
+    boot();
+    CHECK(test_level == 56 && memcmp(&test_rgb, &rgb, sizeof(rgb)) == 0);
+}
+
+static void test_shutdown_waits_for_dirty_vars() {
+    flash_emu_init();
+    boot();
+    unsigned shutdowns = nrf_pwr_mgmt_shutdown_count();
+    debouncing_timeout_ms = 30;
+    CHECK(fs_var_changed(&debouncing_timeout_ms) == NRF_SUCCESS);
+
+    /* Handler of fs_vars is called when fs one has saved statistics, then variables are written */
+    nrf_pwr_mgmt_shutdown(NRF_PWR_MGMT_SHUTDOWN_RESET);
+    CHECK(nrf_pwr_mgmt_shutdown_count() == shutdowns);
+    settle();
+    CHECK(nrf_pwr_mgmt_shutdown_count() == shutdowns);
+    settle();
+    CHECK(nrf_pwr_mgmt_shutdown_count() == shutdowns + 1);
+    CHECK(is_stored("debounce_ms", &debouncing_timeout_ms, sizeof(debouncing_timeout_ms)));
+
+    boot();
+    CHECK(debouncing_timeout_ms == 30);
+}
+
+/*
+    Debounce tests
+*/
+
+static void check_debounce_ticks(uint32_t stored_ms, uint32_t timeout_ms) {
+    flash_emu_init();
+    boot();
+    CHECK(fs_write("debounce_ms", &stored_ms, sizeof(stored_ms)) != NULL);
+    settle();
+    boot();
+    CHECK(debouncing_timeout_ms == stored_ms);
+
+    button_control_init();
+    button_handler(BUTTON1, NRF_GPIOTE_POLARITY_TOGGLE);
+    CHECK(debouncing_timer->started && debouncing_timer->timeout_ticks == APP_TIMER_TICKS(timeout_ms));
+    /* Pin events are ignored until timer expires */
+    debouncing_timer->started = false;
+    button_handler(BUTTON1, NRF_GPIOTE_POLARITY_TOGGLE);
+    CHECK(!debouncing_timer->started);
+    debouncing_timer->handler(NULL);
+    CHECK(!button_config_s.debounce_proccessing);
+}
+
+static void test_debounce_timeout_is_clamped() {
+    /* Zero timeout wouldn`t start timer, button would never be handled again */
+    check_debounce_ticks(0, DEBOUNCING_MIN_TIMEOUT_MS);
+    check_debounce_ticks(20, 20);
+    check_debounce_ticks(DEBOUNCING_TIMEOUT_MS, DEBOUNCING_TIMEOUT_MS);
+}
+
+int main(void) {
+    RUN_TEST(test_defaults_are_kept_when_not_stored);
+    RUN_TEST(test_stored_values_are_loaded);
+    RUN_TEST(test_changed_vars_are_written_after_quiet_window);
+    RUN_TEST(test_shutdown_waits_for_dirty_vars);
+    RUN_TEST(test_debounce_timeout_is_clamped);
+    return 0;
+}
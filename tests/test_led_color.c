@@ -0,0 +1,109 @@
+/* Module is included, so tests reach gamma table and compare values */
+#include "../modules/led_color/led_color.c"
+
+#include "test.h"
+
+#include <inttypes.h>
+#include <math.h>
+#include <stdio.h>
+
+/* Max difference of interpolated table from CIE formula, in UINT16_MAX scale */
+#define GAMMA_MAX_ERROR 4
+
+static const uint32_t base_clocks_hz[] = {
+    [NRF_PWM_CLK_16MHz] = 16000000, [NRF_PWM_CLK_8MHz] = 8000000, [NRF_PWM_CLK_4MHz] = 4000000,
+    [NRF_PWM_CLK_2MHz] = 2000000, [NRF_PWM_CLK_1MHz] = 1000000, [NRF_PWM_CLK_500kHz] = 500000,
+    [NRF_PWM_CLK_250kHz] = 250000, [NRF_PWM_CLK_125kHz] = 125000
+};
+
+static double get_exact_linear(uint16_t perceptual) {
+    double l = perceptual / (double) UINT16_MAX;
+    return l > 0.08 ? pow((l * 100 + 16) / 116, 3) : l * 100 / 903.3;
+}
+
+static void test_pwm_config() {
+    pwm_control_init();
+    uint32_t refresh_hz = base_clocks_hz[nrfx_pwm_config.base_clock] / nrfx_pwm_config.top_value;
+    CHECK(nrfx_pwm_config.top_value == PWM_TOP_VALUE);
+    CHECK(refresh_hz >= PWM_MIN_REFRESH_HZ);
+    /* Slower clock would flicker */
+    CHECK(nrfx_pwm_config.base_clock == NRF_PWM_CLK_125kHz || refresh_hz / 2 < PWM_MIN_REFRESH_HZ);
+    printf("    PWM_TOP_VALUE %d, base clock %" PRIu32 " Hz, refresh %" PRIu32 " Hz\n", PWM_TOP_VALUE,
+           base_clocks_hz[nrfx_pwm_config.base_clock], refresh_hz);
+}
+
+static void test_gamma_table() {
+    int max_error = 0;
+    CHECK(perceptual_to_linear(0) == 0 && perceptual_to_linear(UINT16_MAX) == UINT16_MAX);
+    for (uint32_t perceptual = 0; perceptual <= UINT16_MAX; perceptual++) {
+        uint16_t linear = perceptual_to_linear(perceptual);
+        int error = abs(linear - (int) lround(get_exact_linear(perceptual) * UINT16_MAX));
+        max_error = error > max_error ? error : max_error;
+        CHECK(perceptual == 0 || linear >= perceptual_to_linear(perceptual - 1));
+    }
+    printf("    max error of interpolated table %d / %d\n", max_error, UINT16_MAX);
+    CHECK(max_error <= GAMMA_MAX_ERROR);
+}
+
+static void check_sweep(uint8_t s, bool green) {
+    /*
+        Brightness sweep of hue 0 at saturation s, value 0..100, red or green channel. Green
+        channel of saturated color is dimmer than red one. Old pipeline wrote 8 bit
+        component straight to compare register with top 255, gamma of 8 bit component with
+        the same top shows what 16 bit color and PWM_TOP_VALUE add.
+    */
+    uint32_t old_levels = 0, gamma8_levels = 0, new_levels = 0;
+    int old_prev = -1, gamma8_prev = -1, new_prev = -1;
+    uint8_t first_lit_v = 0;
+    for (uint8_t v = 0; v <= 100; v++) {
+        hsv_data_t hsv = new_hsv(0, s, v);
+        rgb_data_t rgb = get_rgb_from_hsv(&hsv);
+        int old = green ? rgb.g : rgb.r;
+        int gamma8 = (perceptual_to_linear(old * 257) * UINT8_MAX + UINT16_MAX / 2) / UINT16_MAX;
+        set_led2_color_by_hsv(&hsv);
+        int new = green ? seq_values.channel_1 : seq_values.channel_0;
+
+        CHECK(new >= new_prev && new <= PWM_TOP_VALUE);
+        old_levels += old != old_prev;
+        gamma8_levels += gamma8 != gamma8_prev;
+        new_levels += new != new_prev;
+        if (first_lit_v == 0 && new != 0) {
+            first_lit_v = v;
+        }
+        old_prev = old;
+        gamma8_prev = gamma8;
+        new_prev = new;
+    }
+    printf("    s %3u %-5s: old %3" PRIu32 " levels, 8 bit gamma %3" PRIu32 " levels, new %3" PRIu32 " levels of %d,"
+           " first lit at v %u\n", s, green ? "green" : "red", old_levels, gamma8_levels, new_levels, PWM_TOP_VALUE, first_lit_v);
+    /* Dim end is lit and no step of 8 bit pipelines is merged */
+    CHECK(green || new_prev == PWM_TOP_VALUE);
+    CHECK(first_lit_v == 1 && new_levels >= old_levels && new_levels > gamma8_levels);
+}
+
+static void test_brightness_sweep_levels() {
+    check_sweep(100, false);
+    check_sweep(50, true);
+    check_sweep(80, true);
+}
+
+static void test_led1_ramp() {
+    uint32_t levels = 0;
+    int prev = -1;
+    for (uint32_t brightness = 0; brightness <= LED1_BRIGHTNESS_MAX; brightness++) {
+        set_led1_brightness(brightness);
+        CHECK(seq_values.channel_3 >= prev);
+        levels += seq_values.channel_3 != prev;
+        prev = seq_values.channel_3;
+    }
+    CHECK(prev == PWM_TOP_VALUE);
+    printf("    led1 brightness 0..%d: %" PRIu32 " levels\n", LED1_BRIGHTNESS_MAX, levels);
+}
+
+int main(void) {
+    RUN_TEST(test_pwm_config);
+    RUN_TEST(test_gamma_table);
+    RUN_TEST(test_brightness_sweep_levels);
+    RUN_TEST(test_led1_ramp);
+    return 0;
+}